@@ -0,0 +1,18 @@
+PROGRAM = dsbautostart
+
+isEmpty(PREFIX) {
+	PREFIX=/usr/local
+}
+
+isEmpty(DATADIR) {
+	DATADIR=$${PREFIX}/share/$${PROGRAM}
+}
+
+isEmpty(LIBEXECDIR) {
+	LIBEXECDIR=$${PREFIX}/libexec
+}
+
+GUI_PROGRAM = $${PROGRAM}-gui
+GUI_PATH    = $${LIBEXECDIR}/$${GUI_PROGRAM}
+
+DEFINES += PROGRAM=\\\"$${PROGRAM}\\\"
@@ -1,50 +1,15 @@
-PROGRAM = dsbautostart
+include(config.pri)
 
-isEmpty(PREFIX) {
-    PREFIX=/usr/local
-}
+TEMPLATE = subdirs
+SUBDIRS  = lib launcher gui
 
-isEmpty(DATADIR) {
-	DATADIR=$${PREFIX}/share/$${PROGRAM}
-}
-
-QT	    += widgets
-TEMPLATE     = app
-TARGET	     = $${PROGRAM}
-DEPENDPATH  += . lib qt-helper
-INCLUDEPATH += . lib qt-helper
-TRANSLATIONS = locale/dsbautostart_de.ts \
-               locale/dsbautostart_fr.ts
-APPSDIR	     = $${PREFIX}/share/applications
-DEFINES	    += PROGRAM=\\\"$${PROGRAM}\\\" LOCALE_PATH=\\\"$${DATADIR}\\\"
-INSTALLS     = target locales desktopfile
-QMAKE_POST_LINK = $(STRIP) $(TARGET)
-QMAKE_EXTRA_TARGETS += distclean cleanqm readme readmemd
-
-target.files	  = $${PROGRAM}
-target.path	  = $${PREFIX}/bin
-
-desktopfile.path  = $${APPSDIR}
-desktopfile.files = $${PROGRAM}.desktop
-
-HEADERS += src/list.h \
-	   src/editwin.h \
-	   src/listwidget.h \
-           src/mainwin.h \
-	   src/desktopfile.h \
-	   lib/dsbautostart.h \
-           lib/qt-helper/qt-helper.h 
-SOURCES += src/list.cpp \
-	   src/editwin.cpp \
-	   src/listwidget.cpp \
-           src/main.cpp \
-           src/mainwin.cpp \
-	   src/desktopfile.cpp \
-	   lib/dsbautostart.c \
-           lib/qt-helper/qt-helper.cpp
-
-locales.path = $${DATADIR}
+lib.file	 = lib/lib.pro
+launcher.file	 = launcher/launcher.pro
+launcher.depends = lib
+gui.file	 = src/gui.pro
+gui.depends	 = lib
 
+QMAKE_EXTRA_TARGETS += readme readmemd
 
 readme.target = readme
 readme.files = readme.mdoc
@@ -57,14 +22,3 @@ readmemd.target = readmemd
 readmemd.files = readme.mdoc
 readmemd.commands = mandoc -mdoc -Tmarkdown readme.mdoc | \
 			sed -e \'1,1d; \$$,\$$d\' > README.md
-
-qtPrepareTool(LRELEASE, lrelease)
-for(a, TRANSLATIONS) {
-	cmd = $$LRELEASE $${a}
-	system($$cmd)
-}
-locales.files += locale/*.qm
-
-cleanqm.commands  = rm -f $${locales.files}
-distclean.depends = cleanqm
-
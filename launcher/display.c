@@ -0,0 +1,288 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Wait until the display server accepts connections. The socket is
+ * $XDG_RUNTIME_DIR/$WAYLAND_DISPLAY if WAYLAND_DISPLAY is set, else
+ * /tmp/.X11-unix/X<n> for a local $DISPLAY. If connecting fails, the
+ * directory of the socket is watched (inotify(7) on Linux, kqueue(2) on
+ * the BSDs), and connecting is retried when something was added. If the
+ * directory doesn't exist yet, its parent is watched until it appears.
+ * A socket that exists, but refuses connections, is retried every
+ * DISPLAY_RETRY_MS, since the server might not listen yet.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+#endif
+
+#include "display.h"
+#include "evloop.h"
+
+#define PATH_X11_SOCKET_DIR "/tmp/.X11-unix"
+
+static int  wfd = -1;
+static int  retry_timer;
+static int  max_timer;
+static bool watching_dir;	/* Watching the socket's dir, not its parent */
+static char sockpath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static char sockdir[sizeof(sockpath)];
+static void (*ready_cb)(void);
+
+static int  socket_path(void);
+static int  watch(void);
+static bool try_connect(void);
+static void check(void);
+static void changed(int, void *);
+static void retry(void *);
+static void timeout(void *);
+static void release(void);
+
+/*
+ * Call the given function once the display accepts connections, or
+ * after DISPLAY_MAX_WAIT_MS.
+ */
+int
+display_wait(void (*cb)(void))
+{
+	ready_cb = cb;
+	if (socket_path() == -1) {
+		/* Remote, or no display. Nothing to wait for. */
+		release();
+		return (0);
+	}
+	if (try_connect()) {
+		release();
+		return (0);
+	}
+	if ((max_timer = ev_add_timer(DISPLAY_MAX_WAIT_MS, timeout,
+	    NULL)) == -1)
+		return (-1);
+	if (watch() == -1) {
+		warn("Failed to watch %s", sockdir);
+		release();
+		return (0);
+	}
+	/* It might have appeared while we set up the watch. */
+	check();
+
+	return (0);
+}
+
+/*
+ * Determine the path of the display server's socket. Returns -1 if there
+ * is no local display.
+ */
+static int
+socket_path()
+{
+	char	   *p;
+	const char *disp, *dir;
+
+	if ((disp = getenv("WAYLAND_DISPLAY")) != NULL && *disp != '\0') {
+		if (*disp == '/')
+			(void)snprintf(sockpath, sizeof(sockpath), "%s", disp);
+		else {
+			if ((dir = getenv("XDG_RUNTIME_DIR")) == NULL)
+				return (-1);
+			(void)snprintf(sockpath, sizeof(sockpath), "%s/%s",
+			    dir, disp);
+		}
+	} else if ((disp = getenv("DISPLAY")) != NULL && *disp != '\0') {
+		/* Only local displays: ":0", ":0.0", "unix:0" */
+		if (strncmp(disp, "unix:", 5) == 0)
+			disp += 4;
+		if (*disp != ':')
+			return (-1);
+		(void)snprintf(sockpath, sizeof(sockpath),
+		    PATH_X11_SOCKET_DIR "/X%.*s", (int)strcspn(disp + 1, "."),
+		    disp + 1);
+	} else
+		return (-1);
+	(void)strcpy(sockdir, sockpath);
+	if ((p = strrchr(sockdir, '/')) != NULL)
+		*p = '\0';
+	return (0);
+}
+
+static bool
+try_connect()
+{
+	int		   s;
+	bool		   ok;
+	struct sockaddr_un sun;
+
+	if ((s = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return (false);
+	(void)memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	(void)strcpy(sun.sun_path, sockpath);
+	ok = connect(s, (struct sockaddr *)&sun, sizeof(sun)) == 0;
+	(void)close(s);
+
+	return (ok);
+}
+
+/*
+ * Watch the directory of the socket, or, if it doesn't exist, its parent.
+ */
+static int
+watch()
+{
+	char	   parent[sizeof(sockdir)], *p;
+	const char *dir;
+
+	(void)strcpy(parent, sockdir);
+	if ((p = strrchr(parent, '/')) == NULL)
+		(void)strcpy(parent, ".");
+	else if (p == parent)
+		p[1] = '\0';
+	else
+		*p = '\0';
+	watching_dir = access(sockdir, F_OK) == 0;
+	dir = watching_dir ? sockdir : parent;
+#ifdef __linux__
+	if (wfd == -1) {
+		if ((wfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+			return (-1);
+		if (ev_add_fd(wfd, changed, NULL) == -1)
+			return (-1);
+	}
+	if (inotify_add_watch(wfd, dir, IN_CREATE | IN_MOVED_TO |
+	    IN_ATTRIB) == -1)
+		return (-1);
+#else
+	if (wfd != -1) {
+		ev_del_fd(wfd);
+		(void)close(wfd);
+	}
+	if ((wfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return (-1);
+	if (ev_watch_dir(wfd, changed, NULL) == -1)
+		return (-1);
+#endif
+	return (0);
+}
+
+/*
+ * Something was added to the watched directory.
+ */
+static void
+changed(int fd, void *arg)
+{
+#ifdef __linux__
+	char buf[4096];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+#else
+	(void)fd;
+#endif
+	(void)arg;
+	if (!watching_dir && access(sockdir, F_OK) == 0) {
+		/* The socket's directory was created. */
+		if (watch() == -1) {
+			warn("Failed to watch %s", sockdir);
+			release();
+			return;
+		}
+	}
+	check();
+}
+
+static void
+check()
+{
+	struct stat sb;
+
+	if (ready_cb == NULL)
+		return;
+	if (try_connect()) {
+		release();
+		return;
+	}
+	/*
+	 * The socket exists, but the server isn't listening yet. There
+	 * won't be another event for it, so poll.
+	 */
+	if (retry_timer != 0 || stat(sockpath, &sb) == -1 ||
+	    !S_ISSOCK(sb.st_mode))
+		return;
+	if ((retry_timer = ev_add_timer(DISPLAY_RETRY_MS, retry,
+	    NULL)) == -1) {
+		warn("ev_add_timer()");
+		retry_timer = 0;
+		release();
+	}
+}
+
+static void
+retry(void *arg)
+{
+	(void)arg;
+	retry_timer = 0;
+	check();
+}
+
+static void
+timeout(void *arg)
+{
+	(void)arg;
+	max_timer = 0;
+	warnx("Display not ready after %ds: %s", DISPLAY_MAX_WAIT_MS / 1000,
+	    sockpath);
+	release();
+}
+
+static void
+release()
+{
+	void (*cb)(void);
+
+	if ((cb = ready_cb) == NULL)
+		return;
+	ready_cb = NULL;
+	if (retry_timer != 0)
+		ev_del_timer(retry_timer);
+	if (max_timer != 0)
+		ev_del_timer(max_timer);
+	retry_timer = max_timer = 0;
+	if (wfd != -1) {
+		ev_del_fd(wfd);
+		(void)close(wfd);
+		wfd = -1;
+	}
+	cb();
+}
@@ -0,0 +1,484 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * A minimal event loop for the launcher. It waits for readable file
+ * descriptors, timers, and terminated child processes. On Linux it's
+ * based on epoll(7) and signalfd(2), on the BSDs on kqueue(2). SIGCHLD
+ * and the signals registered by ev_add_signal() are blocked while the loop
+ * is in use, so no signal handlers are involved.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+#else
+# include <sys/event.h>
+#endif
+
+#include "evloop.h"
+
+#define MAX_EVENTS 16
+
+enum { FD_READ, FD_PRI, FD_VNODE };
+
+struct ev_fd_s {
+	int	 fd;
+	void	 *arg;
+	ev_fd_cb cb;
+};
+
+struct ev_proc_s {
+	pid_t	   pid;
+	void	   *arg;
+	ev_proc_cb cb;
+};
+
+struct ev_signal_s {
+	int	     sig;
+	void	     *arg;
+	ev_signal_cb cb;
+};
+
+struct ev_timer_s {
+	int	    id;
+	long	    when;
+	void	    *arg;
+	ev_timer_cb cb;
+};
+
+static int		 qfd = -1;
+static int		 sigfd = -1;
+static int		 timer_id;
+static bool		 quit;
+static size_t		 nfds, nprocs, ntimers, nsignals;
+static sigset_t		 omask, sigmask;
+static struct ev_fd_s	 *fds;
+static struct ev_proc_s	 *procs;
+static struct ev_timer_s *timers;
+static struct ev_signal_s *signals;
+
+static int  add_fd(int, int, ev_fd_cb, void *);
+static void dispatch_signal(int);
+static void reap_children(void);
+static void *grow(void *, size_t, size_t);
+
+int
+ev_init()
+{
+	if (qfd != -1)
+		return (0);
+	(void)sigemptyset(&sigmask);
+	(void)sigaddset(&sigmask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &sigmask, &omask) == -1)
+		return (-1);
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if ((qfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		return (-1);
+	if ((sigfd = signalfd(-1, &sigmask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+		return (-1);
+	(void)memset(&ev, 0, sizeof(ev));
+	ev.events  = EPOLLIN;
+	ev.data.fd = sigfd;
+	if (epoll_ctl(qfd, EPOLL_CTL_ADD, sigfd, &ev) == -1)
+		return (-1);
+#else
+	struct kevent kev;
+
+	if ((qfd = kqueue()) == -1)
+		return (-1);
+	EV_SET(&kev, SIGCHLD, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+	if (kevent(qfd, &kev, 1, NULL, 0, NULL) == -1)
+		return (-1);
+#endif
+	return (0);
+}
+
+/*
+ * Must be called by child processes after fork(), before they exec.
+ */
+void
+ev_child_init()
+{
+	(void)sigprocmask(SIG_SETMASK, &omask, NULL);
+}
+
+long
+ev_now_ms()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+long
+ev_now_us()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+int
+ev_add_fd(int fd, ev_fd_cb cb, void *arg)
+{
+	return (add_fd(fd, FD_READ, cb, arg));
+}
+
+/*
+ * Like ev_add_fd(), but wait for priority events (POLLPRI). This is how
+ * the kernel signals PSI triggers. Without epoll, this is the same as
+ * ev_add_fd().
+ */
+int
+ev_add_fd_pri(int fd, ev_fd_cb cb, void *arg)
+{
+	return (add_fd(fd, FD_PRI, cb, arg));
+}
+
+#ifndef __linux__
+/*
+ * Call "cb" when the directory "fd" refers to was written to, i.e., when
+ * files were added, removed, or renamed.
+ */
+int
+ev_watch_dir(int fd, ev_fd_cb cb, void *arg)
+{
+	return (add_fd(fd, FD_VNODE, cb, arg));
+}
+#endif
+
+static int
+add_fd(int fd, int kind, ev_fd_cb cb, void *arg)
+{
+	struct ev_fd_s *p;
+
+	if ((p = grow(fds, nfds, sizeof(*fds))) == NULL)
+		return (-1);
+	fds = p;
+#ifdef __linux__
+	struct epoll_event ev;
+
+	(void)memset(&ev, 0, sizeof(ev));
+	ev.events  = kind == FD_PRI ? EPOLLPRI : EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(qfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		return (-1);
+#else
+	struct kevent kev;
+
+	if (kind == FD_VNODE) {
+		EV_SET(&kev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		    NOTE_WRITE | NOTE_EXTEND, 0, NULL);
+	} else
+		EV_SET(&kev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(qfd, &kev, 1, NULL, 0, NULL) == -1)
+		return (-1);
+#endif
+	fds[nfds].fd  = fd;
+	fds[nfds].cb  = cb;
+	fds[nfds].arg = arg;
+	nfds++;
+
+	return (0);
+}
+
+/*
+ * Stop watching the given file descriptor. Must be called before the
+ * file descriptor is closed.
+ */
+void
+ev_del_fd(int fd)
+{
+	size_t i;
+
+	for (i = 0; i < nfds && fds[i].fd != fd; i++)
+		;
+	if (i == nfds)
+		return;
+	fds[i] = fds[--nfds];
+#ifdef __linux__
+	(void)epoll_ctl(qfd, EPOLL_CTL_DEL, fd, NULL);
+#else
+	struct kevent kev;
+
+	EV_SET(&kev, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	(void)kevent(qfd, &kev, 1, NULL, 0, NULL);
+#endif
+}
+
+/*
+ * Call "cb" when the child process "pid" terminated. The callback gets
+ * the exit status and the resource usage of the child. ev_init() must
+ * have been called before the child was created.
+ */
+int
+ev_watch_proc(pid_t pid, ev_proc_cb cb, void *arg)
+{
+	struct ev_proc_s *p;
+
+	if ((p = grow(procs, nprocs, sizeof(*procs))) == NULL)
+		return (-1);
+	procs = p;
+	procs[nprocs].pid = pid;
+	procs[nprocs].cb  = cb;
+	procs[nprocs].arg = arg;
+	nprocs++;
+
+	return (0);
+}
+
+/*
+ * Stop watching the given child process. It's still reaped when it
+ * terminates.
+ */
+void
+ev_unwatch_proc(pid_t pid)
+{
+	size_t i;
+
+	for (i = 0; i < nprocs; i++) {
+		if (procs[i].pid == pid) {
+			procs[i] = procs[--nprocs];
+			return;
+		}
+	}
+}
+
+/*
+ * Call "cb" when the given signal arrives.
+ */
+int
+ev_add_signal(int sig, ev_signal_cb cb, void *arg)
+{
+	struct ev_signal_s *p;
+
+	if ((p = grow(signals, nsignals, sizeof(*signals))) == NULL)
+		return (-1);
+	signals = p;
+	(void)sigaddset(&sigmask, sig);
+	if (sigprocmask(SIG_BLOCK, &sigmask, NULL) == -1)
+		return (-1);
+#ifdef __linux__
+	if (signalfd(sigfd, &sigmask, 0) == -1)
+		return (-1);
+#else
+	struct kevent kev;
+
+	EV_SET(&kev, sig, EVFILT_SIGNAL, EV_ADD, 0, 0, NULL);
+	if (kevent(qfd, &kev, 1, NULL, 0, NULL) == -1)
+		return (-1);
+#endif
+	signals[nsignals].sig = sig;
+	signals[nsignals].cb  = cb;
+	signals[nsignals].arg = arg;
+	nsignals++;
+
+	return (0);
+}
+
+/*
+ * Call "cb" once after "ms" milliseconds. Returns an ID which can be
+ * passed to ev_del_timer().
+ */
+int
+ev_add_timer(long ms, ev_timer_cb cb, void *arg)
+{
+	struct ev_timer_s *p;
+
+	if ((p = grow(timers, ntimers, sizeof(*timers))) == NULL)
+		return (-1);
+	timers = p;
+	timers[ntimers].id   = ++timer_id;
+	timers[ntimers].when = ev_now_ms() + ms;
+	timers[ntimers].cb   = cb;
+	timers[ntimers].arg  = arg;
+	ntimers++;
+
+	return (timer_id);
+}
+
+void
+ev_del_timer(int id)
+{
+	size_t i;
+
+	for (i = 0; i < ntimers; i++) {
+		if (timers[i].id == id) {
+			timers[i] = timers[--ntimers];
+			return;
+		}
+	}
+}
+
+void
+ev_quit()
+{
+	quit = true;
+}
+
+/*
+ * Dispatch events until ev_quit() is called, or there is nothing left
+ * to wait for.
+ */
+int
+ev_run()
+{
+	int	 i, n, timeout;
+	long	 now, next;
+	size_t	 j;
+	void	 *arg;
+	ev_fd_cb cb;
+	ev_timer_cb tcb;
+
+	for (quit = false; !quit;) {
+		if (nfds == 0 && nprocs == 0 && ntimers == 0)
+			break;
+		now = ev_now_ms();
+		for (j = 0, next = -1; j < ntimers; j++) {
+			if (next == -1 || timers[j].when < next)
+				next = timers[j].when;
+		}
+		timeout = next == -1 ? -1 : next <= now ? 0 : (int)(next - now);
+#ifdef __linux__
+		struct epoll_event ev[MAX_EVENTS];
+
+		if ((n = epoll_wait(qfd, ev, MAX_EVENTS, timeout)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		for (i = 0; i < n; i++) {
+			int fd = ev[i].data.fd;
+#else
+		struct kevent ev[MAX_EVENTS];
+		struct timespec ts, *tsp = NULL;
+
+		if (timeout >= 0) {
+			ts.tv_sec  = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			tsp = &ts;
+		}
+		if ((n = kevent(qfd, NULL, 0, ev, MAX_EVENTS, tsp)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		for (i = 0; i < n; i++) {
+			if (ev[i].filter == EVFILT_SIGNAL) {
+				dispatch_signal((int)ev[i].ident);
+				continue;
+			}
+			int fd = (int)ev[i].ident;
+#endif
+			if (fd == sigfd) {
+#ifdef __linux__
+				struct signalfd_siginfo si;
+
+				while (read(sigfd, &si, sizeof(si)) ==
+				    sizeof(si))
+					dispatch_signal((int)si.ssi_signo);
+#endif
+				continue;
+			}
+			for (j = 0; j < nfds && fds[j].fd != fd; j++)
+				;
+			if (j < nfds) {
+				cb = fds[j].cb; arg = fds[j].arg;
+				cb(fd, arg);
+			}
+		}
+		for (now = ev_now_ms(); !quit;) {
+			for (j = 0; j < ntimers && timers[j].when > now; j++)
+				;
+			if (j == ntimers)
+				break;
+			tcb = timers[j].cb; arg = timers[j].arg;
+			timers[j] = timers[--ntimers];
+			tcb(arg);
+		}
+	}
+	return (0);
+}
+
+static void
+dispatch_signal(int sig)
+{
+	size_t i;
+
+	if (sig == SIGCHLD) {
+		reap_children();
+		return;
+	}
+	for (i = 0; i < nsignals; i++) {
+		if (signals[i].sig == sig)
+			signals[i].cb(sig, signals[i].arg);
+	}
+}
+
+static void
+reap_children()
+{
+	int	   status;
+	pid_t	   pid;
+	size_t	   i;
+	struct rusage	 ru;
+	struct ev_proc_s proc;
+
+	while ((pid = wait4(-1, &status, WNOHANG, &ru)) > 0) {
+		for (i = 0; i < nprocs && procs[i].pid != pid; i++)
+			;
+		if (i == nprocs)
+			continue;
+		proc = procs[i];
+		procs[i] = procs[--nprocs];
+		proc.cb(pid, status, &ru, proc.arg);
+	}
+}
+
+static void *
+grow(void *array, size_t n, size_t size)
+{
+	/* Grow in steps of 8 elements. */
+	if (n % 8 != 0)
+		return (array);
+	return (realloc(array, (n + 8) * size));
+}
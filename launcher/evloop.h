@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EVLOOP_H_
+#define _EVLOOP_H_
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+typedef void (*ev_fd_cb)(int fd, void *arg);
+typedef void (*ev_proc_cb)(pid_t pid, int status, const struct rusage *ru,
+	     void *arg);
+typedef void (*ev_timer_cb)(void *arg);
+typedef void (*ev_signal_cb)(int sig, void *arg);
+
+int  ev_init(void);
+int  ev_add_fd(int fd, ev_fd_cb cb, void *arg);
+int  ev_add_fd_pri(int fd, ev_fd_cb cb, void *arg);
+#ifndef __linux__
+int  ev_watch_dir(int fd, ev_fd_cb cb, void *arg);
+#endif
+int  ev_watch_proc(pid_t pid, ev_proc_cb cb, void *arg);
+int  ev_add_timer(long ms, ev_timer_cb cb, void *arg);
+int  ev_add_signal(int sig, ev_signal_cb cb, void *arg);
+int  ev_run(void);
+void ev_del_fd(int fd);
+void ev_del_timer(int id);
+void ev_unwatch_proc(pid_t pid);
+void ev_quit(void);
+void ev_child_init(void);
+long ev_now_ms(void);
+long ev_now_us(void);
+#endif /* !_EVLOOP_H_ */
@@ -0,0 +1,286 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Launch history. For every command, we record how much CPU time it
+ * used in the first HIST_WINDOW_MS after it was started, how long it took
+ * to exit if it exited within that time, and how often it failed in a
+ * row. The scheduler uses this to start cheap commands first, and to
+ * defer expensive ones. The history is written to
+ * $XDG_CACHE_HOME/dsbautostart/history. It only contains entries of
+ * existing desktop files, and malformed lines are ignored.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifndef __linux__
+# include <sys/param.h>
+# include <sys/sysctl.h>
+# include <sys/user.h>
+#endif
+
+#include "launcher.h"
+#include "history.h"
+
+#define HIST_FILE	"history"
+#define HIST_MAGIC	"dsbautostart-history 1"
+#define HIST_MAX_LINES	1024
+#define HIST_MAX_RUNS	100
+#define HIST_MAX_MS	(3600 * 1000)
+
+static int parse_line(char *, char **, hist_t *);
+static int parse_num(const char *, int, int *);
+
+/*
+ * Read the history, and assign the records to the given jobs. A missing
+ * or unreadable history file is not an error.
+ */
+int
+history_load(job_t *jobs, int njobs)
+{
+	int    i, n;
+	char   *path, *id, buf[_POSIX_PATH_MAX + 64];
+	FILE   *fp;
+	hist_t h;
+
+	if ((path = dsbautostart_cache_path(HIST_FILE)) == NULL)
+		return (-1);
+	if ((fp = fopen(path, "r")) == NULL) {
+		free(path);
+		return (errno == ENOENT ? 0 : -1);
+	}
+	free(path);
+	if (fgets(buf, sizeof(buf), fp) == NULL ||
+	    (buf[strcspn(buf, "\n")] = '\0', strcmp(buf, HIST_MAGIC) != 0)) {
+		(void)fclose(fp);
+		return (0);
+	}
+	for (n = 0; n < HIST_MAX_LINES && fgets(buf, sizeof(buf), fp) != NULL;
+	    n++) {
+		if (strchr(buf, '\n') == NULL) {
+			/* Overlong line. Skip the rest of it. */
+			while (fgets(buf, sizeof(buf), fp) != NULL &&
+			    strchr(buf, '\n') == NULL)
+				;
+			continue;
+		}
+		if (parse_line(buf, &id, &h) == -1)
+			continue;
+		for (i = 0; i < njobs; i++) {
+			if (strcmp(jobs[i].id, id) == 0) {
+				jobs[i].hist = h;
+				break;
+			}
+		}
+	}
+	(void)fclose(fp);
+
+	return (0);
+}
+
+/*
+ * Write the records of the given jobs to the history file.
+ */
+int
+history_save(job_t *jobs, int njobs)
+{
+	int    i, fd;
+	char   *path, *tmp;
+	FILE   *fp;
+	size_t len;
+
+	if ((path = dsbautostart_cache_path(HIST_FILE)) == NULL)
+		return (-1);
+	len = strlen(path) + sizeof(".XXXXXX");
+	if ((tmp = malloc(len)) == NULL) {
+		free(path);
+		return (-1);
+	}
+	(void)snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			(void)close(fd);
+			(void)unlink(tmp);
+		}
+		free(path); free(tmp);
+		return (-1);
+	}
+	(void)fprintf(fp, "%s\n", HIST_MAGIC);
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].hist.runs == 0 || strpbrk(jobs[i].id, "\t\n"))
+			continue;
+		(void)fprintf(fp, "%s\t%d\t%d\t%d\t%d\n", jobs[i].id,
+		    jobs[i].hist.runs, jobs[i].hist.cpu_ms,
+		    jobs[i].hist.exit_ms, jobs[i].hist.fails);
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+		(void)unlink(tmp);
+		free(path); free(tmp);
+		return (-1);
+	}
+	free(path); free(tmp);
+
+	return (0);
+}
+
+/*
+ * Add a sample to the given record. Times are averaged with the previous
+ * samples, weighting the latest sample by 1/4.
+ */
+void
+history_record(hist_t *h, long cpu_ms, long exit_ms, bool failed)
+{
+	if (cpu_ms < 0)
+		cpu_ms = 0;
+	else if (cpu_ms > HIST_MAX_MS)
+		cpu_ms = HIST_MAX_MS;
+	if (exit_ms > HIST_MAX_MS)
+		exit_ms = HIST_MAX_MS;
+	if (h->runs == 0) {
+		h->cpu_ms  = (int)cpu_ms;
+		h->exit_ms = (int)exit_ms;
+	} else {
+		h->cpu_ms = (int)((3L * h->cpu_ms + cpu_ms) / 4);
+		if (exit_ms == -1 || h->exit_ms == -1)
+			h->exit_ms = (int)exit_ms;
+		else
+			h->exit_ms = (int)((3L * h->exit_ms + exit_ms) / 4);
+	}
+	if (h->runs < HIST_MAX_RUNS)
+		h->runs++;
+	if (!failed)
+		h->fails = 0;
+	else if (h->fails < HIST_MAX_RUNS)
+		h->fails++;
+}
+
+/*
+ * Commands which used a lot of CPU time after they were started, or
+ * which failed several times in a row, are considered expensive.
+ */
+bool
+history_expensive(const hist_t *h)
+{
+	if (h->runs == 0)
+		return (false);
+	return (h->cpu_ms >= HIST_EXPENSIVE_MS || h->fails >= HIST_FLAKY);
+}
+
+/*
+ * Return the CPU time in milliseconds the given process used so far, or
+ * -1 if it couldn't be determined.
+ */
+long
+history_cpu_ms(pid_t pid)
+{
+#ifdef __linux__
+	int	      i;
+	long	      hz;
+	char	      path[32], buf[1024], *p;
+	FILE	      *fp;
+	unsigned long utime, stime;
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+	p = fgets(buf, sizeof(buf), fp);
+	(void)fclose(fp);
+	/* The command name can contain spaces. Skip up to the last ')'. */
+	if (p == NULL || (p = strrchr(buf, ')')) == NULL)
+		return (-1);
+	/* Skip the fields 3 (state) to 13 (cmajflt). */
+	for (i = 0, p++; i < 11; i++) {
+		if ((p = strchr(p + 1, ' ')) == NULL)
+			return (-1);
+	}
+	if (sscanf(p, " %lu %lu", &utime, &stime) != 2)
+		return (-1);
+	if ((hz = sysconf(_SC_CLK_TCK)) <= 0)
+		return (-1);
+	return ((long)((utime + stime) * 1000 / hz));
+#else
+	int		  mib[4];
+	size_t		  len;
+	struct kinfo_proc kp;
+
+	mib[0] = CTL_KERN; mib[1] = KERN_PROC; mib[2] = KERN_PROC_PID;
+	mib[3] = (int)pid;
+	len = sizeof(kp);
+	if (sysctl(mib, 4, &kp, &len, NULL, 0) == -1 || len != sizeof(kp))
+		return (-1);
+	return ((long)(kp.ki_runtime / 1000));
+#endif
+}
+
+/*
+ * Parse a line of the form "<ID>\t<runs>\t<cpu_ms>\t<exit_ms>\t<fails>".
+ */
+static int
+parse_line(char *line, char **id, hist_t *h)
+{
+	char *p, *f[5];
+	int  i;
+
+	line[strcspn(line, "\n")] = '\0';
+	for (i = 0, p = line; i < 5; i++) {
+		f[i] = p;
+		if ((p = strchr(p, '\t')) != NULL)
+			*p++ = '\0';
+		else if (i < 4)
+			return (-1);
+	}
+	if (*f[0] == '\0' ||
+	    parse_num(f[1], HIST_MAX_RUNS, &h->runs) == -1 ||
+	    parse_num(f[2], HIST_MAX_MS, &h->cpu_ms) == -1 ||
+	    parse_num(f[3], HIST_MAX_MS, &h->exit_ms) == -1 ||
+	    parse_num(f[4], HIST_MAX_RUNS, &h->fails) == -1 || h->runs < 1)
+		return (-1);
+	*id = f[0];
+
+	return (0);
+}
+
+/*
+ * Parse a number in [-1, max].
+ */
+static int
+parse_num(const char *str, int max, int *val)
+{
+	long l;
+	char *ep;
+
+	errno = 0;
+	l = strtol(str, &ep, 10);
+	if (errno != 0 || ep == str || *ep != '\0' || l < -1 || l > max)
+		return (-1);
+	*val = (int)l;
+
+	return (0);
+}
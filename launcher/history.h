@@ -0,0 +1,48 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define HIST_WINDOW_MS	  5000	/* Time a command is observed after start */
+#define HIST_EXPENSIVE_MS 500	/* CPU time in the window of costly commands */
+#define HIST_FLAKY	  3	/* # of failures in a row of flaky commands */
+
+typedef struct hist_s {
+	int runs;	/* # of recorded starts, 0 if unknown */
+	int cpu_ms;	/* Average CPU time in the first HIST_WINDOW_MS */
+	int exit_ms;	/* Average time until exit, or -1 if still running */
+	int fails;	/* # of failures in a row */
+} hist_t;
+
+struct job_s;
+
+extern int  history_load(struct job_s *, int);
+extern int  history_save(struct job_s *, int);
+extern void history_record(hist_t *, long cpu_ms, long exit_ms, bool failed);
+extern long history_cpu_ms(pid_t);
+extern bool history_expensive(const hist_t *);
+#endif /* !_HISTORY_H_ */
@@ -0,0 +1,99 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _LAUNCHER_H_
+#define _LAUNCHER_H_
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "dsbautostart.h"
+#include "rctl.h"
+#include "history.h"
+#include "prefetch.h"
+
+typedef enum {
+	JOB_WAITING,	/* Waiting for prerequisites */
+	JOB_RUNNING,	/* Spawned, but not ready yet */
+	JOB_READY,	/* Spawned, and dependents may start */
+	JOB_FAILED,	/* Could not be started, or exited with an error */
+	JOB_SKIPPED,	/* Excluded, not installed, or requirement failed */
+	JOB_EXITED,	/* Exited after it became ready */
+	JOB_BACKOFF	/* Waiting to be restarted */
+} job_state_t;
+
+typedef enum {
+	RESTART_NEVER, RESTART_ON_FAILURE, RESTART_ALWAYS
+} restart_t;
+
+struct job_s;
+
+typedef struct job_dep_s {
+	bool	     required;	/* X-DSB-Requires instead of X-DSB-After */
+	struct job_s *job;
+} job_dep_t;
+
+typedef struct job_s {
+	int	       npending;	/* # of prerequisites not ready yet */
+	int	       nfails;		/* # of consecutive early exits */
+	int	       nrestarts;
+	int	       status;		/* Last exit status */
+	int	       timer;		/* Restart timer ID */
+	int	       sample_timer;	/* Timer ID for the history sample */
+	int	       order;		/* Position in the start order, from 1 */
+	int	       profile;		/* Index in the resource profile, or -1 */
+	long	       est_start;	/* Estimated start time in ms */
+	long	       started;		/* Time of last start in ms */
+	char	       *id;		/* Desktop file ID */
+	const char     *rule;		/* Key which caused the job to be skipped */
+	const char     *rule_value;	/* Value of that key */
+	bool	       ready_on_exit;	/* X-DSB-Ready=exit */
+	bool	       deferred;	/* Start delayed because it's expensive,
+					   or waiting for the display */
+	bool	       background;	/* X-DSB-Background=true */
+	bool	       needs_display;	/* X-DSB-NeedsDisplay=true */
+	pid_t	       pid;
+	pid_t	       running;		/* PID of an instance started before */
+	size_t	       ndependents;
+	entry_t	       *entry;
+	job_dep_t      *dependents;	/* Jobs waiting for this one */
+	job_state_t    state;
+	restart_t      restart;		/* X-DSB-Restart */
+	rctl_t	       rctl;		/* Resource controls */
+	hist_t	       hist;		/* Launch history */
+	pf_set_t       *prefetch;	/* Files mapped at the last start */
+	desktop_file_t *df;
+} job_t;
+
+struct opts_s {
+	bool supervise;	/* Stay resident, and restart crashed commands */
+	bool dry_run;	/* Print the launch plan, but don't start anything */
+	bool watch;	/* Stay resident, and start entries added later */
+	long profile_ms; /* Duration of the resource profile, 0 if disabled */
+	long profile_interval_ms;
+};
+
+extern struct opts_s opts;
+extern pid_t spawn(job_t *);
+extern void  release_parent(int);
+#endif /* !_LAUNCHER_H_ */
@@ -0,0 +1,50 @@
+include(../config.pri)
+
+#
+# The launcher handles -a and -c, and only links against libc and
+# libdsbautostart. Everything else is handed over to the GUI.
+#
+TEMPLATE	 = app
+TARGET		 = $${PROGRAM}
+CONFIG		+= console
+CONFIG		-= qt app_bundle
+DEPENDPATH	+= . ../lib
+INCLUDEPATH	+= . ../lib
+DEFINES		+= GUI_PATH=\\\"$${GUI_PATH}\\\"
+LIBS		+= -L$$OUT_PWD/../lib -ldsbautostart
+PRE_TARGETDEPS	+= $$OUT_PWD/../lib/libdsbautostart.a
+INSTALLS	 = target
+QMAKE_POST_LINK  = $(STRIP) $(TARGET)
+
+target.files = $${PROGRAM}
+target.path  = $${PREFIX}/bin
+
+HEADERS += launcher.h \
+	   display.h \
+	   evloop.h \
+	   history.h \
+	   logcap.h \
+	   plan.h \
+	   prefetch.h \
+	   pressure.h \
+	   procidx.h \
+	   profile.h \
+	   rctl.h \
+	   schedule.h \
+	   supervise.h \
+	   watch.h
+SOURCES += main.c \
+	   display.c \
+	   evloop.c \
+	   history.c \
+	   logcap.c \
+	   plan.c \
+	   prefetch.c \
+	   pressure.c \
+	   procidx.c \
+	   profile.c \
+	   rctl.c \
+	   schedule.c \
+	   spawn.c \
+	   supervise.c \
+	   watch.c
@@ -0,0 +1,259 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Output capture. The stdout and stderr of every command are connected to
+ * a non-blocking pipe, which is read by the event loop. The output is
+ * prefixed with timestamps, collected in a buffer of BUF_SIZE bytes per
+ * pipe, and appended to $XDG_CACHE_HOME/dsbautostart/logs/<ID>.log when
+ * the buffer is full, FLUSH_MS after new output arrived, or when the
+ * pipe is closed. Log files are rotated to <ID>.log.1 when they exceed
+ * LOG_MAX_SIZE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "launcher.h"
+#include "logcap.h"
+#include "evloop.h"
+
+#define BUF_SIZE	16384
+#define FLUSH_MS	1000
+#define LOG_MAX_SIZE	(512 * 1024)
+#define TIMESTAMP_FMT	"%Y-%m-%d %H:%M:%S "
+#define TIMESTAMP_LEN	sizeof("YYYY-mm-dd HH:MM:SS ")
+
+typedef struct logbuf_s {
+	int	fd;
+	int	timer;		/* Flush timer ID or 0 */
+	bool	bol;		/* Next byte starts a new line */
+	char	*path;		/* Log file */
+	char	buf[BUF_SIZE];
+	size_t	len;		/* # of bytes in the buffer */
+	job_t	*job;
+} logbuf_t;
+
+static void read_cb(int, void *);
+static void flush_cb(void *);
+static void flush(logbuf_t *);
+static void put(logbuf_t *, const char *, size_t);
+static void close_buf(logbuf_t *);
+static int  open_log(const char *, size_t);
+
+/*
+ * Create a pipe for the output of the given job, and start reading from
+ * its non-blocking read end. Both ends are closed on exec. This is done
+ * before fork(), so that a child never writes to a pipe nobody reads.
+ * Returns -1 if the output can't be captured. The child then keeps our
+ * stdout and stderr. If fork() fails, it's enough to close the write end.
+ */
+int
+logcap_open(job_t *job, int fds[2])
+{
+	logbuf_t *lb;
+
+	if (pipe(fds) == -1) {
+		warn("pipe()");
+		return (-1);
+	}
+	(void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1) {
+		warn("fcntl()");
+		goto error;
+	}
+	if ((lb = calloc(1, sizeof(logbuf_t))) == NULL) {
+		warn("calloc()");
+		goto error;
+	}
+	if ((lb->path = dsbautostart_log_path(job->df)) == NULL) {
+		warnx("%s: %s", job->id, dsbautostart_strerror());
+		free(lb);
+		goto error;
+	}
+	lb->fd	= fds[0];
+	lb->bol = true;
+	lb->job = job;
+	if (ev_add_fd(fds[0], read_cb, lb) == -1) {
+		warn("ev_add_fd()");
+		free(lb->path);
+		free(lb);
+		goto error;
+	}
+	return (0);
+error:
+	(void)close(fds[0]); (void)close(fds[1]);
+
+	return (-1);
+}
+
+/*
+ * Connect the stdout and stderr of the child to the pipe. Called between
+ * fork() and exec().
+ */
+void
+logcap_child(int fds[2])
+{
+	(void)close(fds[0]);
+	(void)dup2(fds[1], STDOUT_FILENO);
+	(void)dup2(fds[1], STDERR_FILENO);
+	(void)close(fds[1]);
+}
+
+static void
+read_cb(int fd, void *arg)
+{
+	char	 buf[4096];
+	ssize_t	 n;
+	logbuf_t *lb = arg;
+
+	for (;;) {
+		if ((n = read(fd, buf, sizeof(buf))) > 0) {
+			put(lb, buf, (size_t)n);
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && errno == EAGAIN)
+			break;
+		/* EOF or error. All writers are gone. */
+		close_buf(lb);
+		return;
+	}
+	if (lb->len > 0 && lb->timer == 0) {
+		if ((lb->timer = ev_add_timer(FLUSH_MS, flush_cb, lb)) == -1) {
+			lb->timer = 0;
+			flush(lb);
+		}
+	}
+}
+
+/*
+ * Append the given data to the buffer, and prefix each line with the
+ * current time.
+ */
+static void
+put(logbuf_t *lb, const char *data, size_t len)
+{
+	char   ts[TIMESTAMP_LEN];
+	size_t tslen;
+	time_t now;
+
+	now = time(NULL);
+	tslen = strftime(ts, sizeof(ts), TIMESTAMP_FMT, localtime(&now));
+	for (; len > 0; data++, len--) {
+		if (lb->bol) {
+			lb->bol = false;
+			put(lb, ts, tslen);
+		}
+		if (lb->len == BUF_SIZE)
+			flush(lb);
+		lb->buf[lb->len++] = *data;
+		if (*data == '\n')
+			lb->bol = true;
+	}
+}
+
+static void
+flush_cb(void *arg)
+{
+	logbuf_t *lb = arg;
+
+	lb->timer = 0;
+	flush(lb);
+}
+
+/*
+ * Append the contents of the buffer to the log file. If that fails, the
+ * output is discarded.
+ */
+static void
+flush(logbuf_t *lb)
+{
+	int fd;
+
+	if (lb->timer > 0) {
+		ev_del_timer(lb->timer);
+		lb->timer = 0;
+	}
+	if (lb->len == 0)
+		return;
+	if ((fd = open_log(lb->path, lb->len)) == -1)
+		warn("%s: open(%s)", lb->job->id, lb->path);
+	else {
+		if (write(fd, lb->buf, lb->len) == -1)
+			warn("%s: write(%s)", lb->job->id, lb->path);
+		(void)close(fd);
+	}
+	lb->len = 0;
+}
+
+/*
+ * Open the log file for appending "len" bytes. If it would exceed
+ * LOG_MAX_SIZE, it's rotated first.
+ */
+static int
+open_log(const char *path, size_t len)
+{
+	int	    fd;
+	char	    old[PATH_MAX];
+	struct stat sb;
+
+	fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return (-1);
+	if (fstat(fd, &sb) == 0 && sb.st_size > 0 &&
+	    (size_t)sb.st_size + len > LOG_MAX_SIZE) {
+		(void)close(fd);
+		(void)snprintf(old, sizeof(old), "%s.1", path);
+		if (rename(path, old) == -1)
+			return (-1);
+		fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+		    0600);
+	}
+	return (fd);
+}
+
+static void
+close_buf(logbuf_t *lb)
+{
+	/* Terminate an incomplete last line. */
+	if (!lb->bol)
+		put(lb, "\n", 1);
+	flush(lb);
+	ev_del_fd(lb->fd);
+	(void)close(lb->fd);
+	free(lb->path);
+	free(lb);
+}
@@ -0,0 +1,284 @@
+/*-
+ * Copyright (c) 2016 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dsbautostart.h"
+#include "launcher.h"
+#include "schedule.h"
+#include "plan.h"
+#include "profile.h"
+#include "evloop.h"
+
+struct opts_s opts;
+
+static int release_fd = -1;
+
+static void autostart(void);
+static void detach(void);
+static void create_from_list(void);
+static void usage(void);
+static void exec_gui(char *argv[]);
+static void parse_profile_arg(const char *);
+
+int
+main(int argc, char *argv[])
+{
+	int  ch;
+	bool aflag, cflag;
+
+	aflag = cflag = false;
+	while ((ch = getopt(argc, argv, "acnp:swh")) != -1) {
+		switch (ch) {
+		case 'a':
+			aflag = true;
+			break;
+		case 'c':
+			cflag = true;
+			break;
+		case 'n':
+			aflag = opts.dry_run = true;
+			break;
+		case 'p':
+			aflag = true;
+			parse_profile_arg(optarg);
+			break;
+		case 's':
+			aflag = opts.supervise = true;
+			break;
+		case 'w':
+			aflag = opts.watch = true;
+			break;
+		case '?':
+		case 'h':
+			usage();
+		}
+	}
+	if ((aflag && cflag) || (opts.dry_run && (opts.supervise ||
+	    opts.watch || opts.profile_ms > 0)))
+		usage();
+	if (aflag)
+		autostart();
+	else if (cflag)
+		create_from_list();
+	exec_gui(argv);
+
+	return (EXIT_FAILURE);
+}
+
+static void
+autostart()
+{
+	long	       t0;
+	dsbautostart_t *as;
+	/*
+	 * Keys the launcher uses. Name is needed for the %c field code.
+	 * Comment, Terminal, and the rest are skipped.
+	 */
+	const df_key_t keys[] = {
+		DF_KEY_NAME, DF_KEY_EXEC, DF_KEY_HIDDEN, DF_KEY_TRY_EXEC,
+		DF_KEY_ONLY_SHOW_IN, DF_KEY_NOT_SHOW_IN, DF_KEY_AFTER,
+		DF_KEY_REQUIRES, DF_KEY_READY, DF_KEY_RESTART, DF_KEY_NICE,
+		DF_KEY_IO_CLASS, DF_KEY_IO_PRIORITY, DF_KEY_CPU_AFFINITY,
+		DF_KEY_CGROUP, DF_KEY_CPU_WEIGHT, DF_KEY_MEMORY_HIGH,
+		DF_KEY_BACKGROUND, DF_KEY_ALLOW_MULTIPLE, DF_KEY_NEEDS_DISPLAY
+	};
+
+	if (!opts.supervise && !opts.dry_run)
+		detach();
+	dsbautostart_set_read_keys(keys, sizeof(keys) / sizeof(keys[0]));
+	t0 = ev_now_us();
+	if ((as = dsbautostart_init()) == NULL)
+		errx(EXIT_FAILURE, "%s", dsbautostart_strerror());
+	plan_phase("init", t0);
+	t0 = ev_now_us();
+	if (dsbautostart_build_path_index(!opts.dry_run) == -1)
+		warnx("%s", dsbautostart_strerror());
+	plan_phase("path_index", t0);
+	dsbautostart_stats_dump(as);
+	if (sched_run(as) == -1)
+		exit(EXIT_FAILURE);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Fork, and let the parent wait until the child has started all commands.
+ * The child stays in the background to record the launch history, while
+ * the parent returns to the calling script.
+ */
+static void
+detach()
+{
+	int  pfd[2];
+	char status;
+
+	if (pipe(pfd) == -1) {
+		warn("pipe()");
+		return;
+	}
+	switch (fork()) {
+	case -1:
+		warn("fork()");
+		(void)close(pfd[0]); (void)close(pfd[1]);
+		return;
+	case 0:
+		(void)close(pfd[0]);
+		(void)fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+		release_fd = pfd[1];
+		return;
+	}
+	(void)close(pfd[1]);
+	/* EOF without status means the child died. */
+	status = EXIT_FAILURE;
+	while (read(pfd[0], &status, 1) == -1 && errno == EINTR)
+		;
+	_exit(status == EXIT_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*
+ * Let the parent process created by detach() exit with the given status.
+ */
+void
+release_parent(int status)
+{
+	char c = (char)status;
+
+	if (release_fd == -1)
+		return;
+	(void)write(release_fd, &c, 1);
+	(void)close(release_fd);
+	release_fd = -1;
+}
+
+/*
+ * Parse the argument of -p, which has the form "seconds[:milliseconds]".
+ */
+static void
+parse_profile_arg(const char *arg)
+{
+	char *p;
+
+	opts.profile_ms = strtol(arg, &p, 10) * 1000;
+	opts.profile_interval_ms = PROFILE_INTERVAL_MS;
+	if (*p == ':')
+		opts.profile_interval_ms = strtol(p + 1, &p, 10);
+	if (*p != '\0' || opts.profile_ms <= 0 ||
+	    opts.profile_interval_ms <= 0)
+		errx(EXIT_FAILURE, "Invalid argument to -p: %s", arg);
+}
+
+static void
+create_from_list()
+{
+	char	       *p, *q, *line = NULL;
+	bool	       is_duplicate;
+	entry_t	       *ep;
+	size_t	       n, linecap = 0;
+	dsbautostart_t *as;
+
+	as = dsbautostart_init();
+	if (as == NULL)
+		errx(EXIT_FAILURE, "%s", dsbautostart_strerror());
+	while (getline(&line, &linecap, stdin) > 0) {
+		n = strspn(line, "\n\t ");
+		p = &line[n];
+		(void)strtok(p, "#\n\r");
+		if (*p == '#' || *p == '\0')
+			continue;
+		for (q = strchr(p, '\0'); q != p; q--) {
+			if (*q == '&') {
+				*q = '\0';
+				break;
+			}
+		}
+		is_duplicate = false;
+		for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
+			if (ep->df == NULL)
+				continue;
+			if (strcmp(ep->df->exec, p) == 0) {
+				is_duplicate = true;
+				break;
+			}
+		}
+		if (is_duplicate)
+			continue;
+		if (dsbautostart_entry_add(as, p, NULL, NULL, NULL,
+		    NULL, false) == NULL)
+			err(EXIT_FAILURE, "%s", dsbautostart_strerror());
+	}
+	if (dsbautostart_save(as) == -1)
+		errx(EXIT_FAILURE, "%s", dsbautostart_strerror());
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * The GUI lives in its own binary, so that -a and -c don't have to pay
+ * for loading and relocating Qt.
+ */
+static void
+exec_gui(char *argv[])
+{
+	argv[0] = GUI_PATH;
+	(void)execv(GUI_PATH, argv);
+	err(EXIT_FAILURE, "execv(%s)", GUI_PATH);
+}
+
+static void
+usage()
+{
+	(void)printf("Usage: %s [-h]\n"					    \
+		     "       %s <-a|-c|-n|-p duration[:interval]|-s|-w>\n"   \
+		     "Options\n"					    \
+		     "-a     Autostart commands, and return. A background " \
+		     "process writes\n"					    \
+		     "       their output to the logs until they close " \
+		     "it.\n"						    \
+		     "-c     Create desktop files in the user's autostart " \
+		     "directory from the\n"				    \
+		     "       command list read from stdin.\n"		    \
+		     "-n     Print what -a would do as one JSON object per " \
+		     "entry, without\n"					    \
+		     "       starting anything.\n"			    \
+		     "-p     Autostart commands, and print the peak RSS, "  \
+		     "CPU time, disk reads,\n"				    \
+		     "       and the time to settle of each entry's "	    \
+		     "processes during the\n"				    \
+		     "       first duration seconds. They are sampled "    \
+		     "every interval ms.\n"				    \
+		     "-s     Autostart commands, and restart them if " \
+		     "they terminate\n"				    \
+		     "-w     Autostart commands, and start commands of "   \
+		     "desktop files added\n"				    \
+		     "       later. Can be combined with -s.\n"	    \
+		     "-h     Show this help text.\n", PROGRAM, PROGRAM);
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,223 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Dry-run mode (-n). The scheduler runs as usual, but jobs are marked as
+ * started instead of being spawned. Afterwards, one JSON object per
+ * entry is printed in start order, followed by the time each phase took.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "launcher.h"
+#include "plan.h"
+#include "evloop.h"
+
+#define MAX_PHASES 8
+
+struct phase_s {
+	long	   us;
+	const char *name;
+};
+
+static int	      nphases;
+static struct phase_s phases[MAX_PHASES];
+
+static int  cmp_order(const void *, const void *);
+static void print_str(const char *);
+static void print_strn(const char *, size_t);
+static void print_list(const char *);
+static const char *verdict(const job_t *);
+
+/*
+ * Record the time since "start_us" as duration of the given phase.
+ */
+void
+plan_phase(const char *name, long start_us)
+{
+	if (nphases >= MAX_PHASES)
+		return;
+	phases[nphases].name = name;
+	phases[nphases].us   = ev_now_us() - start_us;
+	nphases++;
+}
+
+void
+plan_print(job_t *jobs, int njobs)
+{
+	int   i, j;
+	char  **argv;
+	job_t **list;
+
+	if ((list = calloc(njobs + 1, sizeof(job_t *))) == NULL)
+		return;
+	for (i = 0; i < njobs; i++)
+		list[i] = &jobs[i];
+	qsort(list, njobs, sizeof(job_t *), cmp_order);
+	for (i = 0; i < njobs; i++) {
+		(void)printf("{\"id\":");
+		print_str(list[i]->id);
+		(void)printf(",\"path\":");
+		print_str(list[i]->df->path);
+		(void)printf(",\"layer\":");
+		print_str(dsbautostart_df_layer(list[i]->df));
+		(void)printf(",\"prio\":%d", list[i]->df->prio);
+		(void)printf(",\"verdict\":\"%s\",\"rule\":", verdict(list[i]));
+		print_str(list[i]->rule);
+		(void)printf(",\"rule_value\":");
+		print_str(list[i]->rule_value);
+		(void)printf(",\"argv\":");
+		if ((argv = dsbautostart_df_argv(list[i]->df)) == NULL)
+			(void)printf("null");
+		else {
+			for (j = 0; argv[j] != NULL; j++) {
+				(void)printf(j == 0 ? "[" : ",");
+				print_str(argv[j]);
+			}
+			(void)printf(j == 0 ? "[]" : "]");
+		}
+		(void)printf(",\"shell\":%s", list[i]->df->shell ? "true" :
+		    "false");
+		(void)printf(",\"after\":");
+		print_list(list[i]->df->after);
+		(void)printf(",\"requires\":");
+		print_list(list[i]->df->require);
+		(void)printf(",\"ready\":\"%s\"", list[i]->ready_on_exit ?
+		    "exit" : "spawn");
+		(void)printf(",\"restart\":\"%s\"",
+		    list[i]->restart == RESTART_ALWAYS ? "always" :
+		    list[i]->restart == RESTART_ON_FAILURE ? "on-failure" :
+		    "never");
+		(void)printf(",\"history\":{\"runs\":%d,\"cpu_ms\":%d,"
+		    "\"exit_ms\":%d,\"fails\":%d}", list[i]->hist.runs,
+		    list[i]->hist.cpu_ms, list[i]->hist.exit_ms,
+		    list[i]->hist.fails);
+		(void)printf(",\"background\":%s", list[i]->background ?
+		    "true" : "false");
+		(void)printf(",\"deferred\":%s", list[i]->deferred ? "true" :
+		    "false");
+		if (list[i]->order > 0) {
+			(void)printf(",\"order\":%d,\"start_ms\":%ld}\n",
+			    list[i]->order, list[i]->est_start);
+		} else
+			(void)printf(",\"order\":null,\"start_ms\":null}\n");
+	}
+	(void)printf("{\"phases\":{");
+	for (i = 0; i < nphases; i++) {
+		(void)printf("%s\"%s_us\":%ld", i > 0 ? "," : "",
+		    phases[i].name, phases[i].us);
+	}
+	(void)printf("}}\n");
+	free(list);
+}
+
+/*
+ * Jobs in start order, followed by the skipped ones in their original
+ * order.
+ */
+static int
+cmp_order(const void *a, const void *b)
+{
+	const job_t *j1 = *(job_t * const *)a;
+	const job_t *j2 = *(job_t * const *)b;
+
+	if (j1->order == 0 || j2->order == 0) {
+		if (j1->order != j2->order)
+			return (j1->order == 0 ? 1 : -1);
+		return (j1 < j2 ? -1 : j1 > j2);
+	}
+	return (j1->order - j2->order);
+}
+
+static const char *
+verdict(const job_t *job)
+{
+	if (job->order > 0)
+		return ("start");
+	if (job->rule == NULL)
+		return ("skip");
+	if (strcmp(job->rule, "NotShowIn") == 0 ||
+	    strcmp(job->rule, "OnlyShowIn") == 0)
+		return ("excluded");
+	if (strcmp(job->rule, "X-DSB-Requires") == 0)
+		return ("requirement-failed");
+	if (job->running > 0)
+		return ("running");
+	return ("unavailable");
+}
+
+/*
+ * Print the given string as JSON string, or null.
+ */
+static void
+print_str(const char *str)
+{
+	if (str == NULL)
+		(void)printf("null");
+	else
+		print_strn(str, strlen(str));
+}
+
+static void
+print_strn(const char *str, size_t len)
+{
+	const unsigned char *p;
+
+	(void)putchar('"');
+	for (p = (const unsigned char *)str; len-- > 0; p++) {
+		if (*p == '"' || *p == '\\')
+			(void)printf("\\%c", *p);
+		else if (*p < 0x20)
+			(void)printf("\\u%04x", *p);
+		else
+			(void)putchar(*p);
+	}
+	(void)putchar('"');
+}
+
+/*
+ * Print a semicolon separated list as JSON array.
+ */
+static void
+print_list(const char *list)
+{
+	int	   n;
+	size_t	   len;
+	const char *p;
+
+	(void)putchar('[');
+	for (n = 0, p = list; p != NULL && *p != '\0'; p += len) {
+		if ((len = strcspn(p, ";")) > 0) {
+			if (n++ > 0)
+				(void)putchar(',');
+			print_strn(p, len);
+		}
+		if (p[len] == ';')
+			len++;
+	}
+	(void)putchar(']');
+}
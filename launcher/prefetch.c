@@ -0,0 +1,423 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Page cache prefetching. Before the commands are started, the kernel is
+ * asked to read their executables, and the files they mapped when they
+ * were started before (shared libraries, mostly), into the page cache
+ * (posix_fadvise(POSIX_FADV_WILLNEED)). The reads are only initiated, so
+ * the I/O for all files is in flight at once, instead of being faulted
+ * in one command after the other.
+ *
+ * The mapped files are learned from /proc/<pid>/maps on Linux, or from
+ * the kern.proc.vmmap sysctl on FreeBSD, when the launch history sample
+ * is taken, and written to $XDG_CACHE_HOME/dsbautostart/prefetch. A file
+ * is dropped from the set if its identity (device, inode, size, mtime)
+ * changed.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef __linux__
+# include <sys/param.h>
+# include <sys/sysctl.h>
+# include <sys/user.h>
+#endif
+
+#include "launcher.h"
+#include "prefetch.h"
+
+#define PF_FILE		"prefetch"
+#define PF_MAGIC	"dsbautostart-prefetch 1"
+#define PF_MAX_LINES	8192
+
+typedef struct pf_req_s {
+	dev_t	   dev;
+	ino_t	   ino;
+	const char *path;
+} pf_req_t;
+
+static int  parse_line(char *, char **, pf_file_t *);
+static int  add_file(pf_set_t *, const char *, ino_t);
+static int  cmp_req(const void *, const void *);
+static bool same_file(const pf_file_t *, const struct stat *);
+static void free_set(pf_set_t *);
+
+/*
+ * Read the learned file sets, and assign them to the given jobs. A
+ * missing or unreadable file is not an error.
+ */
+int
+prefetch_load(job_t *jobs, int njobs)
+{
+	int	  i, n;
+	char	  *path, *id, buf[_POSIX_PATH_MAX + 128];
+	FILE	  *fp;
+	pf_set_t  *set;
+	pf_file_t f;
+
+	if ((path = dsbautostart_cache_path(PF_FILE)) == NULL)
+		return (-1);
+	if ((fp = fopen(path, "r")) == NULL) {
+		free(path);
+		return (errno == ENOENT ? 0 : -1);
+	}
+	free(path);
+	if (fgets(buf, sizeof(buf), fp) == NULL ||
+	    (buf[strcspn(buf, "\n")] = '\0', strcmp(buf, PF_MAGIC) != 0)) {
+		(void)fclose(fp);
+		return (0);
+	}
+	for (n = 0; n < PF_MAX_LINES && fgets(buf, sizeof(buf), fp) != NULL;
+	    n++) {
+		if (strchr(buf, '\n') == NULL) {
+			while (fgets(buf, sizeof(buf), fp) != NULL &&
+			    strchr(buf, '\n') == NULL)
+				;
+			continue;
+		}
+		if (parse_line(buf, &id, &f) == -1)
+			continue;
+		for (i = 0; i < njobs && strcmp(jobs[i].id, id) != 0; i++)
+			;
+		if (i == njobs)
+			continue;
+		if ((set = jobs[i].prefetch) == NULL) {
+			if ((set = calloc(1, sizeof(*set))) == NULL)
+				break;
+			jobs[i].prefetch = set;
+		}
+		if (set->nfiles == PREFETCH_MAX_FILES ||
+		    (f.path = strdup(f.path)) == NULL)
+			continue;
+		set->files[set->nfiles++] = f;
+	}
+	(void)fclose(fp);
+
+	return (0);
+}
+
+/*
+ * Write the learned file sets of the given jobs.
+ */
+int
+prefetch_save(job_t *jobs, int njobs)
+{
+	int	  i, j, fd;
+	char	  *path, *tmp;
+	FILE	  *fp;
+	size_t	  len;
+	pf_file_t *f;
+
+	if ((path = dsbautostart_cache_path(PF_FILE)) == NULL)
+		return (-1);
+	len = strlen(path) + sizeof(".XXXXXX");
+	if ((tmp = malloc(len)) == NULL) {
+		free(path);
+		return (-1);
+	}
+	(void)snprintf(tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		if (fd != -1) {
+			(void)close(fd);
+			(void)unlink(tmp);
+		}
+		free(path); free(tmp);
+		return (-1);
+	}
+	(void)fprintf(fp, "%s\n", PF_MAGIC);
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].prefetch == NULL || strpbrk(jobs[i].id, "\t\n"))
+			continue;
+		for (j = 0; j < jobs[i].prefetch->nfiles; j++) {
+			f = &jobs[i].prefetch->files[j];
+			(void)fprintf(fp, "%s\t%ju\t%ju\t%jd\t%jd\t%s\n",
+			    jobs[i].id, (uintmax_t)f->dev, (uintmax_t)f->ino,
+			    (intmax_t)f->size, (intmax_t)f->mtime, f->path);
+		}
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+		(void)unlink(tmp);
+		free(path); free(tmp);
+		return (-1);
+	}
+	free(path); free(tmp);
+
+	return (0);
+}
+
+/*
+ * Initiate the reads of the executables, and the learned files of the
+ * jobs which are about to be started. Files are requested in inode order
+ * per device, which roughly matches their order on disk.
+ */
+void
+prefetch_run(job_t *jobs, int njobs)
+{
+	int	    i, j, fd;
+	char	    *prog, **progs;
+	size_t	    n, nprogs;
+	pf_req_t    *req;
+	pf_set_t    *set;
+	struct stat sb;
+
+	for (i = 0, n = 0; i < njobs; i++) {
+		if (jobs[i].prefetch != NULL)
+			n += jobs[i].prefetch->nfiles;
+	}
+	req   = calloc(n + njobs, sizeof(pf_req_t));
+	progs = calloc(njobs, sizeof(char *));
+	if (req == NULL || progs == NULL) {
+		free(req); free(progs);
+		return;
+	}
+	for (i = 0, n = nprogs = 0; i < njobs; i++) {
+		/* Background jobs start later. Don't compete for the I/O. */
+		if (jobs[i].state != JOB_WAITING || jobs[i].running > 0 ||
+		    jobs[i].background)
+			continue;
+		if (!jobs[i].df->shell &&
+		    (prog = dsbautostart_df_program(jobs[i].df)) != NULL) {
+			progs[nprogs++] = prog;
+			if (stat(prog, &sb) == 0) {
+				req[n].dev  = sb.st_dev;
+				req[n].ino  = sb.st_ino;
+				req[n++].path = prog;
+			}
+		}
+		if ((set = jobs[i].prefetch) == NULL)
+			continue;
+		for (j = 0; j < set->nfiles;) {
+			if (stat(set->files[j].path, &sb) == -1 ||
+			    !same_file(&set->files[j], &sb)) {
+				/* Replaced, or removed. Forget it. */
+				free(set->files[j].path);
+				set->files[j] = set->files[--set->nfiles];
+				continue;
+			}
+			req[n].dev  = sb.st_dev;
+			req[n].ino  = sb.st_ino;
+			req[n].path = set->files[j++].path;
+			n++;
+		}
+	}
+	qsort(req, n, sizeof(pf_req_t), cmp_req);
+	for (i = 0; i < (int)n; i++) {
+		if (i > 0 && req[i].dev == req[i - 1].dev &&
+		    req[i].ino == req[i - 1].ino)
+			continue;
+		if ((fd = open(req[i].path, O_RDONLY | O_CLOEXEC | O_NONBLOCK))
+		    == -1)
+			continue;
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		(void)close(fd);
+	}
+	for (i = 0; i < (int)nprogs; i++)
+		free(progs[i]);
+	free(progs);
+	free(req);
+}
+
+/*
+ * Record the files the job's process has mapped, replacing the set
+ * learned before.
+ */
+void
+prefetch_learn(job_t *job)
+{
+	pf_set_t *set;
+#ifdef __linux__
+	char	      path[32], buf[_POSIX_PATH_MAX + 128], *p;
+	FILE	      *fp;
+	unsigned long ino;
+	int	      n;
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/maps", (int)job->pid);
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	if ((set = calloc(1, sizeof(*set))) == NULL) {
+		(void)fclose(fp);
+		return;
+	}
+	while (set->nfiles < PREFETCH_MAX_FILES &&
+	    fgets(buf, sizeof(buf), fp) != NULL) {
+		/* address perms offset dev inode path */
+		buf[strcspn(buf, "\n")] = '\0';
+		if (sscanf(buf, "%*s %*s %*s %*s %lu %n", &ino, &n) != 1 ||
+		    ino == 0)
+			continue;
+		p = buf + n;
+		if (*p != '/' || strstr(p, " (deleted)") != NULL)
+			continue;
+		(void)add_file(set, p, (ino_t)ino);
+	}
+	(void)fclose(fp);
+#else
+	int		     mib[4];
+	char		     *buf, *p;
+	size_t		     len;
+	struct kinfo_vmentry *kve;
+
+	mib[0] = CTL_KERN; mib[1] = KERN_PROC; mib[2] = KERN_PROC_VMMAP;
+	mib[3] = (int)job->pid;
+	if (sysctl(mib, 4, NULL, &len, NULL, 0) == -1)
+		return;
+	/* The map might grow in between. */
+	len = len * 4 / 3;
+	if ((buf = malloc(len)) == NULL)
+		return;
+	if (sysctl(mib, 4, buf, &len, NULL, 0) == -1 ||
+	    (set = calloc(1, sizeof(*set))) == NULL) {
+		free(buf);
+		return;
+	}
+	for (p = buf; p < buf + len && set->nfiles < PREFETCH_MAX_FILES;
+	    p += kve->kve_structsize) {
+		kve = (struct kinfo_vmentry *)(void *)p;
+		if (kve->kve_structsize == 0)
+			break;
+		if (kve->kve_type != KVME_TYPE_VNODE || kve->kve_path[0] != '/')
+			continue;
+		(void)add_file(set, kve->kve_path, (ino_t)kve->kve_vn_fileid);
+	}
+	free(buf);
+#endif
+	if (set->nfiles == 0) {
+		/* Exited already, or nothing mapped. Keep what we had. */
+		free(set);
+		return;
+	}
+	free_set(job->prefetch);
+	job->prefetch = set;
+}
+
+/*
+ * Add the given file to the set unless it's in it already, or it's not
+ * the same file which was mapped.
+ */
+static int
+add_file(pf_set_t *set, const char *path, ino_t ino)
+{
+	int	    i;
+	pf_file_t   *f;
+	struct stat sb;
+
+	for (i = set->nfiles - 1; i >= 0; i--) {
+		/* Files are mapped in several segments, usually in a row. */
+		if (set->files[i].ino == ino &&
+		    strcmp(set->files[i].path, path) == 0)
+			return (0);
+	}
+	if (stat(path, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_ino != ino)
+		return (-1);
+	f = &set->files[set->nfiles];
+	if ((f->path = strdup(path)) == NULL)
+		return (-1);
+	f->dev	 = sb.st_dev;
+	f->ino	 = sb.st_ino;
+	f->size	 = sb.st_size;
+	f->mtime = sb.st_mtime;
+	set->nfiles++;
+
+	return (0);
+}
+
+static bool
+same_file(const pf_file_t *f, const struct stat *sb)
+{
+	return (f->dev == sb->st_dev && f->ino == sb->st_ino &&
+	    f->size == sb->st_size && f->mtime == sb->st_mtime);
+}
+
+static void
+free_set(pf_set_t *set)
+{
+	int i;
+
+	if (set == NULL)
+		return;
+	for (i = 0; i < set->nfiles; i++)
+		free(set->files[i].path);
+	free(set);
+}
+
+static int
+cmp_req(const void *a, const void *b)
+{
+	const pf_req_t *r1 = a, *r2 = b;
+
+	if (r1->dev != r2->dev)
+		return (r1->dev < r2->dev ? -1 : 1);
+	if (r1->ino != r2->ino)
+		return (r1->ino < r2->ino ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Parse a line of the form
+ * "<ID>\t<dev>\t<inode>\t<size>\t<mtime>\t<path>". The path is not
+ * copied.
+ */
+static int
+parse_line(char *line, char **id, pf_file_t *f)
+{
+	int		   i;
+	char		   *p, *ep, *fld[6];
+	unsigned long long u[4];
+
+	line[strcspn(line, "\n")] = '\0';
+	for (i = 0, p = line; i < 6; i++) {
+		fld[i] = p;
+		if (i < 5) {
+			if ((p = strchr(p, '\t')) == NULL)
+				return (-1);
+			*p++ = '\0';
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		errno = 0;
+		u[i] = strtoull(fld[i + 1], &ep, 10);
+		if (errno != 0 || ep == fld[i + 1] || *ep != '\0')
+			return (-1);
+	}
+	if (*fld[0] == '\0' || *fld[5] != '/')
+		return (-1);
+	*id	 = fld[0];
+	f->dev	 = (dev_t)u[0];
+	f->ino	 = (ino_t)u[1];
+	f->size	 = (off_t)u[2];
+	f->mtime = (time_t)u[3];
+	f->path	 = fld[5];
+
+	return (0);
+}
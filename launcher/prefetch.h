@@ -0,0 +1,50 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+#include <sys/types.h>
+
+#define PREFETCH_MAX_FILES 64	/* Files learned per command */
+
+typedef struct pf_file_s {
+	dev_t  dev;
+	ino_t  ino;
+	off_t  size;
+	time_t mtime;
+	char   *path;
+} pf_file_t;
+
+typedef struct pf_set_s {
+	int	  nfiles;
+	pf_file_t files[PREFETCH_MAX_FILES];
+} pf_set_t;
+
+struct job_s;
+
+extern int  prefetch_load(struct job_s *, int);
+extern int  prefetch_save(struct job_s *, int);
+extern void prefetch_run(struct job_s *, int);
+extern void prefetch_learn(struct job_s *);
+#endif /* !_PREFETCH_H_ */
@@ -0,0 +1,277 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Wait until the system has settled. On Linux with PSI, a trigger is
+ * registered for the CPU, memory, and I/O pressure files. The kernel
+ * signals a trigger (POLLPRI) if the tasks were stalled for more than the
+ * threshold within PSI_TRIGGER_US. The system is considered settled if no
+ * trigger fires for the configured window. Without PSI, the load average
+ * per CPU is checked every LOAD_INTERVAL_MS.
+ *
+ * The thresholds can be set through DSBAUTOSTART_PRESSURE, a comma
+ * separated list of key=value pairs. E.g.:
+ *
+ *	cpu=20,memory=10,io=20,load=0.7,window=5,maxwait=60
+ *
+ * Percentages of 0 disable the respective trigger. window and maxwait
+ * are given in seconds.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "pressure.h"
+#include "evloop.h"
+
+#define ENV_PRESSURE	 "DSBAUTOSTART_PRESSURE"
+#define PATH_PSI	 "/proc/pressure/"
+#define PSI_TRIGGER_US	 2000000	/* Unprivileged minimum is 2s */
+#define LOAD_INTERVAL_MS 1000
+
+static struct psi_s {
+	const char *name;
+	int	   pct;
+	int	   fd;
+} psi[] = {
+	{ "cpu",    PRESSURE_CPU_PCT,	 -1 },
+	{ "memory", PRESSURE_MEMORY_PCT, -1 },
+	{ "io",	    PRESSURE_IO_PCT,	 -1 }
+};
+#define NPSI (sizeof(psi) / sizeof(psi[0]))
+
+static int    calm_timer;
+static int    max_timer;
+static int    load_timer;
+static long   window_ms = PRESSURE_WINDOW_MS;
+static long   max_wait_ms = PRESSURE_MAX_WAIT_MS;
+static long   calm_since;
+static double max_load = PRESSURE_LOAD;
+static void   (*settled_cb)(void);
+
+static int  add_triggers(void);
+static void parse_env(void);
+static void release(void);
+static void calm(void *);
+static void timeout(void *);
+static void check_load(void *);
+static void triggered(int, void *);
+
+/*
+ * Call the given function once the pressure stayed below the thresholds
+ * for the configured window, or after the maximum wait time.
+ */
+int
+pressure_wait(void (*cb)(void))
+{
+	settled_cb = cb;
+	parse_env();
+	if ((max_timer = ev_add_timer(max_wait_ms, timeout, NULL)) == -1)
+		return (-1);
+	calm_since = ev_now_ms();
+	if (add_triggers() > 0) {
+		if ((calm_timer = ev_add_timer(window_ms, calm, NULL)) == -1)
+			return (-1);
+		return (0);
+	}
+	if ((load_timer = ev_add_timer(LOAD_INTERVAL_MS, check_load,
+	    NULL)) == -1)
+		return (-1);
+	return (0);
+}
+
+static void
+parse_env()
+{
+	char   *p, *q, *buf, *last;
+	double val;
+	size_t i;
+
+	if ((p = getenv(ENV_PRESSURE)) == NULL || (buf = strdup(p)) == NULL)
+		return;
+	for (p = strtok_r(buf, ",", &last); p != NULL;
+	    p = strtok_r(NULL, ",", &last)) {
+		if ((q = strchr(p, '=')) == NULL) {
+			warnx("%s: Invalid setting: %s", ENV_PRESSURE, p);
+			continue;
+		}
+		*q++ = '\0';
+		val = strtod(q, &q);
+		if (*q != '\0' || val < 0) {
+			warnx("%s: Invalid value for %s", ENV_PRESSURE, p);
+			continue;
+		}
+		for (i = 0; i < NPSI && strcmp(psi[i].name, p) != 0; i++)
+			;
+		if (i < NPSI)
+			psi[i].pct = val > 100 ? 100 : (int)val;
+		else if (strcmp(p, "load") == 0)
+			max_load = val;
+		else if (strcmp(p, "window") == 0)
+			window_ms = (long)(val * 1000);
+		else if (strcmp(p, "maxwait") == 0)
+			max_wait_ms = (long)(val * 1000);
+		else
+			warnx("%s: Unknown setting: %s", ENV_PRESSURE, p);
+	}
+	free(buf);
+}
+
+/*
+ * Register a PSI trigger for each resource with a threshold. Returns the
+ * number of triggers registered.
+ */
+static int
+add_triggers()
+{
+	int    n;
+	char   buf[64];
+	size_t i, len;
+
+	for (i = n = 0; i < NPSI; i++) {
+		if (psi[i].pct == 0)
+			continue;
+		(void)snprintf(buf, sizeof(buf), PATH_PSI "%s", psi[i].name);
+		if ((psi[i].fd = open(buf, O_RDWR | O_NONBLOCK | O_CLOEXEC))
+		    == -1)
+			continue;
+		len = (size_t)snprintf(buf, sizeof(buf), "some %ld %ld",
+		    (long)PSI_TRIGGER_US / 100 * psi[i].pct,
+		    (long)PSI_TRIGGER_US);
+		/* The kernel wants the terminating NUL. */
+		if (write(psi[i].fd, buf, len + 1) == -1 ||
+		    ev_add_fd_pri(psi[i].fd, triggered, &psi[i]) == -1) {
+			if (errno != ENOENT)
+				warn("PSI trigger for %s", psi[i].name);
+			(void)close(psi[i].fd);
+			psi[i].fd = -1;
+			continue;
+		}
+		n++;
+	}
+	return (n);
+}
+
+/*
+ * A PSI trigger fired. Restart the window.
+ */
+static void
+triggered(int fd, void *arg)
+{
+	struct psi_s  *p = arg;
+	struct pollfd pfd;
+
+	pfd.fd = fd; pfd.events = POLLPRI;
+	if (poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLERR | POLLNVAL))) {
+		/* The trigger was destroyed. */
+		ev_del_fd(fd);
+		(void)close(fd);
+		p->fd = -1;
+		return;
+	}
+	calm_since = ev_now_ms();
+	if (calm_timer != 0)
+		ev_del_timer(calm_timer);
+	if ((calm_timer = ev_add_timer(window_ms, calm, NULL)) == -1) {
+		warn("ev_add_timer()");
+		calm_timer = 0;
+		release();
+	}
+}
+
+static void
+check_load(void *arg)
+{
+	long   ncpu;
+	double load;
+
+	(void)arg;
+	load_timer = 0;
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	if (getloadavg(&load, 1) != 1) {
+		release();
+		return;
+	}
+	if (load / ncpu > max_load)
+		calm_since = ev_now_ms();
+	else if (ev_now_ms() - calm_since >= window_ms) {
+		release();
+		return;
+	}
+	if ((load_timer = ev_add_timer(LOAD_INTERVAL_MS, check_load,
+	    NULL)) == -1) {
+		warn("ev_add_timer()");
+		load_timer = 0;
+		release();
+	}
+}
+
+static void
+calm(void *arg)
+{
+	(void)arg;
+	calm_timer = 0;
+	release();
+}
+
+static void
+timeout(void *arg)
+{
+	(void)arg;
+	max_timer = 0;
+	release();
+}
+
+static void
+release()
+{
+	void   (*cb)(void);
+	size_t i;
+
+	if ((cb = settled_cb) == NULL)
+		return;
+	settled_cb = NULL;
+	if (calm_timer != 0)
+		ev_del_timer(calm_timer);
+	if (max_timer != 0)
+		ev_del_timer(max_timer);
+	if (load_timer != 0)
+		ev_del_timer(load_timer);
+	calm_timer = max_timer = load_timer = 0;
+	for (i = 0; i < NPSI; i++) {
+		if (psi[i].fd == -1)
+			continue;
+		ev_del_fd(psi[i].fd);
+		(void)close(psi[i].fd);
+		psi[i].fd = -1;
+	}
+	cb();
+}
@@ -0,0 +1,391 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Index of the processes of the current user in the current session,
+ * used to skip commands which are already running. The process table is
+ * read once by procidx_build(). Every process is indexed by the basename
+ * of argv[0], of its executable, and, for interpreted scripts, of argv[1],
+ * combined with the remaining arguments. procidx_find() only looks at the
+ * processes in the matching hash buckets.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <dirent.h>
+#else
+# include <sys/param.h>
+# include <sys/sysctl.h>
+# include <sys/user.h>
+#endif
+
+#include "procidx.h"
+
+#define NBUCKETS 512	/* Power of 2 */
+
+enum { KEY_ARGV0, KEY_EXE, KEY_SCRIPT };
+
+struct proc_s {
+	pid_t	      pid;
+	char	      *exe;	/* Path of the executable, or NULL */
+	char	      *args;	/* NUL separated argument vector */
+	size_t	      argslen;
+	struct proc_s *next;
+};
+
+struct key_s {
+	int	      kind;
+	unsigned int  hash;
+	const char    *name;	/* argv[0], exe, or script path */
+	const char    *args;	/* Arguments following "name" */
+	size_t	      argslen;
+	struct proc_s *proc;
+	struct key_s  *next;
+};
+
+static struct key_s  *buckets[NBUCKETS];
+static struct proc_s *procs;
+
+static int	    add_proc(pid_t, const char *, const char *, size_t);
+static int	    add_key(struct proc_s *, int, const char *, const char *,
+			size_t);
+static bool	    args_equal(const struct key_s *, char * const *);
+static unsigned int hash_key(const char *, const char *, size_t);
+static unsigned int hash_argv(const char *, char * const *);
+static const char   *base(const char *);
+
+#ifdef __linux__
+static char *read_file(int, const char *, size_t *);
+
+int
+procidx_build()
+{
+	int	      dfd;
+	char	      *p, *args, *stat, exe[PATH_MAX], path[64];
+	uid_t	      uid;
+	pid_t	      pid, sid, self, psid;
+	size_t	      len;
+	DIR	      *dir;
+	ssize_t	      n;
+	struct stat   sb;
+	struct dirent *dp;
+
+	uid = getuid(); sid = getsid(0); self = getpid();
+	if ((dfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return (-1);
+	if ((dir = fdopendir(dfd)) == NULL) {
+		(void)close(dfd);
+		return (-1);
+	}
+	while ((dp = readdir(dir)) != NULL) {
+		pid = (pid_t)strtol(dp->d_name, &p, 10);
+		if (*p != '\0' || pid <= 0 || pid == self)
+			continue;
+		if (fstatat(dfd, dp->d_name, &sb, 0) == -1 || sb.st_uid != uid)
+			continue;
+		(void)snprintf(path, sizeof(path), "%d/stat", (int)pid);
+		if ((stat = read_file(dfd, path, &len)) == NULL)
+			continue;
+		/* Fields following the command name: state ppid pgrp session */
+		p = strrchr(stat, ')');
+		if (p == NULL || p[1] == '\0' || p[2] == 'Z' ||
+		    sscanf(p + 3, "%*d %*d %d", (int *)&psid) != 1 ||
+		    psid != sid) {
+			free(stat);
+			continue;
+		}
+		free(stat);
+		(void)snprintf(path, sizeof(path), "%d/cmdline", (int)pid);
+		if ((args = read_file(dfd, path, &len)) == NULL)
+			continue;
+		(void)snprintf(path, sizeof(path), "%d/exe", (int)pid);
+		if ((n = readlinkat(dfd, path, exe, sizeof(exe) - 1)) == -1)
+			n = 0;
+		exe[n] = '\0';
+		if (len == 0 || add_proc(pid, exe, args, len) == -1)
+			free(args);
+	}
+	(void)closedir(dir);
+
+	return (0);
+}
+
+/*
+ * Read the file relative to the given directory into a NUL-terminated
+ * buffer. "len" is set to the # of bytes read.
+ */
+static char *
+read_file(int dfd, const char *path, size_t *len)
+{
+	int	fd;
+	char	*buf, *p;
+	size_t	size;
+	ssize_t n;
+
+	if ((fd = openat(dfd, path, O_RDONLY | O_CLOEXEC)) == -1)
+		return (NULL);
+	for (buf = NULL, size = 512, *len = 0;; *len += (size_t)n) {
+		if (buf == NULL || *len + 1 >= size) {
+			if ((p = realloc(buf, size *= 2)) == NULL)
+				break;
+			buf = p;
+		}
+		if ((n = read(fd, buf + *len, size - *len - 1)) <= 0)
+			break;
+	}
+	(void)close(fd);
+	if (buf == NULL)
+		return (NULL);
+	buf[*len] = '\0';
+
+	return (buf);
+}
+#else
+int
+procidx_build()
+{
+	int		  i, n, mib[4];
+	char		  *args, exe[PATH_MAX];
+	pid_t		  sid, self;
+	size_t		  len, elen;
+	struct kinfo_proc *kp;
+
+	sid = getsid(0); self = getpid();
+	mib[0] = CTL_KERN; mib[1] = KERN_PROC; mib[2] = KERN_PROC_UID;
+	mib[3] = (int)getuid();
+	if (sysctl(mib, 4, NULL, &len, NULL, 0) == -1)
+		return (-1);
+	len += len / 8;
+	if ((kp = malloc(len)) == NULL)
+		return (-1);
+	if (sysctl(mib, 4, kp, &len, NULL, 0) == -1) {
+		free(kp);
+		return (-1);
+	}
+	n = (int)(len / sizeof(struct kinfo_proc));
+	for (i = 0; i < n; i++) {
+		if (kp[i].ki_sid != sid || kp[i].ki_pid == self ||
+		    kp[i].ki_stat == SZOMB)
+			continue;
+		mib[2] = KERN_PROC_ARGS; mib[3] = kp[i].ki_pid;
+		if (sysctl(mib, 4, NULL, &len, NULL, 0) == -1 || len == 0)
+			continue;
+		if ((args = malloc(len + 1)) == NULL)
+			break;
+		if (sysctl(mib, 4, args, &len, NULL, 0) == -1 || len == 0) {
+			free(args);
+			continue;
+		}
+		args[len] = '\0';
+		mib[2] = KERN_PROC_PATHNAME;
+		elen = sizeof(exe);
+		if (sysctl(mib, 4, exe, &elen, NULL, 0) == -1)
+			exe[0] = '\0';
+		if (add_proc(kp[i].ki_pid, exe, args, len) == -1)
+			free(args);
+	}
+	free(kp);
+
+	return (0);
+}
+#endif
+
+/*
+ * Return the PID of a process running the given program with the same
+ * arguments, or -1. "path" is the full path of argv[0].
+ */
+pid_t
+procidx_find(const char *path, char * const *argv)
+{
+	int	     i;
+	char	     real[PATH_MAX];
+	const char   *names[2];
+	unsigned int hash;
+	struct key_s *k;
+
+	names[0] = argv[0];
+	names[1] = realpath(path, real) != NULL ? real : path;
+	for (i = 0; i < 2; i++) {
+		hash = hash_argv(base(names[i]), argv);
+		for (k = buckets[hash & (NBUCKETS - 1)]; k != NULL;
+		    k = k->next) {
+			if (k->hash != hash ||
+			    strcmp(base(k->name), base(names[i])) != 0 ||
+			    !args_equal(k, argv))
+				continue;
+			/* Full paths must match exactly. */
+			if (k->kind != KEY_ARGV0 && strcmp(k->name, path) != 0 &&
+			    strcmp(k->name, names[1]) != 0)
+				continue;
+			return (k->proc->pid);
+		}
+	}
+	return (-1);
+}
+
+void
+procidx_free()
+{
+	size_t	      i;
+	struct key_s  *k, *nk;
+	struct proc_s *p, *np;
+
+	for (p = procs; p != NULL; p = np) {
+		np = p->next;
+		free(p->exe);
+		free(p->args);
+		free(p);
+	}
+	procs = NULL;
+	for (i = 0; i < NBUCKETS; i++) {
+		for (k = buckets[i]; k != NULL; k = nk) {
+			nk = k->next;
+			free(k);
+		}
+		buckets[i] = NULL;
+	}
+}
+
+/*
+ * Add a process with the given executable, and argument vector. "args"
+ * is taken over.
+ */
+static int
+add_proc(pid_t pid, const char *exe, const char *args, size_t len)
+{
+	size_t	      n;
+	const char    *rest;
+	struct proc_s *p;
+
+	/* Make sure the vector is terminated. */
+	while (len > 0 && args[len - 1] == '\0')
+		len--;
+	len++;
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return (-1);
+	if (*exe != '\0' && (p->exe = strdup(exe)) == NULL) {
+		free(p);
+		return (-1);
+	}
+	p->pid = pid; p->args = (char *)args; p->argslen = len;
+	p->next = procs; procs = p;
+
+	n = strlen(args) + 1;
+	rest = args + n;
+	if (add_key(p, KEY_ARGV0, args, rest, len - n) == -1)
+		return (0);
+	if (p->exe != NULL && strcmp(base(p->exe), base(args)) != 0)
+		(void)add_key(p, KEY_EXE, p->exe, rest, len - n);
+	/* #!/interpreter scripts: argv[0] is the interpreter. */
+	if (n < len && *rest == '/') {
+		n = strlen(rest) + 1;
+		(void)add_key(p, KEY_SCRIPT, rest, rest + n,
+		    len - (rest + n - args));
+	}
+	return (0);
+}
+
+static int
+add_key(struct proc_s *p, int kind, const char *name, const char *args,
+	size_t len)
+{
+	struct key_s *k;
+
+	if ((k = malloc(sizeof(*k))) == NULL)
+		return (-1);
+	k->kind = kind; k->name = name; k->args = args; k->argslen = len;
+	k->proc = p;
+	k->hash = hash_key(base(name), args, len);
+	k->next = buckets[k->hash & (NBUCKETS - 1)];
+	buckets[k->hash & (NBUCKETS - 1)] = k;
+
+	return (0);
+}
+
+static bool
+args_equal(const struct key_s *k, char * const *argv)
+{
+	size_t	   i, n;
+	const char *p;
+
+	for (i = 1, p = k->args; argv[i] != NULL; i++, p += n) {
+		n = strlen(argv[i]) + 1;
+		if (p + n > k->args + k->argslen || strcmp(p, argv[i]) != 0)
+			return (false);
+	}
+	return (p == k->args + k->argslen);
+}
+
+/*
+ * FNV-1a hash of the name, followed by the NUL separated arguments.
+ */
+static unsigned int
+hash_key(const char *name, const char *args, size_t len)
+{
+	size_t	     i;
+	unsigned int h;
+
+	for (h = 2166136261U; *name != '\0'; name++)
+		h = (h ^ (unsigned char)*name) * 16777619U;
+	h *= 16777619U;
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)args[i]) * 16777619U;
+	return (h);
+}
+
+static unsigned int
+hash_argv(const char *name, char * const *argv)
+{
+	size_t	     i;
+	unsigned int h;
+	const char   *p;
+
+	for (h = 2166136261U; *name != '\0'; name++)
+		h = (h ^ (unsigned char)*name) * 16777619U;
+	h *= 16777619U;
+	for (i = 1; argv[i] != NULL; i++) {
+		for (p = argv[i]; *p != '\0'; p++)
+			h = (h ^ (unsigned char)*p) * 16777619U;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static const char *
+base(const char *path)
+{
+	const char *p;
+
+	return ((p = strrchr(path, '/')) != NULL ? p + 1 : path);
+}
@@ -0,0 +1,488 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Resource profiling (-p). For the first opts.profile_ms after the start,
+ * the process trees of all started commands are sampled every
+ * opts.profile_interval_ms. Afterwards, the peak RSS, the CPU time, the
+ * number of bytes read from disk, and the time until the tree settled
+ * are printed for every entry.
+ *
+ * A process belongs to an entry if its parent does, or if it is in the
+ * process group of the entry's command. Every command is started in its
+ * own process group for that purpose. Exited processes keep contributing
+ * the CPU time and disk reads of their last sample.
+ *
+ * All memory is allocated by profile_start(), so sampling doesn't
+ * allocate. On Linux, /proc is read by getdents(2) on a directory
+ * descriptor which is kept open, and the per process files are read with
+ * plain read(2) into static buffers.
+ */
+
+#ifdef __linux__
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+# include <dirent.h>
+# include <sys/syscall.h>
+#else
+# include <sys/param.h>
+# include <sys/sysctl.h>
+# include <sys/user.h>
+#endif
+
+#include "launcher.h"
+#include "profile.h"
+#include "evloop.h"
+
+#define MAX_PROCS	8192	/* Size of the process table. Power of 2 */
+#define SETTLE_PCT	5	/* CPU usage below which a tree is settled */
+
+struct slot_s {
+	pid_t	pid;		/* 0 if the slot was never used */
+	pid_t	ppid;
+	pid_t	pgid;
+	int	job;		/* Index of the owning job, or -1 */
+	long	gen;		/* Sample in which the process was seen */
+	long	cpu_ms;
+	long	rss_kb;
+	long	read_bytes;
+};
+
+struct prof_s {
+	pid_t	pgid;		/* Process group of the command, or 0 */
+	int	nprocs;		/* # of processes seen */
+	long	started;	/* Time the command was started */
+	long	dead_cpu_ms;	/* CPU time of exited processes */
+	long	dead_read_bytes;
+	long	cpu_ms;		/* CPU time in the last sample */
+	long	rss_kb;		/* RSS in the last sample */
+	long	read_bytes;
+	long	peak_rss_kb;
+	long	prev_cpu_ms;	/* CPU time in the previous sample */
+	long	settle_ms;	/* Time of the last busy sample */
+	bool	busy;		/* Busy in the last sample */
+};
+
+static int	     njobs;
+static long	     gen;
+static long	     t_start;
+static long	     t_last;
+static bool	     active;
+static job_t	     *jobs;
+static struct slot_s *table;
+static struct prof_s *prof;
+#ifdef __linux__
+static int	     procfd = -1;
+static long	     pagesize_kb;
+static long	     hz;
+static char	     dents[16384];
+static char	     rdbuf[4096];
+#else
+static size_t	     kpsize;
+static struct kinfo_proc *kp;
+#endif
+
+static void	      sample(void *);
+static void	      scan(void);
+static void	      visit(pid_t, pid_t, pid_t);
+static void	      update_totals(long);
+static void	      report(void);
+static int	      owner(pid_t, pid_t);
+static struct slot_s *lookup(pid_t, bool);
+#ifdef __linux__
+static int	      read_file(pid_t, const char *);
+static int	      read_stat(pid_t, pid_t *, pid_t *, long *);
+#endif
+
+/*
+ * Allocate the process table, and start sampling.
+ */
+int
+profile_start(job_t *jobv, int n)
+{
+	int i;
+
+	jobs  = jobv;
+	njobs = n;
+	for (i = 0; i < n; i++)
+		jobs[i].profile = i;
+	if ((table = calloc(MAX_PROCS, sizeof(struct slot_s))) == NULL ||
+	    (prof = calloc(n + 1, sizeof(struct prof_s))) == NULL)
+		return (-1);
+#ifdef __linux__
+	if ((procfd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return (-1);
+	pagesize_kb = sysconf(_SC_PAGESIZE) / 1024;
+	if ((hz = sysconf(_SC_CLK_TCK)) <= 0)
+		hz = 100;
+#else
+	kpsize = MAX_PROCS * sizeof(struct kinfo_proc);
+	if ((kp = malloc(kpsize)) == NULL)
+		return (-1);
+#endif
+	t_start = t_last = ev_now_ms();
+	if (ev_add_timer(opts.profile_interval_ms, sample, NULL) == -1)
+		return (-1);
+	active = true;
+
+	return (0);
+}
+
+bool
+profile_active()
+{
+	return (active);
+}
+
+/*
+ * Add the command of the given job, which was just spawned. Jobs created
+ * after profile_start(), i.e., in watch mode, are not profiled.
+ */
+void
+profile_add(job_t *job, pid_t pid)
+{
+	int	      i;
+	struct slot_s *s;
+
+	if (!active || job->profile < 0)
+		return;
+	i = job->profile;
+	prof[i].pgid = pid;
+	if (prof[i].started == 0)
+		prof[i].started = ev_now_ms();
+	if ((s = lookup(pid, true)) != NULL) {
+		s->job	= i;
+		s->gen	= gen;
+		s->ppid = getpid();
+		s->pgid = pid;
+		s->cpu_ms = s->rss_kb = s->read_bytes = 0;
+		prof[i].nprocs++;
+	}
+}
+
+static void
+sample(void *arg)
+{
+	long now;
+
+	(void)arg;
+	gen++;
+	scan();
+	now = ev_now_ms();
+	update_totals(now);
+	t_last = now;
+	if (now - t_start >= opts.profile_ms) {
+		report();
+		active = false;
+		release_parent(EXIT_SUCCESS);
+		return;
+	}
+	if (ev_add_timer(opts.profile_interval_ms, sample, NULL) == -1) {
+		warn("ev_add_timer()");
+		report();
+		active = false;
+		release_parent(EXIT_SUCCESS);
+	}
+}
+
+/*
+ * Look up the slot of the given PID. If "create" is true, a new slot is
+ * returned if there is none. Slots of processes which were not seen in
+ * the last sample are reused.
+ */
+static struct slot_s *
+lookup(pid_t pid, bool create)
+{
+	unsigned int  i, n;
+	struct slot_s *s, *stale;
+
+	stale = NULL;
+	for (i = (unsigned int)pid * 2654435761U, n = 0; n < MAX_PROCS;
+	    i++, n++) {
+		s = &table[i & (MAX_PROCS - 1)];
+		if (s->pid == 0)
+			break;
+		if (s->pid == pid && s->gen >= gen - 1)
+			return (s);
+		if (stale == NULL && s->gen < gen - 1 && s->job == -1)
+			stale = s;
+	}
+	if (!create)
+		return (NULL);
+	if (stale != NULL)
+		s = stale;
+	else if (n == MAX_PROCS)
+		return (NULL);
+	s->pid = pid;
+	s->job = -1;
+	s->gen = gen;
+
+	return (s);
+}
+
+/*
+ * Return the index of the job the process with the given parent and
+ * process group belongs to, or -1.
+ */
+static int
+owner(pid_t ppid, pid_t pgid)
+{
+	int	      i;
+	struct slot_s *s;
+
+	if ((s = lookup(ppid, false)) != NULL && s->job >= 0)
+		return (s->job);
+	for (i = 0; i < njobs; i++) {
+		if (prof[i].pgid == pgid && pgid > 0)
+			return (i);
+	}
+	return (-1);
+}
+
+/*
+ * Called for every process found by scan(). New processes are assigned
+ * to the job their parent or process group belongs to. Processes which
+ * don't belong to any job are only looked at again if their parent was
+ * adopted later.
+ */
+static void
+visit(pid_t pid, pid_t ppid, pid_t pgid)
+{
+	int	      job;
+	struct slot_s *s;
+
+	if ((s = lookup(pid, true)) == NULL)
+		return;
+	if (s->gen != gen || s->job == -1) {
+		s->ppid = ppid;
+		s->pgid = pgid;
+	}
+	s->gen = gen;
+	if (s->job == -1 && (job = owner(s->ppid, s->pgid)) != -1) {
+		s->job = job;
+		s->cpu_ms = s->rss_kb = s->read_bytes = 0;
+		prof[job].nprocs++;
+	}
+}
+
+#ifdef __linux__
+struct linux_dirent64 {
+	ino64_t	       d_ino;
+	off64_t	       d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char	       d_name[];
+};
+
+static void
+scan()
+{
+	long	      n, off, cpu;
+	char	      *p;
+	pid_t	      pid, ppid, pgid;
+	struct slot_s *s;
+	struct linux_dirent64 *d;
+
+	if (lseek(procfd, 0, SEEK_SET) == -1)
+		return;
+	while ((n = syscall(SYS_getdents64, procfd, dents, sizeof(dents))) > 0) {
+		for (off = 0; off < n; off += d->d_reclen) {
+			d = (struct linux_dirent64 *)(dents + off);
+			if (d->d_name[0] < '1' || d->d_name[0] > '9')
+				continue;
+			pid = (pid_t)strtol(d->d_name, &p, 10);
+			if (*p != '\0')
+				continue;
+			s = lookup(pid, false);
+			if (s == NULL || s->job == -1) {
+				/* Only read the stat file of new processes. */
+				if (s != NULL && s->gen >= gen - 1)
+					visit(pid, s->ppid, s->pgid);
+				else if (read_stat(pid, &ppid, &pgid, &cpu) == 0)
+					visit(pid, ppid, pgid);
+				if ((s = lookup(pid, false)) == NULL ||
+				    s->job == -1)
+					continue;
+			} else
+				s->gen = gen;
+			if (read_stat(pid, &ppid, &pgid, &cpu) == 0)
+				s->cpu_ms = cpu;
+			if (read_file(pid, "statm") > 0 &&
+			    (p = strchr(rdbuf, ' ')) != NULL)
+				s->rss_kb = strtol(p, NULL, 10) * pagesize_kb;
+			if (read_file(pid, "io") > 0 &&
+			    (p = strstr(rdbuf, "\nread_bytes: ")) != NULL)
+				s->read_bytes = strtol(p + 13, NULL, 10);
+		}
+	}
+}
+
+/*
+ * Read /proc/<pid>/<file> into rdbuf. Returns the # of bytes read, or -1.
+ */
+static int
+read_file(pid_t pid, const char *file)
+{
+	int	fd;
+	char	path[64];
+	ssize_t n;
+
+	(void)snprintf(path, sizeof(path), "%d/%s", (int)pid, file);
+	if ((fd = openat(procfd, path, O_RDONLY | O_CLOEXEC)) == -1)
+		return (-1);
+	n = read(fd, rdbuf, sizeof(rdbuf) - 1);
+	(void)close(fd);
+	if (n < 0)
+		return (-1);
+	rdbuf[n] = '\0';
+
+	return ((int)n);
+}
+
+static int
+read_stat(pid_t pid, pid_t *ppid, pid_t *pgid, long *cpu_ms)
+{
+	int	      i;
+	char	      *p;
+	unsigned long utime, stime;
+
+	if (read_file(pid, "stat") <= 0)
+		return (-1);
+	/* The command name can contain spaces. Skip up to the last ')'. */
+	if ((p = strrchr(rdbuf, ')')) == NULL)
+		return (-1);
+	/* Fields 3 (state), 4 (ppid), 5 (pgrp), ... 14 (utime), 15 (stime) */
+	if (sscanf(p + 1, " %*c %d %d", (int *)ppid, (int *)pgid) != 2)
+		return (-1);
+	for (i = 0, p++; i < 11; i++) {
+		if ((p = strchr(p + 1, ' ')) == NULL)
+			return (-1);
+	}
+	if (sscanf(p, " %lu %lu", &utime, &stime) != 2)
+		return (-1);
+	*cpu_ms = (long)((utime + stime) * 1000 / hz);
+
+	return (0);
+}
+#else
+static void
+scan()
+{
+	int	      i, n, mib[3];
+	size_t	      len;
+	struct slot_s *s;
+
+	mib[0] = CTL_KERN; mib[1] = KERN_PROC; mib[2] = KERN_PROC_PROC;
+	len = kpsize;
+	if (sysctl(mib, 3, kp, &len, NULL, 0) == -1)
+		return;
+	n = (int)(len / sizeof(struct kinfo_proc));
+	for (i = 0; i < n; i++) {
+		visit(kp[i].ki_pid, kp[i].ki_ppid, kp[i].ki_pgid);
+		if ((s = lookup(kp[i].ki_pid, false)) == NULL || s->job == -1)
+			continue;
+		s->cpu_ms = (long)(kp[i].ki_runtime / 1000);
+		s->rss_kb = (long)kp[i].ki_rssize * (getpagesize() / 1024);
+		/* Only the # of block reads is available. */
+		s->read_bytes = (long)kp[i].ki_rusage.ru_inblock * DEV_BSIZE;
+	}
+}
+#endif
+
+/*
+ * Sum up the values of the processes of each job. Processes which
+ * disappeared are moved to the dead_* counters.
+ */
+static void
+update_totals(long now)
+{
+	int	      i;
+	long	      interval;
+	struct slot_s *s;
+
+	for (i = 0; i < njobs; i++) {
+		prof[i].cpu_ms = prof[i].dead_cpu_ms;
+		prof[i].read_bytes = prof[i].dead_read_bytes;
+		prof[i].rss_kb = 0;
+	}
+	for (s = table; s < table + MAX_PROCS; s++) {
+		if (s->pid == 0 || s->job == -1)
+			continue;
+		if (s->gen != gen) {
+			prof[s->job].dead_cpu_ms += s->cpu_ms;
+			prof[s->job].dead_read_bytes += s->read_bytes;
+			prof[s->job].cpu_ms += s->cpu_ms;
+			prof[s->job].read_bytes += s->read_bytes;
+			s->job = -1;
+			continue;
+		}
+		prof[s->job].cpu_ms += s->cpu_ms;
+		prof[s->job].read_bytes += s->read_bytes;
+		prof[s->job].rss_kb += s->rss_kb;
+	}
+	interval = now - t_last;
+	for (i = 0; i < njobs; i++) {
+		if (prof[i].rss_kb > prof[i].peak_rss_kb)
+			prof[i].peak_rss_kb = prof[i].rss_kb;
+		if (prof[i].started == 0)
+			continue;
+		prof[i].busy = interval > 0 &&
+		    (prof[i].cpu_ms - prof[i].prev_cpu_ms) * 100 >
+		    interval * SETTLE_PCT;
+		if (prof[i].busy)
+			prof[i].settle_ms = now - prof[i].started;
+		prof[i].prev_cpu_ms = prof[i].cpu_ms;
+	}
+}
+
+static void
+report()
+{
+	int i;
+
+	(void)printf("# ID\tPIDS\tPEAK_RSS_KB\tCPU_MS\tREAD_BYTES\tSETTLE_MS\n");
+	for (i = 0; i < njobs; i++) {
+		if (prof[i].started == 0)
+			continue;
+		(void)printf("%s\t%d\t%ld\t%ld\t", jobs[i].id, prof[i].nprocs,
+		    prof[i].peak_rss_kb, prof[i].cpu_ms);
+		(void)printf("%ld\t", prof[i].read_bytes);
+		if (prof[i].busy)
+			(void)printf("-\n");
+		else
+			(void)printf("%ld\n", prof[i].settle_ms);
+	}
+	(void)fflush(stdout);
+}
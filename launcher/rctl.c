@@ -0,0 +1,386 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef __linux__
+# ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+# endif
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+# include <sched.h>
+# include <sys/syscall.h>
+#else
+# include <sys/param.h>
+# include <sys/cpuset.h>
+#endif
+
+#include "rctl.h"
+
+#define PATH_CGROUP_FS		"/sys/fs/cgroup"
+#define PATH_SELF_CGROUP	"/proc/self/cgroup"
+#define CGROUP_PREFIX		"dsbautostart-"
+#define ENV_CGROUP_ROOT		"DSBAUTOSTART_CGROUP_ROOT"
+
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_RT		1
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+
+#define LONG_BITS		(sizeof(unsigned long) * CHAR_BIT)
+
+static int  parse_int(const char *, const char *, long, long, long *);
+static int  parse_cpus(rctl_t *, const char *);
+static int  parse_size(const char *, long long *);
+static int  write_file(const char *, const char *, const char *);
+static char *cgroup_root(void);
+static char *make_cgroup(const char *, const desktop_file_t *);
+
+/*
+ * Parse the resource control keys of the given desktop file. Invalid
+ * values are reported, and ignored. If the entry defines a cgroup, it
+ * is created, and its limits are set. Returns -1 if memory allocation
+ * failed.
+ */
+int
+rctl_init(rctl_t *rc, const char *id, const desktop_file_t *df)
+{
+	long val;
+
+	(void)memset(rc, 0, sizeof(*rc));
+	rc->nice = RCTL_NICE_UNSET;
+	rc->io_class = -1;
+	if (df->nice != NULL &&
+	    parse_int(id, df->nice, -20, 19, &val) == 0)
+		rc->nice = (int)val;
+	if (df->io_class != NULL) {
+		if (strcmp(df->io_class, "idle") == 0)
+			rc->io_class = IOPRIO_CLASS_IDLE;
+		else if (strcmp(df->io_class, "best-effort") == 0)
+			rc->io_class = IOPRIO_CLASS_BE;
+		else if (strcmp(df->io_class, "realtime") == 0)
+			rc->io_class = IOPRIO_CLASS_RT;
+		else {
+			warnx("%s: Invalid X-DSB-IOClass value '%s'", id,
+			    df->io_class);
+		}
+	}
+	if (df->io_prio != NULL &&
+	    parse_int(id, df->io_prio, 0, 7, &val) == 0) {
+		rc->io_prio = (int)val;
+		/* An I/O priority without class implies best-effort. */
+		if (rc->io_class == -1)
+			rc->io_class = IOPRIO_CLASS_BE;
+	} else
+		rc->io_prio = 4;
+#ifndef __linux__
+	if (rc->io_class != -1) {
+		warnx("%s: I/O priorities are not supported on this system",
+		    id);
+		rc->io_class = -1;
+	}
+#endif
+	if (df->cpu_affinity != NULL && parse_cpus(rc, df->cpu_affinity) == -1)
+		warnx("%s: Invalid X-DSB-CPUAffinity value '%s'", id,
+		    df->cpu_affinity);
+	if (df->cgroup != NULL) {
+		rc->cgroup = make_cgroup(id, df);
+		if (rc->cgroup == NULL && errno == ENOMEM)
+			return (-1);
+	}
+	return (0);
+}
+
+void
+rctl_free(rctl_t *rc)
+{
+	free(rc->cgroup);
+	rc->cgroup = NULL;
+}
+
+/*
+ * Apply the resource controls to the calling process. This is called in
+ * the child between fork() and exec(). Failures are reported, but do not
+ * prevent the command from being started.
+ */
+void
+rctl_apply(const rctl_t *rc, const char *id)
+{
+	size_t i;
+
+	/* Writing "0" to cgroup.procs moves the writing process. */
+	if (rc->cgroup != NULL && write_file(rc->cgroup, "cgroup.procs",
+	    "0") == -1)
+		warn("%s: Couldn't move process to %s", id, rc->cgroup);
+	if (rc->affinity) {
+#ifdef __linux__
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		for (i = 0; i < RCTL_MAXCPU && i < CPU_SETSIZE; i++) {
+			if (rc->cpus[i / LONG_BITS] & (1UL << (i % LONG_BITS)))
+				CPU_SET(i, &set);
+		}
+		if (sched_setaffinity(0, sizeof(set), &set) == -1)
+			warn("%s: sched_setaffinity()", id);
+#else
+		cpuset_t set;
+
+		CPU_ZERO(&set);
+		for (i = 0; i < RCTL_MAXCPU && i < CPU_SETSIZE; i++) {
+			if (rc->cpus[i / LONG_BITS] & (1UL << (i % LONG_BITS)))
+				CPU_SET(i, &set);
+		}
+		if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1,
+		    sizeof(set), &set) == -1)
+			warn("%s: cpuset_setaffinity()", id);
+#endif
+	}
+#ifdef __linux__
+	if (rc->io_class != -1) {
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    rc->io_class << IOPRIO_CLASS_SHIFT | rc->io_prio) == -1)
+			warn("%s: ioprio_set()", id);
+	}
+#endif
+	if (rc->nice != RCTL_NICE_UNSET &&
+	    setpriority(PRIO_PROCESS, 0, rc->nice) == -1)
+		warn("%s: setpriority()", id);
+}
+
+static int
+parse_int(const char *id, const char *str, long min, long max, long *val)
+{
+	char *ep;
+
+	errno = 0;
+	*val = strtol(str, &ep, 10);
+	if (errno != 0 || ep == str || *ep != '\0' || *val < min ||
+	    *val > max) {
+		warnx("%s: Invalid value '%s'. Must be in [%ld, %ld]", id,
+		    str, min, max);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Parse a list of CPUs and CPU ranges separated by semicolons or commas,
+ * e.g., "0-3;6".
+ */
+static int
+parse_cpus(rctl_t *rc, const char *str)
+{
+	long	   lo, hi, i;
+	char	   *ep;
+	const char *p;
+
+	for (p = str; *p != '\0';) {
+		lo = strtol(p, &ep, 10);
+		if (ep == p || lo < 0 || lo >= RCTL_MAXCPU)
+			return (-1);
+		hi = lo;
+		if (*ep == '-') {
+			p = ep + 1;
+			hi = strtol(p, &ep, 10);
+			if (ep == p || hi < lo || hi >= RCTL_MAXCPU)
+				return (-1);
+		}
+		for (i = lo; i <= hi; i++)
+			rc->cpus[i / LONG_BITS] |= 1UL << (i % LONG_BITS);
+		if (*ep == ';' || *ep == ',')
+			ep++;
+		else if (*ep != '\0')
+			return (-1);
+		p = ep;
+	}
+	rc->affinity = true;
+
+	return (0);
+}
+
+/*
+ * Parse a byte count with an optional K, M, G, or T suffix. "max" means
+ * no limit, and is returned as -1.
+ */
+static int
+parse_size(const char *str, long long *size)
+{
+	char *ep;
+
+	if (strcmp(str, "max") == 0) {
+		*size = -1;
+		return (0);
+	}
+	errno = 0;
+	*size = strtoll(str, &ep, 10);
+	if (errno != 0 || ep == str || *size < 0)
+		return (-1);
+	switch (*ep) {
+	case 'T': case 't':
+		*size *= 1024;
+		/* FALLTHROUGH */
+	case 'G': case 'g':
+		*size *= 1024;
+		/* FALLTHROUGH */
+	case 'M': case 'm':
+		*size *= 1024;
+		/* FALLTHROUGH */
+	case 'K': case 'k':
+		*size *= 1024;
+		ep++;
+	}
+	return (*ep == '\0' ? 0 : -1);
+}
+
+static int
+write_file(const char *dir, const char *file, const char *str)
+{
+	int  fd;
+	char path[PATH_MAX];
+
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, file);
+	if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+		return (-1);
+	if (write(fd, str, strlen(str)) == -1) {
+		(void)close(fd);
+		return (-1);
+	}
+	return (close(fd));
+}
+
+/*
+ * Return the directory below which the cgroups for the entries are
+ * created. This is either the directory defined by DSBAUTOSTART_CGROUP_ROOT,
+ * or the parent of our own cgroup, which needs to be delegated to the
+ * user.
+ */
+static char *
+cgroup_root(void)
+{
+	int	    len;
+	char	    *p, buf[PATH_MAX];
+	FILE	    *fp;
+	static char *root = NULL;
+
+	if (root != NULL)
+		return (root);
+	if ((p = getenv(ENV_CGROUP_ROOT)) != NULL && *p != '\0')
+		return ((root = strdup(p)));
+	if ((fp = fopen(PATH_SELF_CGROUP, "r")) == NULL)
+		return (NULL);
+	/* The unified hierarchy is listed as "0::<path>" */
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (strncmp(buf, "0::", 3) != 0)
+			continue;
+		(void)strtok(buf, "\n");
+		if ((p = strrchr(buf + 3, '/')) != NULL)
+			*p = '\0';
+		len = snprintf(NULL, 0, "%s%s", PATH_CGROUP_FS, buf + 3);
+		if ((root = malloc(len + 1)) != NULL) {
+			(void)snprintf(root, len + 1, "%s%s", PATH_CGROUP_FS,
+			    buf + 3);
+		}
+		break;
+	}
+	(void)fclose(fp);
+	if (root == NULL && errno != ENOMEM)
+		errno = ENOENT;
+	return (root);
+}
+
+/*
+ * Create the cgroup for the given entry, and set its limits. Returns the
+ * path to the cgroup, or NULL if the cgroup could not be created.
+ */
+static char *
+make_cgroup(const char *id, const desktop_file_t *df)
+{
+	int	  len;
+	long	  weight;
+	char	  *path, *root, buf[32];
+	long long size;
+
+#ifndef __linux__
+	warnx("%s: cgroups are not supported on this system", id);
+	errno = ENOTSUP;
+	return (NULL);
+#endif
+	if (strchr(df->cgroup, '/') != NULL || *df->cgroup == '.' ||
+	    *df->cgroup == '\0') {
+		warnx("%s: Invalid X-DSB-CGroup value '%s'", id, df->cgroup);
+		errno = EINVAL;
+		return (NULL);
+	}
+	if ((root = cgroup_root()) == NULL) {
+		if (errno != ENOMEM)
+			warnx("%s: Couldn't determine cgroup root", id);
+		return (NULL);
+	}
+	len = snprintf(NULL, 0, "%s/%s%s", root, CGROUP_PREFIX, df->cgroup);
+	if ((path = malloc(len + 1)) == NULL)
+		return (NULL);
+	(void)snprintf(path, len + 1, "%s/%s%s", root, CGROUP_PREFIX,
+	    df->cgroup);
+	if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+		warn("%s: mkdir(%s)", id, path);
+		free(path);
+		errno = EACCES;
+		return (NULL);
+	}
+	if (df->cpu_weight != NULL &&
+	    parse_int(id, df->cpu_weight, 1, 10000, &weight) == 0) {
+		(void)snprintf(buf, sizeof(buf), "%ld", weight);
+		if (write_file(root, "cgroup.subtree_control", "+cpu") == -1 ||
+		    write_file(path, "cpu.weight", buf) == -1)
+			warn("%s: Couldn't set cpu.weight", id);
+	}
+	if (df->memory_high != NULL) {
+		if (parse_size(df->memory_high, &size) == -1) {
+			warnx("%s: Invalid X-DSB-MemoryHigh value '%s'", id,
+			    df->memory_high);
+		} else {
+			if (size == -1)
+				(void)strcpy(buf, "max");
+			else
+				(void)snprintf(buf, sizeof(buf), "%lld", size);
+			if (write_file(root, "cgroup.subtree_control",
+			    "+memory") == -1 ||
+			    write_file(path, "memory.high", buf) == -1)
+				warn("%s: Couldn't set memory.high", id);
+		}
+	}
+	return (path);
+}
@@ -0,0 +1,47 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RCTL_H_
+#define _RCTL_H_
+#include <limits.h>
+#include <stdbool.h>
+
+#include "dsbautostart.h"
+
+#define RCTL_MAXCPU	1024
+#define RCTL_NICE_UNSET	INT_MIN
+
+typedef struct rctl_s {
+	int	      nice;		/* X-DSB-Nice or RCTL_NICE_UNSET */
+	int	      io_class;		/* Kernel I/O class or -1 */
+	int	      io_prio;		/* X-DSB-IOPriority */
+	bool	      affinity;		/* CPU set is defined */
+	unsigned long cpus[RCTL_MAXCPU / (sizeof(unsigned long) * CHAR_BIT)];
+	char	      *cgroup;		/* Path to cgroup directory or NULL */
+} rctl_t;
+
+extern int  rctl_init(rctl_t *, const char *id, const desktop_file_t *);
+extern void rctl_apply(const rctl_t *, const char *id);
+extern void rctl_free(rctl_t *);
+#endif /* !_RCTL_H_ */
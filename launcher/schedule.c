@@ -0,0 +1,982 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Dependency-ordered launching. Entries can declare prerequisites by
+ * desktop file ID through X-DSB-After (start after the listed entries, if
+ * they are started at all) and X-DSB-Requires (don't start unless the
+ * listed entries were started successfully). A prerequisite is ready as
+ * soon as it was spawned, or, if it has X-DSB-Ready=exit, when it
+ * exited successfully. Everything else is started right away.
+ *
+ * Jobs which can be started at the same time are ordered by their launch
+ * history: Jobs other jobs depend on come first, followed by the cheap
+ * ones. Expensive jobs nothing depends on are deferred, and started one
+ * by one every DEFER_MS. Jobs with X-DSB-Background=true are deferred
+ * until the system has settled (see pressure.c). Jobs with
+ * X-DSB-NeedsDisplay=true are held until the display server accepts
+ * connections (see display.c).
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "launcher.h"
+#include "schedule.h"
+#include "evloop.h"
+#include "supervise.h"
+#include "history.h"
+#include "plan.h"
+#include "profile.h"
+#include "display.h"
+#include "prefetch.h"
+#include "pressure.h"
+#include "procidx.h"
+#include "watch.h"
+
+#define DEFER_MS	1000
+
+static int	njobs;
+static int	nadded;
+static int	nbatch;
+static int	ndeferred;
+static int	maxdeferred;
+static int	nheld;		/* # of jobs waiting for the display */
+static int	nsampling;	/* # of jobs whose history sample is pending */
+static int	defer_timer;
+static int	norder;
+static long	defer_clock;	/* Estimated start of the last deferred job */
+static bool	hist_saved;
+static bool	settled;	/* Background jobs may start */
+static bool	awaiting;	/* Waiting for the system to settle */
+static bool	display_ready;
+static bool	display_awaited;	/* display_wait() was called */
+static job_t	*jobs;
+static job_t	**deferred;
+static job_t	**held;		/* Jobs waiting for the display */
+static job_t	**added;	/* Jobs created by sched_flush() */
+static desktop_file_t **batch;	/* Desktop files queued by sched_add() */
+
+static int	create_jobs(dsbautostart_t *);
+static int	init_job(job_t *, desktop_file_t *, bool, bool);
+static void	check_running(job_t *);
+static int	add_deps(job_t *, const char *, bool);
+static int	add_dependent(job_t *, job_t *, bool);
+static void	break_cycles(void);
+static void	visit(job_t *, char *);
+static void	job_runnable(job_t *);
+static void	job_start(job_t *);
+static void	job_ready(job_t *);
+static void	job_fail(job_t *, job_state_t);
+static void	proc_exited(pid_t, int, const struct rusage *, void *);
+static void	start_deferred(void *);
+static void	schedule_deferred(void);
+static void	system_settled(void);
+static void	hold(job_t *);
+static void	display_available(void);
+static int	next_deferred(void);
+static job_t	*take_deferred(int);
+static long	defer_ms(void);
+static void	sample(void *);
+static void	check_done(void);
+static void	save_history(void);
+static int	cmp_cost(const void *, const void *);
+static job_t	*lookup_job(const char *);
+static bool	job_active(const char *);
+static bool	requirements_met(const job_t *);
+static void	skip_rule(job_t *, df_key_t);
+static restart_t parse_restart(const desktop_file_t *);
+
+int
+sched_run(dsbautostart_t *as)
+{
+	int   i, n;
+	long  t0;
+	job_t **list;
+
+	if (ev_init() == -1)
+		err(EXIT_FAILURE, "ev_init()");
+	if (opts.supervise && supervise_init() == -1)
+		err(EXIT_FAILURE, "supervise_init()");
+	t0 = ev_now_us();
+	if (create_jobs(as) == -1)
+		return (-1);
+	if (history_load(jobs, njobs) == -1)
+		warn("Couldn't read launch history");
+	if (!opts.dry_run && prefetch_load(jobs, njobs) == -1)
+		warn("Couldn't read prefetch list");
+	plan_phase("jobs", t0);
+	t0 = ev_now_us();
+	for (i = 0; i < njobs; i++) {
+		if (add_deps(&jobs[i], jobs[i].df->after, false) == -1 ||
+		    add_deps(&jobs[i], jobs[i].df->require, true) == -1)
+			return (-1);
+	}
+	break_cycles();
+	plan_phase("deps", t0);
+	if (opts.profile_ms > 0 && profile_start(jobs, njobs) == -1)
+		err(EXIT_FAILURE, "profile_start()");
+	t0 = ev_now_us();
+	if ((list = calloc(njobs, sizeof(job_t *))) == NULL ||
+	    (deferred = calloc(njobs, sizeof(job_t *))) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	maxdeferred = njobs;
+	/*
+	 * Entries that will not be started make the entries requiring
+	 * them fail.
+	 */
+	for (i = n = 0; i < njobs; i++) {
+		if (jobs[i].state == JOB_SKIPPED)
+			list[n++] = &jobs[i];
+	}
+	for (i = 0; i < n; i++)
+		job_fail(list[i], JOB_SKIPPED);
+	/* Jobs which are already running are ready. */
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].state == JOB_WAITING && jobs[i].running > 0)
+			job_ready(&jobs[i]);
+	}
+	if (!opts.dry_run)
+		prefetch_run(jobs, njobs);
+	/* Start the jobs without prerequisites, cheap ones first. */
+	for (i = n = 0; i < njobs; i++) {
+		if (jobs[i].state == JOB_WAITING && jobs[i].npending == 0 &&
+		    !jobs[i].deferred)
+			list[n++] = &jobs[i];
+	}
+	qsort(list, n, sizeof(job_t *), cmp_cost);
+	for (i = 0; i < n; i++) {
+		if (list[i]->state == JOB_WAITING && list[i]->npending == 0 &&
+		    !list[i]->deferred)
+			job_runnable(list[i]);
+	}
+	free(list);
+	check_done();
+	if (opts.supervise)
+		supervise_write_state();
+	if (opts.watch && watch_start() == -1)
+		warn("Couldn't watch the autostart directories");
+	if (ev_run() == -1)
+		err(EXIT_FAILURE, "ev_run()");
+	plan_phase("schedule", t0);
+	if (opts.dry_run) {
+		plan_print(jobs, njobs);
+		return (0);
+	}
+	if (!hist_saved)
+		save_history();
+	return (0);
+}
+
+/*
+ * Return the i-th job, including those created by sched_flush(), or NULL
+ * if there are fewer jobs.
+ */
+job_t *
+sched_job(int i)
+{
+	if (i < njobs)
+		return (&jobs[i]);
+	if (i < njobs + nadded)
+		return (added[i - njobs]);
+	return (NULL);
+}
+
+/*
+ * Queue a desktop file which appeared after the start. It's started by
+ * the next call of sched_flush(), unless a job with the same ID was
+ * started before. The desktop file is taken over.
+ */
+int
+sched_add(desktop_file_t *df)
+{
+	desktop_file_t **p;
+
+	if ((p = realloc(batch, (nbatch + 1) * sizeof(*p))) == NULL)
+		return (-1);
+	batch = p;
+	batch[nbatch++] = df;
+
+	return (0);
+}
+
+/*
+ * Create jobs for the desktop files queued by sched_add(), and start
+ * them, cheap ones first. Their X-DSB-Requires prerequisites must have
+ * been started already. X-DSB-After is ignored.
+ */
+void
+sched_flush()
+{
+	int   i, n;
+	bool  indexed;
+	job_t *job, **p, **list;
+
+	if (nbatch == 0)
+		return;
+	if ((list = calloc(nbatch, sizeof(job_t *))) == NULL ||
+	    (p = realloc(added, (nadded + nbatch) * sizeof(*p))) == NULL) {
+		warn("Couldn't start new entries");
+		free(list);
+		return;
+	}
+	added = p;
+	/* Programs may have been installed along with the new entries. */
+	if (dsbautostart_update_path_index() == -1)
+		warnx("%s", dsbautostart_strerror());
+	indexed = procidx_build() == 0;
+	for (i = n = 0; i < nbatch; i++) {
+		job = calloc(1, sizeof(*job));
+		if (job == NULL || job_active(batch[i]->path) ||
+		    init_job(job, batch[i],
+		    dsbautostart_df_exclude_rule(batch[i]) != -1, indexed) ==
+		    -1 || job->state == JOB_SKIPPED || job->running > 0 ||
+		    !requirements_met(job)) {
+			if (job != NULL)
+				rctl_free(&job->rctl);
+			dsbautostart_df_free(batch[i]);
+			free(job);
+			continue;
+		}
+		list[n++] = added[nadded++] = job;
+	}
+	procidx_free();
+	nbatch = 0;
+	qsort(list, n, sizeof(job_t *), cmp_cost);
+	for (i = 0; i < n; i++)
+		job_runnable(list[i]);
+	free(list);
+	check_done();
+	if (opts.supervise && n > 0)
+		supervise_write_state();
+}
+
+static int
+create_jobs(dsbautostart_t *as)
+{
+	int	   n;
+	bool	   indexed;
+	entry_t	   *ep;
+
+	for (n = 0, ep = as->cur_entries; ep != NULL; ep = ep->next)
+		n++;
+	if ((jobs = calloc(n, sizeof(job_t))) == NULL) {
+		warn("calloc()");
+		return (-1);
+	}
+	if (!(indexed = procidx_build() == 0))
+		warn("Couldn't read the process table");
+	for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
+		if (ep->deleted || ep->df->path == NULL)
+			continue;
+		jobs[njobs].entry = ep;
+		if (init_job(&jobs[njobs], ep->df, ep->exclude, indexed) == -1)
+			return (-1);
+		njobs++;
+	}
+	procidx_free();
+
+	return (0);
+}
+
+static int
+init_job(job_t *job, desktop_file_t *df, bool exclude, bool indexed)
+{
+	const char *p;
+
+	if ((p = strrchr(df->path, '/')) != NULL)
+		p++;
+	else
+		p = df->path;
+	job->id	    = (char *)p;
+	job->df	    = df;
+	job->pid    = -1;
+	job->status = -1;
+	job->profile = -1;
+	job->state  = JOB_WAITING;
+	job->restart = parse_restart(df);
+	job->ready_on_exit = df->ready != NULL &&
+	    strcmp(df->ready, "exit") == 0;
+	job->background = df->background != NULL &&
+	    strcmp(df->background, "true") == 0;
+	job->needs_display = df->needs_display != NULL &&
+	    strcmp(df->needs_display, "true") == 0;
+	if (exclude) {
+		job->state = JOB_SKIPPED;
+		skip_rule(job, dsbautostart_df_exclude_rule(df) ==
+		    DF_KEY_NOT_SHOW_IN ? DF_KEY_NOT_SHOW_IN :
+		    DF_KEY_ONLY_SHOW_IN);
+	} else if (!dsbautostart_df_available(df)) {
+		warnx("%s: Program not found. Skipping", df->path);
+		job->state = JOB_SKIPPED;
+		skip_rule(job, df->try_exec != NULL ?
+		    DF_KEY_TRY_EXEC : DF_KEY_EXEC);
+	} else if (indexed)
+		check_running(job);
+	/* Don't create cgroups in dry-run mode. */
+	if (job->state != JOB_SKIPPED && job->running == 0 && !opts.dry_run &&
+	    rctl_init(&job->rctl, p, df) == -1) {
+		warn("rctl_init()");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * If the program of the given job is already running in our session,
+ * and the job doesn't have X-DSB-AllowMultiple=true, remember its PID.
+ * Shell command lines can't be checked.
+ */
+static void
+check_running(job_t *job)
+{
+	char  *path;
+	pid_t pid;
+
+	if (job->df->allow_multiple != NULL &&
+	    strcmp(job->df->allow_multiple, "true") == 0)
+		return;
+	if (job->df->shell || (path = dsbautostart_df_program(job->df)) == NULL)
+		return;
+	pid = procidx_find(path, dsbautostart_df_argv(job->df));
+	free(path);
+	if (pid == -1)
+		return;
+	warnx("%s: Already running as PID %d. Skipping", job->id, (int)pid);
+	job->running = pid;
+	job->rule = dsbautostart_df_key_name(DF_KEY_ALLOW_MULTIPLE);
+	job->rule_value = job->df->allow_multiple;
+}
+
+/*
+ * Remember the key which caused the job to be skipped.
+ */
+static void
+skip_rule(job_t *job, df_key_t key)
+{
+	job->rule = dsbautostart_df_key_name(key);
+	switch (key) {
+	case DF_KEY_NOT_SHOW_IN:
+		job->rule_value = job->df->not_show_in;
+		break;
+	case DF_KEY_ONLY_SHOW_IN:
+		job->rule_value = job->df->only_show_in;
+		break;
+	case DF_KEY_TRY_EXEC:
+		job->rule_value = job->df->try_exec;
+		break;
+	default:
+		job->rule_value = job->df->exec;
+	}
+}
+
+static restart_t
+parse_restart(const desktop_file_t *df)
+{
+	if (df->restart == NULL || strcmp(df->restart, "never") == 0)
+		return (RESTART_NEVER);
+	if (strcmp(df->restart, "on-failure") == 0)
+		return (RESTART_ON_FAILURE);
+	if (strcmp(df->restart, "always") == 0)
+		return (RESTART_ALWAYS);
+	warnx("%s: Invalid X-DSB-Restart value '%s'", df->path, df->restart);
+
+	return (RESTART_NEVER);
+}
+
+/*
+ * Look up a job by its desktop file ID. The ".desktop" suffix is optional.
+ */
+static job_t *
+lookup_job(const char *id)
+{
+	int    i;
+	size_t len;
+
+	len = strlen(id);
+	for (i = 0; i < njobs; i++) {
+		if (strncmp(jobs[i].id, id, len) != 0)
+			continue;
+		if (jobs[i].id[len] == '\0' ||
+		    strcmp(jobs[i].id + len, ".desktop") == 0)
+			return (&jobs[i]);
+	}
+	return (NULL);
+}
+
+/*
+ * Check whether a job for the desktop file with the given path was
+ * started, or is about to be started.
+ */
+static bool
+job_active(const char *path)
+{
+	int	   i;
+	job_t	   *job;
+	const char *id;
+
+	id = (id = strrchr(path, '/')) != NULL ? id + 1 : path;
+	for (i = 0; (job = sched_job(i)) != NULL; i++) {
+		if (strcmp(job->id, id) != 0)
+			continue;
+		if (job->state != JOB_SKIPPED && job->state != JOB_FAILED)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Check whether the X-DSB-Requires prerequisites of a job added by
+ * sched_flush() were started.
+ */
+static bool
+requirements_met(const job_t *job)
+{
+	char  *buf, *id, *last;
+	bool  met;
+	job_t *pre;
+
+	if (job->df->require == NULL)
+		return (true);
+	if ((buf = strdup(job->df->require)) == NULL) {
+		warn("strdup()");
+		return (false);
+	}
+	for (met = true, id = buf; met &&
+	    (id = strtok_r(id, "; \t", &last)) != NULL; id = NULL) {
+		pre = lookup_job(id);
+		if (pre != NULL && (pre->state == JOB_READY ||
+		    pre->state == JOB_RUNNING || pre->state == JOB_EXITED ||
+		    pre->state == JOB_BACKOFF))
+			continue;
+		warnx("%s: Requirement %s not met. Skipping", job->id, id);
+		met = false;
+	}
+	free(buf);
+
+	return (met);
+}
+
+/*
+ * Add the jobs from the given semicolon separated list of desktop file
+ * IDs as prerequisites of "job". If a required job does not exist, "job"
+ * is skipped, and its rule refers to the missing ID in "buf", which is
+ * kept then.
+ */
+static int
+add_deps(job_t *job, const char *list, bool required)
+{
+	char  *buf, *id, *last;
+	bool  keep;
+	job_t *pre;
+
+	if (list == NULL)
+		return (0);
+	if ((buf = strdup(list)) == NULL) {
+		warn("strdup()");
+		return (-1);
+	}
+	keep = false;
+	for (id = buf; (id = strtok_r(id, "; \t", &last)) != NULL; id = NULL) {
+		if ((pre = lookup_job(id)) == NULL) {
+			if (!required)
+				continue;
+			warnx("%s: Requires %s which does not exist", job->id,
+			    id);
+			if (job->state != JOB_SKIPPED) {
+				job->rule = dsbautostart_df_key_name(
+				    DF_KEY_REQUIRES);
+				job->rule_value = id;
+				keep = true;
+			}
+			job->state = JOB_SKIPPED;
+			continue;
+		}
+		if (pre == job)
+			continue;
+		if (add_dependent(pre, job, required) == -1) {
+			if (!keep)
+				free(buf);
+			return (-1);
+		}
+	}
+	if (!keep)
+		free(buf);
+
+	return (0);
+}
+
+static int
+add_dependent(job_t *job, job_t *dependent, bool required)
+{
+	size_t	  i;
+	job_dep_t *p;
+
+	for (i = 0; i < job->ndependents; i++) {
+		if (job->dependents[i].job == dependent) {
+			job->dependents[i].required |= required;
+			return (0);
+		}
+	}
+	p = realloc(job->dependents, (job->ndependents + 1) * sizeof(*p));
+	if (p == NULL) {
+		warn("realloc()");
+		return (-1);
+	}
+	job->dependents = p;
+	job->dependents[job->ndependents].job = dependent;
+	job->dependents[job->ndependents].required = required;
+	job->ndependents++;
+	dependent->npending++;
+
+	return (0);
+}
+
+/*
+ * Find dependency cycles by a depth-first search, and break them by
+ * removing the edges that close them.
+ */
+static void
+break_cycles()
+{
+	int  i;
+	char *color;
+
+	if ((color = calloc(njobs, 1)) == NULL)
+		err(EXIT_FAILURE, "calloc()");
+	for (i = 0; i < njobs; i++) {
+		if (color[i] == 0)
+			visit(&jobs[i], color);
+	}
+	free(color);
+}
+
+static void
+visit(job_t *job, char *color)
+{
+	size_t i;
+	job_t  *dep;
+
+	color[job - jobs] = 1;
+	for (i = 0; i < job->ndependents;) {
+		dep = job->dependents[i].job;
+		if (color[dep - jobs] == 1) {
+			warnx("Dependency cycle between %s and %s. Ignoring " \
+			    "dependency of %s on %s", job->id, dep->id,
+			    dep->id, job->id);
+			dep->npending--;
+			job->dependents[i] =
+			    job->dependents[--job->ndependents];
+			continue;
+		}
+		if (color[dep - jobs] == 0)
+			visit(dep, color);
+		i++;
+	}
+	color[job - jobs] = 2;
+}
+
+/*
+ * Start the given job, unless it's expensive, and nothing depends on it,
+ * or it's a background job. In that case it's queued, and started later
+ * by start_deferred(). Jobs which need the display are held until it's
+ * ready.
+ */
+static void
+job_runnable(job_t *job)
+{
+	job_t **p;
+
+	if (job->needs_display && !display_ready && !opts.dry_run) {
+		hold(job);
+		return;
+	}
+	if (!job->background &&
+	    (job->ndependents > 0 || !history_expensive(&job->hist))) {
+		job_start(job);
+		return;
+	}
+	if (job->background && !settled && !awaiting) {
+		awaiting = true;
+		if (opts.dry_run)
+			settled = true;
+		else if (pressure_wait(system_settled) == -1) {
+			warn("pressure_wait()");
+			settled = true;
+		}
+	}
+	if (ndeferred == maxdeferred) {
+		/* Jobs added by sched_flush() */
+		if ((p = realloc(deferred, (maxdeferred + 8) *
+		    sizeof(*p))) == NULL) {
+			warn("realloc()");
+			job_start(job);
+			return;
+		}
+		deferred = p;
+		maxdeferred += 8;
+	}
+	job->deferred = true;
+	deferred[ndeferred++] = job;
+	schedule_deferred();
+}
+
+/*
+ * Hold the job until the display server accepts connections. Like
+ * deferred jobs, held jobs don't keep the parent process waiting.
+ */
+static void
+hold(job_t *job)
+{
+	job_t **p;
+
+	if ((p = realloc(held, (nheld + 1) * sizeof(*p))) == NULL) {
+		warn("realloc()");
+		job_start(job);
+		return;
+	}
+	held = p;
+	job->deferred = true;
+	held[nheld++] = job;
+	if (display_awaited)
+		return;
+	display_awaited = true;
+	if (display_wait(display_available) == -1) {
+		warn("display_wait()");
+		display_available();
+	}
+}
+
+static void
+display_available()
+{
+	int   i, n;
+	job_t **list;
+
+	if (display_ready)
+		return;
+	display_ready = true;
+	list = held; n = nheld;
+	held = NULL; nheld = 0;
+	for (i = 0; i < n; i++) {
+		list[i]->deferred = false;
+		if (list[i]->state == JOB_WAITING)
+			job_runnable(list[i]);
+	}
+	free(list);
+	check_done();
+}
+
+static void
+system_settled()
+{
+	settled = true;
+	schedule_deferred();
+	check_done();
+}
+
+/*
+ * Return the index of the cheapest deferred job which may be started now,
+ * or -1.
+ */
+static int
+next_deferred()
+{
+	int i;
+
+	qsort(deferred, ndeferred, sizeof(job_t *), cmp_cost);
+	for (i = 0; i < ndeferred; i++) {
+		if (!deferred[i]->background || settled)
+			return (i);
+	}
+	return (-1);
+}
+
+static job_t *
+take_deferred(int i)
+{
+	job_t *job = deferred[i];
+
+	(void)memmove(deferred + i, deferred + i + 1,
+	    (--ndeferred - i) * sizeof(job_t *));
+	return (job);
+}
+
+/*
+ * Arm the timer for the next deferred job, if there is one which may be
+ * started.
+ */
+static void
+schedule_deferred()
+{
+	int   i;
+	job_t *job;
+
+	if (defer_timer != 0 || next_deferred() == -1)
+		return;
+	if ((defer_timer = ev_add_timer(defer_ms(), start_deferred,
+	    NULL)) != -1)
+		return;
+	warn("ev_add_timer()");
+	defer_timer = 0;
+	/* Without a timer, start them right away. */
+	while ((i = next_deferred()) != -1) {
+		job = take_deferred(i);
+		if (job->state == JOB_WAITING)
+			job_start(job);
+	}
+}
+
+/*
+ * Start the cheapest of the deferred jobs.
+ */
+static void
+start_deferred(void *arg)
+{
+	int   i;
+	job_t *job;
+
+	(void)arg;
+	defer_timer = 0;
+	if ((i = next_deferred()) == -1)
+		return;
+	job = take_deferred(i);
+	defer_clock += DEFER_MS;
+	if (job->est_start < defer_clock)
+		job->est_start = defer_clock;
+	if (job->state == JOB_WAITING)
+		job_start(job);
+	schedule_deferred();
+	check_done();
+}
+
+/*
+ * In dry-run mode, deferred jobs are "started" without delay. Their
+ * estimated start time is tracked by defer_clock.
+ */
+static long
+defer_ms()
+{
+	return (opts.dry_run ? 0 : DEFER_MS);
+}
+
+static void
+job_start(job_t *job)
+{
+	job->order = ++norder;
+	if (opts.dry_run) {
+		/* Assume the job succeeds, and becomes ready as usual. */
+		job_ready(job);
+		return;
+	}
+	job->started = ev_now_ms();
+	if ((job->pid = spawn(job)) == -1) {
+		history_record(&job->hist, 0, 0, true);
+		job_fail(job, JOB_FAILED);
+		return;
+	}
+	/*
+	 * Watch every job for HIST_WINDOW_MS to record its launch history.
+	 * After that, only jobs we wait for, or supervise, are watched.
+	 */
+	if (ev_watch_proc(job->pid, proc_exited, job) == -1) {
+		warn("ev_watch_proc()");
+		job_ready(job);
+		return;
+	}
+	job->sample_timer = ev_add_timer(HIST_WINDOW_MS, sample, job);
+	if (job->sample_timer == -1) {
+		warn("ev_add_timer()");
+		job->sample_timer = 0;
+		if (!job->ready_on_exit && !opts.supervise)
+			ev_unwatch_proc(job->pid);
+	} else
+		nsampling++;
+	if (!job->ready_on_exit) {
+		job_ready(job);
+		return;
+	}
+	job->state = JOB_RUNNING;
+}
+
+static void
+proc_exited(pid_t pid, int status, const struct rusage *ru, void *arg)
+{
+	long  cpu_ms;
+	job_t *job = arg;
+
+	(void)pid;
+	if (job->sample_timer > 0) {
+		ev_del_timer(job->sample_timer);
+		job->sample_timer = 0;
+		nsampling--;
+		cpu_ms = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000 +
+		    (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) / 1000;
+		history_record(&job->hist, cpu_ms, ev_now_ms() - job->started,
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+	}
+	if (job->state == JOB_RUNNING) {
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			job_ready(job);
+		else {
+			warnx("%s: Command failed", job->id);
+			job_fail(job, JOB_FAILED);
+		}
+	}
+	if (opts.supervise)
+		supervise_exited(job, status);
+	check_done();
+}
+
+/*
+ * Record the CPU time the job used in its first HIST_WINDOW_MS.
+ */
+static void
+sample(void *arg)
+{
+	long  cpu_ms;
+	job_t *job = arg;
+
+	job->sample_timer = 0;
+	nsampling--;
+	if ((cpu_ms = history_cpu_ms(job->pid)) != -1)
+		history_record(&job->hist, cpu_ms, -1, false);
+	prefetch_learn(job);
+	if (job->state != JOB_RUNNING && !opts.supervise)
+		ev_unwatch_proc(job->pid);
+	check_done();
+}
+
+/*
+ * Let the parent process return once all jobs except for the deferred
+ * ones were started, and write the history once all samples were taken.
+ */
+static void
+check_done()
+{
+	int  i;
+	bool started, waiting;
+
+	for (i = 0, started = true, waiting = false; i < njobs; i++) {
+		if (jobs[i].state == JOB_WAITING) {
+			waiting = true;
+			if (!jobs[i].deferred)
+				started = false;
+		} else if (jobs[i].state == JOB_RUNNING)
+			started = false;
+	}
+	/* In profile mode, the parent is released after the report. */
+	if (started && !profile_active())
+		release_parent(EXIT_SUCCESS);
+	if (!waiting && nsampling == 0 && !hist_saved && !opts.dry_run) {
+		hist_saved = true;
+		save_history();
+	}
+}
+
+static void
+save_history()
+{
+	if (history_save(jobs, njobs) == -1)
+		warn("Couldn't write launch history");
+	if (prefetch_save(jobs, njobs) == -1)
+		warn("Couldn't write prefetch list");
+}
+
+/*
+ * Order jobs other jobs depend on first, flaky jobs last, and the rest
+ * by the CPU time they used in their first HIST_WINDOW_MS.
+ */
+static int
+cmp_cost(const void *a, const void *b)
+{
+	bool	    c1, c2;
+	const job_t *j1 = *(job_t * const *)a;
+	const job_t *j2 = *(job_t * const *)b;
+
+	c1 = j1->ndependents > 0 || j1->ready_on_exit;
+	c2 = j2->ndependents > 0 || j2->ready_on_exit;
+	if (c1 != c2)
+		return (c1 ? -1 : 1);
+	c1 = j1->hist.fails >= HIST_FLAKY;
+	c2 = j2->hist.fails >= HIST_FLAKY;
+	if (c1 != c2)
+		return (c1 ? 1 : -1);
+	return (j1->hist.cpu_ms - j2->hist.cpu_ms);
+}
+
+/*
+ * Release the dependents of the given job.
+ */
+static void
+job_ready(job_t *job)
+{
+	long   ready;
+	size_t i;
+	job_t  *dep;
+
+	job->state = JOB_READY;
+	ready = job->est_start;
+	if (job->ready_on_exit && job->hist.exit_ms > 0)
+		ready += job->hist.exit_ms;
+	for (i = 0; i < job->ndependents; i++) {
+		dep = job->dependents[i].job;
+		if (dep->est_start < ready)
+			dep->est_start = ready;
+		if (--dep->npending == 0 && dep->state == JOB_WAITING)
+			job_runnable(dep);
+	}
+}
+
+/*
+ * Mark the given job as failed or skipped. Dependents which require it
+ * are skipped, the others don't wait for it any longer.
+ */
+static void
+job_fail(job_t *job, job_state_t state)
+{
+	size_t i;
+	job_t  *dep;
+
+	job->state = state;
+	for (i = 0; i < job->ndependents; i++) {
+		dep = job->dependents[i].job;
+		dep->npending--;
+		if (dep->state != JOB_WAITING)
+			continue;
+		if (job->dependents[i].required) {
+			warnx("%s: Requirement %s not met. Skipping", dep->id,
+			    job->id);
+			dep->rule = dsbautostart_df_key_name(DF_KEY_REQUIRES);
+			dep->rule_value = job->id;
+			job_fail(dep, JOB_SKIPPED);
+		} else if (dep->npending == 0)
+			job_runnable(dep);
+	}
+}
@@ -0,0 +1,107 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "launcher.h"
+#include "evloop.h"
+#include "logcap.h"
+#include "profile.h"
+
+/*
+ * Execute the command of the given job in the background. The command is
+ * only passed to /bin/sh if it requires a shell. Its output is captured
+ * by logcap. Returns the PID of the child, or -1 if fork() or exec failed.
+ */
+pid_t
+spawn(job_t *job)
+{
+	int   pfd[2], lfd[2], error;
+	char  **argv;
+	pid_t pid;
+
+	if ((argv = dsbautostart_df_argv(job->df)) == NULL) {
+		warnx("%s: %s", job->id, dsbautostart_strerror());
+		return (-1);
+	}
+	/*
+	 * The child reports exec failures through a close-on-exec pipe. If
+	 * we read EOF, exec succeeded.
+	 */
+	if (pipe(pfd) == -1) {
+		warn("pipe()");
+		return (-1);
+	}
+	(void)fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+	if (logcap_open(job, lfd) == -1) {
+		warnx("%s: Couldn't capture output", job->id);
+		lfd[0] = lfd[1] = -1;
+	}
+	switch ((pid = fork())) {
+	case -1:
+		warn("fork()");
+		(void)close(pfd[0]); (void)close(pfd[1]);
+		/* The read end is closed when the log reader sees EOF. */
+		if (lfd[1] != -1)
+			(void)close(lfd[1]);
+		return (-1);
+	case 0:
+		(void)close(pfd[0]);
+		ev_child_init();
+		if (opts.profile_ms > 0)
+			(void)setpgid(0, 0);
+		if (lfd[0] != -1)
+			logcap_child(lfd);
+		rctl_apply(&job->rctl, job->id);
+		(void)execvp(argv[0], argv);
+		error = errno;
+		(void)write(pfd[1], &error, sizeof(error));
+		_exit(127);
+	}
+	(void)close(pfd[1]);
+	if (opts.profile_ms > 0) {
+		/* Avoid racing with the child's setpgid(). */
+		(void)setpgid(pid, pid);
+		profile_add(job, pid);
+	}
+	if (lfd[1] != -1)
+		(void)close(lfd[1]);
+	error = 0;
+	while (read(pfd[0], &error, sizeof(error)) == -1 && errno == EINTR)
+		;
+	(void)close(pfd[0]);
+	if (error != 0) {
+		errno = error;
+		warn("%s: execvp(%s)", job->id, argv[0]);
+		return (-1);
+	}
+	return (pid);
+}
@@ -0,0 +1,239 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Supervisor mode. The launcher stays resident, keeps track of the
+ * commands it started, and restarts those with X-DSB-Restart set to
+ * "on-failure" or "always" when they terminate. Restarts are delayed by
+ * an exponential backoff. If a command keeps exiting shortly after it
+ * was started, we give up on it. The current state of all commands is
+ * written to $XDG_RUNTIME_DIR/dsbautostart.state on every change.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "launcher.h"
+#include "supervise.h"
+#include "schedule.h"
+#include "evloop.h"
+
+#define BACKOFF_MIN_MS	1000
+#define BACKOFF_MAX_MS	60000
+#define STABLE_MS	30000	/* Runtime after which a command is stable */
+#define MAX_FAILS	5	/* # of early exits in a row before we give up */
+#define STATE_FILE	"dsbautostart.state"
+
+static bool stopping;
+static char *state_file;
+
+static void stop(int, void *);
+static void restart_job(void *);
+static void proc_exited(pid_t, int, const struct rusage *, void *);
+static const char *state_name(job_state_t);
+
+int
+supervise_init()
+{
+	size_t	   len;
+	const char *dir;
+
+	if (ev_add_signal(SIGTERM, stop, NULL) == -1 ||
+	    ev_add_signal(SIGINT, stop, NULL) == -1 ||
+	    ev_add_signal(SIGHUP, stop, NULL) == -1)
+		return (-1);
+	if ((dir = getenv("XDG_RUNTIME_DIR")) != NULL && *dir == '/') {
+		len = strlen(dir) + sizeof(STATE_FILE) + 1;
+		if ((state_file = malloc(len)) == NULL)
+			return (-1);
+		(void)snprintf(state_file, len, "%s/%s", dir, STATE_FILE);
+	} else if ((state_file = dsbautostart_cache_path("state")) == NULL)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Called when a command started by us terminated.
+ */
+void
+supervise_exited(job_t *job, int status)
+{
+	long delay, runtime;
+	bool failed;
+
+	job->status = status;
+	job->pid    = -1;
+	failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+	if (job->state == JOB_READY)
+		job->state = JOB_EXITED;
+	if (stopping || job->ready_on_exit || job->restart == RESTART_NEVER ||
+	    (job->restart == RESTART_ON_FAILURE && !failed)) {
+		supervise_write_state();
+		return;
+	}
+	runtime = ev_now_ms() - job->started;
+	if (runtime >= STABLE_MS)
+		job->nfails = 0;
+	if (++job->nfails > MAX_FAILS) {
+		warnx("%s: Exited %d times in a row. Giving up", job->id,
+		    MAX_FAILS);
+		job->state = JOB_FAILED;
+		supervise_write_state();
+		return;
+	}
+	delay = (long)BACKOFF_MIN_MS << (job->nfails - 1);
+	if (delay > BACKOFF_MAX_MS)
+		delay = BACKOFF_MAX_MS;
+	job->state = JOB_BACKOFF;
+	job->timer = ev_add_timer(delay, restart_job, job);
+	if (job->timer == -1) {
+		warn("ev_add_timer()");
+		job->state = JOB_FAILED;
+	}
+	supervise_write_state();
+}
+
+static void
+restart_job(void *arg)
+{
+	job_t *job = arg;
+
+	job->timer = 0;
+	job->nrestarts++;
+	job->started = ev_now_ms();
+	if ((job->pid = spawn(job)) == -1) {
+		supervise_exited(job, W_EXITCODE(127, 0));
+		return;
+	}
+	job->state = JOB_READY;
+	if (ev_watch_proc(job->pid, proc_exited, job) == -1)
+		warn("ev_watch_proc()");
+	supervise_write_state();
+}
+
+static void
+proc_exited(pid_t pid, int status, const struct rusage *ru, void *arg)
+{
+	(void)pid; (void)ru;
+	supervise_exited((job_t *)arg, status);
+}
+
+/*
+ * Stop restarting commands, terminate the restartable ones, and quit.
+ */
+static void
+stop(int sig, void *arg)
+{
+	int   i;
+	job_t *job;
+
+	(void)sig; (void)arg;
+	stopping = true;
+	for (i = 0; (job = sched_job(i)) != NULL; i++) {
+		if (job->restart == RESTART_NEVER)
+			continue;
+		if (job->state == JOB_BACKOFF)
+			ev_del_timer(job->timer);
+		else if (job->pid > 0)
+			(void)kill(job->pid, SIGTERM);
+		job->state = JOB_EXITED;
+	}
+	if (state_file != NULL)
+		(void)unlink(state_file);
+	ev_quit();
+}
+
+static const char *
+state_name(job_state_t state)
+{
+	switch (state) {
+	case JOB_WAITING:
+		return ("waiting");
+	case JOB_RUNNING:
+	case JOB_READY:
+		return ("running");
+	case JOB_FAILED:
+		return ("failed");
+	case JOB_SKIPPED:
+		return ("skipped");
+	case JOB_EXITED:
+		return ("exited");
+	case JOB_BACKOFF:
+		return ("backoff");
+	}
+	return ("unknown");
+}
+
+/*
+ * Write one line per command containing its desktop file ID, state, PID,
+ * number of restarts, and the last exit status.
+ */
+void
+supervise_write_state()
+{
+	int   i, fd;
+	FILE  *fp;
+	char  *tmp;
+	job_t *job;
+	size_t len;
+
+	if (state_file == NULL || stopping)
+		return;
+	len = strlen(state_file) + sizeof(".XXXXXX");
+	if ((tmp = malloc(len)) == NULL)
+		return;
+	(void)snprintf(tmp, len, "%s.XXXXXX", state_file);
+	if ((fd = mkstemp(tmp)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		warn("mkstemp(%s)", tmp);
+		if (fd != -1) {
+			(void)close(fd);
+			(void)unlink(tmp);
+		}
+		free(tmp);
+		return;
+	}
+	(void)fprintf(fp, "# ID\tSTATE\tPID\tRESTARTS\tSTATUS\n");
+	for (i = 0; (job = sched_job(i)) != NULL; i++) {
+		(void)fprintf(fp, "%s\t%s\t%d\t%d\t", job->id,
+		    state_name(job->state), (int)job->pid, job->nrestarts);
+		if (job->status == -1)
+			(void)fprintf(fp, "-\n");
+		else if (WIFSIGNALED(job->status))
+			(void)fprintf(fp, "SIG%d\n", WTERMSIG(job->status));
+		else
+			(void)fprintf(fp, "%d\n", WEXITSTATUS(job->status));
+	}
+	if (fclose(fp) != 0 || rename(tmp, state_file) == -1) {
+		warn("Failed to write %s", state_file);
+		(void)unlink(tmp);
+	}
+	free(tmp);
+}
@@ -0,0 +1,345 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Watch mode (-w). The XDG autostart directories are watched for new or
+ * changed desktop files. On Linux, inotify(7) reports the names of the
+ * files, on the BSDs a kqueue(2) vnode event makes us look for files
+ * whose identity (device, inode, size, mtime) changed. Changes are
+ * collected until there were none for WATCH_DEBOUNCE_MS, but at most for
+ * WATCH_MAX_DELAY_MS. Then only the changed files are read, and passed
+ * to the scheduler, which starts the ones that are eligible, and not
+ * started yet.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+#endif
+
+#include "launcher.h"
+#include "watch.h"
+#include "schedule.h"
+#include "evloop.h"
+
+#define MAX_DIRS 16
+
+struct file_s {
+	char		*path;
+	dev_t		dev;
+	ino_t		ino;
+	off_t		size;
+	struct timespec	mtime;
+};
+
+static int	      nfiles;
+static int	      npending;
+static int	      timer;
+static long	      first_change;	/* Time of the oldest pending change */
+static char	      **pending;	/* Paths of changed files */
+static struct file_s  *files;		/* Files we know about */
+#ifdef __linux__
+static int	      wds[MAX_DIRS];
+static const char     *wd_dirs[MAX_DIRS];
+#endif
+
+static int  scan_dir(const char *, bool);
+static int  queue(const char *, const char *);
+static bool is_desktop_file(const char *);
+static bool changed(const char *);
+static void flush(void *);
+#ifdef __linux__
+static bool is_symlink(const char *, const char *);
+static void read_events(int, void *);
+#else
+static void dir_changed(int, void *);
+#endif
+
+/*
+ * Record the identity of all existing desktop files, and start watching
+ * the autostart directories.
+ */
+int
+watch_start()
+{
+	int	   i, fd;
+	const char *dir;
+
+#ifdef __linux__
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+		return (-1);
+#endif
+	for (i = 0; i < MAX_DIRS && (dir = dsbautostart_xdg_dir(i)) != NULL;
+	    i++) {
+		/* Make sure the user's directory exists, so we can watch it. */
+		if (i == 0)
+			(void)mkdir(dir, 0755);
+		if (scan_dir(dir, false) == -1)
+			continue;
+#ifdef __linux__
+		wd_dirs[i] = dir;
+		if ((wds[i] = inotify_add_watch(fd, dir, IN_CLOSE_WRITE |
+		    IN_MOVED_TO | IN_CREATE)) == -1) {
+			warn("inotify_add_watch(%s)", dir);
+			wd_dirs[i] = NULL;
+		}
+#else
+		if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+			warn("open(%s)", dir);
+			continue;
+		}
+		if (ev_watch_dir(fd, dir_changed, (void *)dir) == -1) {
+			warn("ev_watch_dir(%s)", dir);
+			(void)close(fd);
+		}
+#endif
+	}
+#ifdef __linux__
+	if (ev_add_fd(fd, read_events, NULL) == -1)
+		return (-1);
+#endif
+	return (0);
+}
+
+/*
+ * Look at the desktop files in the given directory. If "notify" is false,
+ * only their identity is recorded. Else they are queued, and flush()
+ * picks out the changed ones.
+ */
+static int
+scan_dir(const char *dir, bool notify)
+{
+	DIR	      *dirp;
+	char	      path[PATH_MAX];
+	struct dirent *dp;
+
+	if ((dirp = opendir(dir)) == NULL)
+		return (-1);
+	while ((dp = readdir(dirp)) != NULL) {
+		if (!is_desktop_file(dp->d_name))
+			continue;
+		if (notify)
+			(void)queue(dir, dp->d_name);
+		else {
+			(void)snprintf(path, sizeof(path), "%s/%s", dir,
+			    dp->d_name);
+			(void)changed(path);
+		}
+	}
+	(void)closedir(dirp);
+
+	return (0);
+}
+
+static bool
+is_desktop_file(const char *name)
+{
+	size_t len = strlen(name);
+
+	return (len > sizeof(".desktop") - 1 &&
+	    strcmp(name + len - sizeof(".desktop") + 1, ".desktop") == 0);
+}
+
+/*
+ * Check whether the given file is new, or its identity changed since we
+ * looked at it the last time.
+ */
+static bool
+changed(const char *path)
+{
+	int	      i;
+	char	      *p;
+	struct stat   sb;
+	struct file_s *f;
+
+	if (stat(path, &sb) == -1 || !S_ISREG(sb.st_mode))
+		return (false);
+	for (i = 0; i < nfiles && strcmp(files[i].path, path) != 0; i++)
+		;
+	if (i < nfiles) {
+		f = &files[i];
+		if (f->dev == sb.st_dev && f->ino == sb.st_ino &&
+		    f->size == sb.st_size &&
+		    f->mtime.tv_sec == sb.st_mtim.tv_sec &&
+		    f->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+			return (false);
+	} else {
+		if ((f = realloc(files, (nfiles + 1) * sizeof(*f))) == NULL ||
+		    (p = strdup(path)) == NULL) {
+			if (f != NULL)
+				files = f;
+			warn("Couldn't record %s", path);
+			return (true);
+		}
+		files = f;
+		f = &files[nfiles++];
+		f->path = p;
+	}
+	f->dev	 = sb.st_dev;
+	f->ino	 = sb.st_ino;
+	f->size	 = sb.st_size;
+	f->mtime = sb.st_mtim;
+
+	return (true);
+}
+
+/*
+ * Add the given file to the pending changes, and (re)arm the timer.
+ */
+static int
+queue(const char *dir, const char *name)
+{
+	int  i;
+	long now, delay;
+	char *path, **p, buf[PATH_MAX];
+
+	(void)snprintf(buf, sizeof(buf), "%s/%s", dir, name);
+	for (i = 0; i < npending && strcmp(pending[i], buf) != 0; i++)
+		;
+	if (i < npending)
+		return (0);
+	if ((path = strdup(buf)) == NULL)
+		return (-1);
+	if ((p = realloc(pending, (npending + 1) * sizeof(char *))) == NULL) {
+		free(path);
+		return (-1);
+	}
+	pending = p;
+	pending[npending++] = path;
+
+	now = ev_now_ms();
+	if (npending == 1)
+		first_change = now;
+	if (timer != 0)
+		ev_del_timer(timer);
+	delay = first_change + WATCH_MAX_DELAY_MS - now;
+	if (delay > WATCH_DEBOUNCE_MS)
+		delay = WATCH_DEBOUNCE_MS;
+	else if (delay < 0)
+		delay = 0;
+	if ((timer = ev_add_timer(delay, flush, NULL)) == -1) {
+		warn("ev_add_timer()");
+		timer = 0;
+		flush(NULL);
+	}
+	return (0);
+}
+
+/*
+ * Read the changed desktop files which take precedence over the ones
+ * with the same ID in other directories, and pass them to the scheduler.
+ */
+static void
+flush(void *arg)
+{
+	int	       i;
+	char	       *path;
+	const char     *id;
+	desktop_file_t *df;
+
+	(void)arg;
+	timer = 0;
+	for (i = 0; i < npending; i++) {
+		if (!changed(pending[i]))
+			continue;
+		id = strrchr(pending[i], '/') + 1;
+		path = dsbautostart_df_lookup(id);
+		if (path == NULL || strcmp(path, pending[i]) != 0) {
+			free(path);
+			continue;
+		}
+		free(path);
+		if ((df = dsbautostart_df_read(pending[i])) == NULL) {
+			if (dsbautostart_error())
+				warnx("%s", dsbautostart_strerror());
+			continue;
+		}
+		if (df->hidden || sched_add(df) == -1)
+			dsbautostart_df_free(df);
+	}
+	for (i = 0; i < npending; i++)
+		free(pending[i]);
+	npending = 0;
+	sched_flush();
+}
+
+#ifdef __linux__
+static bool
+is_symlink(const char *dir, const char *name)
+{
+	char	    path[PATH_MAX];
+	struct stat sb;
+
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, name);
+	return (lstat(path, &sb) == 0 && S_ISLNK(sb.st_mode));
+}
+
+static void
+read_events(int fd, void *arg)
+{
+	int	   i;
+	char	   *p, buf[4096]
+	    __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t	   n;
+	const struct inotify_event *ev;
+
+	(void)arg;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->len == 0 || !is_desktop_file(ev->name))
+				continue;
+			for (i = 0; i < MAX_DIRS && (wd_dirs[i] == NULL ||
+			    wds[i] != ev->wd); i++)
+				;
+			if (i == MAX_DIRS)
+				continue;
+			/*
+			 * Regular files are queued once they were written,
+			 * but symlinks don't get IN_CLOSE_WRITE.
+			 */
+			if ((ev->mask & IN_CREATE) &&
+			    !is_symlink(wd_dirs[i], ev->name))
+				continue;
+			(void)queue(wd_dirs[i], ev->name);
+		}
+	}
+}
+#else
+static void
+dir_changed(int fd, void *arg)
+{
+	(void)scan_dir((const char *)arg, true);
+}
+#endif
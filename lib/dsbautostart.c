@@ -30,6 +30,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <unistd.h>
 #include <dirent.h>
@@ -38,13 +39,30 @@
 #include <err.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 
 #include "dsbautostart.h"
+#include "pathindex.h"
+#include "stats.h"
 
 #define N_XDG_DIRS		8
+#define N_LOCALES		4
+#define N_DESKTOPS		63	/* Desktop names with their own bit */
+#define DESKTOP_OTHER		(1ULL << N_DESKTOPS)
+#define DESKTOP_HASH_SIZE	128
 #define PATH_USER_CONFIG_DIR	".config"
 #define PATH_USER_AUTOSTART_DIR ".config/autostart"
+#define PATH_USER_CACHE_DIR	".cache"
+#define PATH_LOG_DIR		"logs"
+#define PATH_PATH_INDEX		"pathindex"
 #define PATH_XDG_AUTOSTART_DIR	"/usr/local/etc/xdg/autostart"
+#define PATH_SHELL		"/bin/sh"
+
+/*
+ * Characters which must be quoted in Exec values. If one of them appears
+ * unquoted, we assume the value is a shell command line.
+ */
+#define EXEC_RESERVED_CHARS	"'\\><~|&;$*?#()`"
 
 #define ERROR(ret, fmt, ...) do { \
 	seterr(fmt, ##__VA_ARGS__); \
@@ -56,23 +74,77 @@ static struct df_var_s {
 	const char *name;
 	char	   type;
 	df_key_t   key;
-	union {
-		char **strval;
-		bool *boolval;
-	} val;
-	bool set;
 } df_vars[] = {
-	{ "Name",	TYPE_STR,  DF_KEY_NAME,		{ NULL }, false },
-	{ "Comment",	TYPE_STR,  DF_KEY_COMMENT,	{ NULL }, false },
-	{ "Exec",	TYPE_STR,  DF_KEY_EXEC,	  	{ NULL }, false },
-	{ "Hidden",	TYPE_BOOL, DF_KEY_HIDDEN,	{ NULL }, false },
-	{ "Terminal",	TYPE_BOOL, DF_KEY_TERMINAL,	{ NULL }, false },
-	{ "NotShowIn",	TYPE_STR, DF_KEY_NOT_SHOW_IN,	{ NULL }, false },
-	{ "OnlyShowIn",	TYPE_STR, DF_KEY_ONLY_SHOW_IN,	{ NULL }, false }
+	{ "Name",	TYPE_STR,  DF_KEY_NAME },
+	{ "Comment",	TYPE_STR,  DF_KEY_COMMENT },
+	{ "Exec",	TYPE_STR,  DF_KEY_EXEC },
+	{ "Hidden",	TYPE_BOOL, DF_KEY_HIDDEN },
+	{ "Terminal",	TYPE_BOOL, DF_KEY_TERMINAL },
+	{ "NotShowIn",	TYPE_STR, DF_KEY_NOT_SHOW_IN },
+	{ "OnlyShowIn",	TYPE_STR, DF_KEY_ONLY_SHOW_IN },
+	{ "TryExec",	TYPE_STR, DF_KEY_TRY_EXEC },
+	{ "X-DSB-After", TYPE_STR, DF_KEY_AFTER },
+	{ "X-DSB-Requires", TYPE_STR, DF_KEY_REQUIRES },
+	{ "X-DSB-Ready", TYPE_STR, DF_KEY_READY },
+	{ "X-DSB-Restart", TYPE_STR, DF_KEY_RESTART },
+	{ "X-DSB-Nice",	TYPE_STR, DF_KEY_NICE },
+	{ "X-DSB-IOClass", TYPE_STR, DF_KEY_IO_CLASS },
+	{ "X-DSB-IOPriority", TYPE_STR, DF_KEY_IO_PRIORITY },
+	{ "X-DSB-CPUAffinity", TYPE_STR, DF_KEY_CPU_AFFINITY },
+	{ "X-DSB-CGroup", TYPE_STR, DF_KEY_CGROUP },
+	{ "X-DSB-CPUWeight", TYPE_STR, DF_KEY_CPU_WEIGHT },
+	{ "X-DSB-MemoryHigh", TYPE_STR, DF_KEY_MEMORY_HIGH },
+	{ "X-DSB-Background", TYPE_STR, DF_KEY_BACKGROUND },
+	{ "X-DSB-AllowMultiple", TYPE_STR, DF_KEY_ALLOW_MULTIPLE },
+	{ "X-DSB-NeedsDisplay", TYPE_STR, DF_KEY_NEEDS_DISPLAY }
 };
 
 #define N_DF_VARS (sizeof(df_vars) / sizeof(df_vars[0]))
 
+/*
+ * Byte offsets of a "key=value" line in a df_doc_t. line_end is 0 if the
+ * key is not in the file.
+ */
+typedef struct df_span_s {
+	size_t line;
+	size_t val;
+	size_t val_end;
+	size_t line_end;	/* Past the newline */
+} df_span_t;
+
+/*
+ * The unmodified bytes of a desktop file, and where the [Desktop Entry]
+ * keys we know are. df_save() splices changed values into a copy of the
+ * buffer, so comments, unknown keys, translations, and other groups are
+ * written back byte for byte.
+ */
+struct df_doc_s {
+	char	  *buf;
+	size_t	  len;
+	size_t	  group_end;	/* Past the last line of [Desktop Entry] */
+	df_span_t spans[N_DF_VARS];
+	/* Identity of the file, to detect changes by other programs */
+	dev_t	  dev;
+	ino_t	  ino;
+	off_t	  size;
+	struct timespec mtime;
+};
+
+/*
+ * While a transaction is open, entries are looked up by the basename of
+ * their desktop file in an open addressing hash table.
+ */
+struct txn_s {
+	size_t	     nslots;	/* Power of 2 */
+	size_t	     nused;
+	entry_t	     **slots;
+	entry_t	     *tail;	/* Last entry of cur_entries */
+	hist_entry_t *start;	/* History position at dsbautostart_begin() */
+};
+
+/* Contents of a desktop file created by df_create() */
+#define DF_TEMPLATE "[Desktop Entry]\nType=Application\n"
+
 static struct xdg_dir_s {
 	int   prio;
 	char *path;
@@ -80,8 +152,10 @@ static struct xdg_dir_s {
 
 static int		cmp(const char *, const char *);
 static int		cmp_basenames(const char *path1, const char *path2);
+static int		cmp_ptrs(const void *, const void *);
 static int		create_xdg_dir_list(void);
 static int		create_autostart_dir(void);
+static int		make_dirs(const char *);
 static int		set_xdg_config_dirs(void);
 static int		df_del(const char *);
 static int		df_prio(const char *);
@@ -89,14 +163,26 @@ static int		df_save(desktop_file_t *);
 static int		df_count_paths(const char *);
 static bool		df_str_to_bool(const char *);
 static bool		df_exclude(const desktop_file_t *);
+static int		desktop_id(const char *, size_t);
+static desktop_set_t	desktop_set(const char *, int);
+static void		df_update_desktop_sets(desktop_file_t *, df_key_t);
+static int		exclude_rule(const desktop_file_t *, desktop_set_t);
 static bool		cmp_entries(const entry_t *, const entry_t *);
 static bool		entry_changed(const dsbautostart_t *, const entry_t *);
+static bool		entry_new(const dsbautostart_t *, const entry_t *);
 static char		*readln(FILE *fp);
 static char		*change_string(char **, char *);
+static char		**df_str_field(desktop_file_t *, df_key_t);
+static bool		*df_bool_field(desktop_file_t *, df_key_t);
 static char		*df_get_val(char *, const char *);
+static char		*group_name(char *);
+static int		df_set_local_val(desktop_file_t *, char *, int *);
+static int		locale_rank(const char *, size_t);
+static void		init_locales(void);
+static int		df_set_val(desktop_file_t *, char *, char **);
 static char		*df_create(desktop_file_t *);
+static char		**exec_tokenize(const desktop_file_t *, bool *);
 static char		*user_autostart_path(const char *);
-static void		init_var_tbl(desktop_file_t *);
 static void		get_current_desktop(void);
 static void		skip_spaces(char **);
 static void		_clearerr(void);
@@ -106,23 +192,79 @@ static void		df_free(desktop_file_t *);
 static entry_t		*copy_entries(const entry_t *);
 static entry_t		*entry_add(dsbautostart_t *, desktop_file_t *);
 static hist_entry_t	*hist_add(change_history_t *);
+static void		hist_apply(hist_entry_t *, bool);
+static entry_t		*find_basename(const dsbautostart_t *, const char *);
+static int		txn_index(txn_t *, entry_t *);
+static void		txn_free(txn_t *);
+static unsigned		hash_basename(const char *);
+static const char	*basename_of(const char *);
 static hist_entry_t	*undo(change_history_t *);
 static hist_entry_t	*redo(change_history_t *);
 static desktop_file_t	*df_new(void);
 static desktop_file_t	*df_dup(const desktop_file_t *);
 static desktop_file_t	*df_read(const char *);
+static desktop_file_t	*df_parse(const char *);
+static int		df_scan(desktop_file_t *);
+static df_doc_t		*df_doc_read(FILE *);
+static df_doc_t		*df_doc_dup(const df_doc_t *);
+static void		df_doc_free(df_doc_t *);
+static int		df_write(const desktop_file_t *, FILE *, df_doc_t *);
+static const char	*df_text_val(const desktop_file_t *, df_key_t);
+static bool		df_key_changed(const desktop_file_t *, const df_doc_t *,
+			    int);
+static int		df_write_file(desktop_file_t *, int, const char *,
+			    const char *);
+static bool		df_modified(const desktop_file_t *, const char *);
+static int		df_merge(desktop_file_t *, const char *);
+static int		df_reload(desktop_file_t *, const char *);
+static void		df_swap(desktop_file_t *, desktop_file_t *);
+static int		find_conflict(const dsbautostart_t *);
+static int		lock_autostart_dir(void);
+static int		hist_rebase(dsbautostart_t *, const entry_t *);
+static bool		changed(const dsbautostart_t *);
+static int		save(dsbautostart_t *);
+static size_t		df_size(const desktop_file_t *);
 static desktop_file_t	*df_replace(dsbautostart_t *, entry_t *,
 			    desktop_file_t *);
 static desktop_file_t	**df_readdir(const char *, desktop_file_t ***);
+static desktop_file_t	**scan_dir(const char *, desktop_file_t ***);
+static dsbautostart_t	*init(void);
 static desktop_file_t	*extend_desktop_file_list(desktop_file_t ***,
 			    desktop_file_t *);
 
 static int  entry_id;
 static bool _error = false;
+static bool _conflict = false;	/* Last error was a conflict */
 static char errbuf[1024];
 static char *xdg_config_home;
 static char *xdg_autostart_home;
-static char *current_desktop = "";
+static desktop_set_t current_desktops;	/* Tokenized XDG_CURRENT_DESKTOP */
+static int  ndesktops;
+static char *desktops[N_DESKTOPS];
+static signed char desktop_hash[DESKTOP_HASH_SIZE];	/* ID + 1, 0 if free */
+static bool pidx_persist;	/* Keep the index of $PATH in the cache */
+static unsigned long long read_keys;	/* Keys df_read() reads. 0 = all */
+static char *locales[N_LOCALES + 1];	/* Locale fallback chain */
+static bool locales_init;
+
+/*
+ * Set how dsbautostart_save() handles files changed by other programs
+ * since they were read.
+ */
+void
+dsbautostart_set_conflict_policy(dsbautostart_t *as, conflict_policy_t policy)
+{
+	as->policy = policy;
+}
+
+/*
+ * Return true if the last error was a file changed by another program.
+ */
+bool
+dsbautostart_conflict()
+{
+	return (_conflict);
+}
 
 bool
 dsbautostart_error()
@@ -145,19 +287,22 @@ dsbautostart_read_desktop_files(dsbautostart_t *as)
 	_clearerr();
 
 	for (i = 0; xdg_dirs[i].path != NULL; i++) {
-		if (df_readdir(xdg_dirs[i].path, &list) == NULL) {
-			if (errno != ENOENT)
-				goto error;
-		}
+		/* NULL without error means the directory has no files. */
+		if (df_readdir(xdg_dirs[i].path, &list) == NULL && _error)
+			goto error;
 	}
 	for (i = 0; list != NULL && list[i] != NULL; i++) {
 		if (list[i]->hidden)
-			continue;
-		if (entry_add(as, list[i]) == NULL) {
-			seterr("entry_add()");
-			goto error;
+			df_free(list[i]);
+		else if (entry_add(as, list[i]) == NULL) {
+			/* The entries took over the files before this one. */
+			for (; list[i] != NULL; i++)
+				df_free(list[i]);
+			free(list);
+			ERROR(-1, "entry_add()");
 		}
 	}
+	free(list);
 	return (0);
 error:
 	for (i = 0; list != NULL && list[i] != NULL; i++)
@@ -169,8 +314,39 @@ error:
 	return (-1);
 }
 
+/*
+ * Let desktop files be read with only the given keys. Other keys are
+ * skipped without being stored. Hidden is always read. Passing no keys restores
+ * the default of reading all keys. Desktop files read this way must not
+ * be saved.
+ */
+void
+dsbautostart_set_read_keys(const df_key_t *keys, size_t nkeys)
+{
+	size_t i;
+
+	assert(N_DF_VARS <= sizeof(read_keys) * 8);
+	for (i = 0, read_keys = 0; i < nkeys; i++)
+		read_keys |= 1ULL << keys[i];
+	if (read_keys != 0)
+		read_keys |= 1ULL << DF_KEY_HIDDEN;
+}
+
 dsbautostart_t *
 dsbautostart_init()
+{
+	long long      t0;
+	dsbautostart_t *as;
+
+	t0 = stats_begin();
+	as = init();
+	stats_end(STATS_PHASE_INIT, t0, NULL);
+
+	return (as);
+}
+
+static dsbautostart_t *
+init()
 {
 	dsbautostart_t *as;
 
@@ -179,6 +355,8 @@ dsbautostart_init()
 	if ((as = malloc(sizeof(dsbautostart_t))) == NULL)
 		ERROR(NULL, "malloc()");
 	as->cur_entries = NULL;
+	as->txn = NULL;
+	as->policy = CONFLICT_FAIL;
 	as->hist  = malloc(sizeof(change_history_t));
 	if (as->hist == NULL)
 		ERROR(NULL, "malloc()");
@@ -189,7 +367,9 @@ dsbautostart_init()
 	as->hist->head->next = as->hist->tail;
 	as->hist->tail->prev = as->hist->head;
 	as->hist->head->prev = as->hist->tail->next = NULL;
+	as->hist->head->txn = as->hist->tail->txn = 0;
 	as->hist->idx = as->hist->head;
+	as->hist->txn = 0;
 
 	if (xdg_autostart_home == NULL || xdg_config_home == NULL) {
 		if (set_xdg_config_dirs() == -1) {
@@ -206,7 +386,7 @@ dsbautostart_init()
 	if (dsbautostart_read_desktop_files(as) == -1)
 		return (NULL);
 	as->prev_entries = copy_entries(as->cur_entries);
-	if (as->prev_entries == NULL)
+	if (as->prev_entries == NULL && _error)
 		return (NULL);
 	return (as);
 }
@@ -216,27 +396,43 @@ dsbautostart_entry_set(dsbautostart_t *as, entry_t *entry, const char *cmd,
     const char *name, const char *comment, const char *not_show_in,
     const char *only_show_in, bool terminal)
 {
-	hist_entry_t   *hentry;
 	desktop_file_t *df;
 	
 	_clearerr();
-	if ((hentry = hist_add(as->hist)) == NULL)
-		return (-1);
-	if ((df = df_new()) == NULL)
+	/* Keep the keys we don't change here, e.g. TryExec. */
+	if ((df = df_dup(entry->df)) == NULL)
 		return (-1);
-	if (entry->df->path != NULL) {
-		if ((df->path = strdup(entry->df->path)) == NULL) {
-			seterr("strdup()");
-			df_free(df);
-			return (-1);
-		}
-	}
 	dsbautostart_df_set_key(df, DF_KEY_EXEC, cmd);
 	dsbautostart_df_set_key(df, DF_KEY_NAME, name);
 	dsbautostart_df_set_key(df, DF_KEY_COMMENT, comment);
 	dsbautostart_df_set_key(df, DF_KEY_TERMINAL, &terminal);
 	dsbautostart_df_set_key(df, DF_KEY_NOT_SHOW_IN, not_show_in);
 	dsbautostart_df_set_key(df, DF_KEY_ONLY_SHOW_IN, only_show_in);
+
+	return (dsbautostart_entry_set_df(as, entry, df));
+}
+
+/*
+ * Replace the desktop file of the given entry by "df". The entry takes
+ * over "df", which must have been created by dsbautostart_df_new() or
+ * dsbautostart_df_dup().
+ */
+int
+dsbautostart_entry_set_df(dsbautostart_t *as, entry_t *entry,
+    desktop_file_t *df)
+{
+	hist_entry_t *hentry;
+
+	_clearerr();
+	if ((hentry = hist_add(as->hist)) == NULL)
+		return (-1);
+	if (df->path == NULL && entry->df->path != NULL) {
+		if ((df->path = strdup(entry->df->path)) == NULL)
+			ERROR(-1, "strdup()");
+		/* %k in Exec expands to the path */
+		free(df->argv); df->argv = NULL;
+		df->prio = entry->df->prio;
+	}
 	entry->exclude = df_exclude(df);
 	hentry->action = CHANGE;
 	hentry->entry  = entry;
@@ -253,8 +449,6 @@ dsbautostart_entry_add(dsbautostart_t *as, const char *cmd, const char *name,
 	const char *comment, const char *not_show_in, const char *only_show_in,
 	bool terminal)
 {
-	entry_t	       *entry;
-	hist_entry_t   *hentry;
 	desktop_file_t *df;
 
 	_clearerr();
@@ -267,6 +461,19 @@ dsbautostart_entry_add(dsbautostart_t *as, const char *cmd, const char *name,
 	dsbautostart_df_set_key(df, DF_KEY_NOT_SHOW_IN, not_show_in);
 	dsbautostart_df_set_key(df, DF_KEY_ONLY_SHOW_IN, only_show_in);
 
+	return (dsbautostart_entry_add_df(as, df));
+}
+
+/*
+ * Add a new entry for the given desktop file. The entry takes over "df".
+ */
+entry_t *
+dsbautostart_entry_add_df(dsbautostart_t *as, desktop_file_t *df)
+{
+	entry_t	     *entry;
+	hist_entry_t *hentry;
+
+	_clearerr();
 	if ((entry = entry_add(as, df)) == NULL)
 		return (NULL);
 	if ((hentry = hist_add(as->hist)) == NULL)
@@ -277,6 +484,25 @@ dsbautostart_entry_add(dsbautostart_t *as, const char *cmd, const char *name,
 	return (entry);
 }
 
+desktop_file_t *
+dsbautostart_df_new()
+{
+	_clearerr();
+	return (df_new());
+}
+
+desktop_file_t *
+dsbautostart_df_dup(const desktop_file_t *df)
+{
+	return (df_dup(df));
+}
+
+void
+dsbautostart_df_free(desktop_file_t *df)
+{
+	df_free(df);
+}
+
 entry_t *
 dsbautostart_entry_del(dsbautostart_t *as, entry_t *entry)
 {
@@ -301,20 +527,23 @@ dsbautostart_df_add(dsbautostart_t *as, const char *path)
 	_clearerr();
 	if ((df = df_read(path)) == NULL)
 		return (NULL);
-	if (df->hidden)
+	if (df->hidden) {
+		df_free(df);
 		return (NULL);
-	if (df->path != NULL) {
-		for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
-			if (ep->df->path == NULL)
-				continue;
-			if (strcmp(ep->df->path, df->path) == 0)
-				return (NULL);
-			if (cmp_basenames(ep->df->path, df->path) != 0)
-				continue;
-			if (df->prio > ep->df->prio || ep->deleted)
-				df_replace(as, ep, df);
-			return (ep);
+	}
+	if ((ep = find_basename(as, df->path)) != NULL) {
+		if (strcmp(ep->df->path, df->path) == 0) {
+			df_free(df);
+			return (NULL);
 		}
+		if (df->prio > ep->df->prio || ep->deleted) {
+			if (df_replace(as, ep, df) == NULL) {
+				df_free(df);
+				return (NULL);
+			}
+		} else
+			df_free(df);
+		return (ep);
 	}
 	if ((entry = entry_add(as, df)) == NULL)
 		return (NULL);
@@ -326,46 +555,120 @@ dsbautostart_df_add(dsbautostart_t *as, const char *path)
 	return (entry);
 }
 
+/*
+ * Measure the undo/redo history, and return the statistics collected
+ * since the start of the process. A version of a desktop file which is
+ * referenced by a record, but no longer by its entry, is counted once.
+ */
+const dsbautostart_stats_t *
+dsbautostart_stats(const dsbautostart_t *as)
+{
+	hist_entry_t *h, *n;
+
+	stats.hist_depth = 0;
+	stats.hist_bytes = 0;
+	if (as == NULL)
+		return (&stats);
+	for (h = as->hist->head->next; h != as->hist->tail; h = h->next) {
+		stats.hist_depth++;
+		stats.hist_bytes += sizeof(hist_entry_t);
+		if (h->action != CHANGE)
+			continue;
+		if (h->df0 != h->entry->df)
+			stats.hist_bytes += df_size(h->df0);
+		if (h->df1 == h->entry->df)
+			continue;
+		for (n = h->next; n != as->hist->tail; n = n->next) {
+			if (n->action == CHANGE && n->df0 == h->df1)
+				break;
+		}
+		if (n == as->hist->tail)
+			stats.hist_bytes += df_size(h->df1);
+	}
+	return (&stats);
+}
+
 bool
 dsbautostart_can_undo(const dsbautostart_t *as)
 {
+	if (as->txn != NULL)
+		return (false);
 	return (as->hist->idx != as->hist->head);
 }
 
 bool
 dsbautostart_can_redo(const dsbautostart_t *as)
 {
-	if (as->hist->idx->next == as->hist->tail)
+	if (as->txn != NULL || as->hist->idx->next == as->hist->tail)
 		return (false);
 	return (true);
 }
 
+/*
+ * Free the given object, its entries, and its history. An open
+ * transaction is rolled back. The desktop files of the entries are
+ * shared with the history records, so each of them is freed once.
+ */
 void
 dsbautostart_free(dsbautostart_t *as)
 {
+	size_t		i, n;
+	entry_t		*ep, *next;
+	hist_entry_t	*h, *hnext;
+	desktop_file_t	**dfs;
 
-	free_entries(as->cur_entries);
+	if (as == NULL)
+		return;
+	dsbautostart_rollback(as);
+	free_entries(as->prev_entries);
+	for (n = 0, ep = as->cur_entries; ep != NULL; ep = ep->next)
+		n++;
+	for (h = as->hist->head->next; h != as->hist->tail; h = h->next)
+		n += 2;
+	if ((dfs = malloc((n > 0 ? n : 1) * sizeof(desktop_file_t *))) != NULL) {
+		for (n = 0, ep = as->cur_entries; ep != NULL; ep = ep->next)
+			dfs[n++] = ep->df;
+		for (h = as->hist->head->next; h != as->hist->tail;
+		    h = h->next) {
+			if (h->action != CHANGE)
+				continue;
+			dfs[n++] = h->df0;
+			dfs[n++] = h->df1;
+		}
+		qsort(dfs, n, sizeof(desktop_file_t *), cmp_ptrs);
+		for (i = 0; i < n; i++) {
+			if (i == 0 || dfs[i] != dfs[i - 1])
+				df_free(dfs[i]);
+		}
+		free(dfs);
+	}
+	for (ep = as->cur_entries; ep != NULL; ep = next) {
+		next = ep->next;
+		free(ep);
+	}
+	for (h = as->hist->head; h != NULL; h = hnext) {
+		hnext = h->next;
+		free(h);
+	}
+	free(as->hist);
 	free(as);
 }
 
+/*
+ * Undo the last change, or all changes of the last transaction.
+ */
 void
 dsbautostart_undo(dsbautostart_t *as)
 {
 	hist_entry_t *hentry;
 
-	if ((hentry = undo(as->hist)) == NULL)
+	if (as->txn != NULL)
 		return;
-	switch (hentry->action) {
-	case CHANGE:
-		hentry->entry->df = hentry->df0;
-		break;
-	case DELETE:
-		hentry->entry->deleted = false;
-		break;
-	case ADD:
-		hentry->entry->deleted = true;
-		break;
-	}
+	do {
+		if ((hentry = undo(as->hist)) == NULL)
+			return;
+		hist_apply(hentry, true);
+	} while (hentry->txn != 0 && as->hist->idx->txn == hentry->txn);
 }
 
 void
@@ -373,23 +676,128 @@ dsbautostart_redo(dsbautostart_t *as)
 {
 	hist_entry_t *hentry;
 
-	if ((hentry = redo(as->hist)) == NULL)
+	if (as->txn != NULL)
 		return;
-	switch (hentry->action) {
-	case CHANGE:
-		hentry->entry->df = hentry->df1;
-		break;
-	case DELETE:
-		hentry->entry->deleted = true;
-		break;
-	case ADD:
-		hentry->entry->deleted = false;
-		break;
+	do {
+		if ((hentry = redo(as->hist)) == NULL)
+			return;
+		hist_apply(hentry, false);
+	} while (hentry->txn != 0 && as->hist->idx->next->txn == hentry->txn);
+}
+
+/*
+ * Start a transaction. The changes made until dsbautostart_commit() are
+ * undone and redone as one step, and can be discarded with
+ * dsbautostart_rollback(). dsbautostart_df_add() finds existing entries
+ * by a hash table instead of walking the list, so adding many desktop
+ * files costs O(n) instead of O(n^2). Transactions can't be nested.
+ */
+int
+dsbautostart_begin(dsbautostart_t *as)
+{
+	size_t	 n;
+	txn_t	 *txn;
+	entry_t	 *ep;
+	static unsigned id = 0;
+
+	_clearerr();
+	if (as->txn != NULL)
+		ERROR(-1, "A transaction is already open");
+	if ((txn = calloc(1, sizeof(txn_t))) == NULL)
+		ERROR(-1, "calloc()");
+	for (n = 0, ep = as->cur_entries; ep != NULL; ep = ep->next, n++)
+		txn->tail = ep;
+	for (txn->nslots = 64; txn->nslots < 2 * n; txn->nslots <<= 1)
+		;
+	if ((txn->slots = calloc(txn->nslots, sizeof(entry_t *))) == NULL) {
+		free(txn);
+		ERROR(-1, "calloc()");
+	}
+	stats_alloc(STATS_MEM_OTHER, txn->nslots * sizeof(entry_t *));
+	for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
+		if (txn_index(txn, ep) == -1) {
+			txn_free(txn);
+			return (-1);
+		}
+	}
+	txn->start    = as->hist->idx;
+	as->txn	      = txn;
+	as->hist->txn = ++id != 0 ? id : ++id;
+
+	return (0);
+}
+
+/*
+ * Close the open transaction, and keep its changes.
+ */
+int
+dsbautostart_commit(dsbautostart_t *as)
+{
+	_clearerr();
+	if (as->txn == NULL)
+		ERROR(-1, "No transaction is open");
+	txn_free(as->txn);
+	as->txn = NULL;
+	as->hist->txn = 0;
+
+	return (0);
+}
+
+/*
+ * Close the open transaction, and revert its changes. The records are
+ * removed from the history, and the entries it added are freed.
+ */
+void
+dsbautostart_rollback(dsbautostart_t *as)
+{
+	unsigned     id;
+	hist_entry_t *hentry;
+
+	if (as->txn == NULL)
+		return;
+	id = as->hist->txn;
+	while (as->hist->idx != as->txn->start) {
+		hentry = undo(as->hist);
+		hist_apply(hentry, true);
+	}
+	while ((hentry = as->txn->start->next)->txn == id &&
+	    hentry != as->hist->tail) {
+		hentry->prev->next = hentry->next;
+		hentry->next->prev = hentry->prev;
+		if (hentry->action == CHANGE) {
+			df_free(hentry->df1);
+		} else if (hentry->action == ADD) {
+			if (hentry->entry->prev != NULL)
+				hentry->entry->prev->next = hentry->entry->next;
+			else
+				as->cur_entries = hentry->entry->next;
+			if (hentry->entry->next != NULL)
+				hentry->entry->next->prev = hentry->entry->prev;
+			df_free(hentry->entry->df);
+			free(hentry->entry);
+		}
+		free(hentry);
 	}
+	txn_free(as->txn);
+	as->txn = NULL;
+	as->hist->txn = 0;
 }
 
 bool
 dsbautostart_changed(const dsbautostart_t *as)
+{
+	bool	  ret;
+	long long t0;
+
+	t0  = stats_begin();
+	ret = changed(as);
+	stats_end(STATS_PHASE_COMPARE, t0, NULL);
+
+	return (ret);
+}
+
+static bool
+changed(const dsbautostart_t *as)
 {
 	size_t	cur_entries_cnt, prev_entries_cnt;
 	entry_t *ep0, *ep1;
@@ -421,20 +829,57 @@ dsbautostart_changed(const dsbautostart_t *as)
 int
 dsbautostart_save(dsbautostart_t *as)
 {
-	bool	       saved, hidden;
+	int	  ret;
+	long long t0;
+
+	stats.files_written = stats.files_renamed = stats.files_deleted = 0;
+	t0  = stats_begin();
+	ret = save(as);
+	stats_end(STATS_PHASE_SAVE, t0, NULL);
+
+	return (ret);
+}
+
+/*
+ * Files are only written or deleted while holding an advisory lock on the
+ * user's autostart directory, so that other instances of dsbautostart
+ * don't interleave with us. Files changed by other programs since we read
+ * them are handled according to as->policy. With CONFLICT_FAIL, nothing
+ * is written if there is a conflict.
+ */
+static int
+save(dsbautostart_t *as)
+{
+	int	       lockfd, ret, reload;
+	bool	       saved, hidden, modified;
 	char	       *path;
 	entry_t	       *ep;
 	desktop_file_t *df;
 
 	_clearerr();
 
+	if ((lockfd = lock_autostart_dir()) == -1)
+		return (-1);
+	ret = -1;
+	if (as->policy == CONFLICT_FAIL && find_conflict(as) != 0)
+		goto out;
 	saved = false;
 	for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
 		if (ep->deleted) {
-			if (ep->df->path != NULL) {
-				if (df_del(ep->df->path) == -1)
-					return (-1);
-			}
+			/*
+			 * An entry added from a desktop file by dropping it,
+			 * and removed again by undo, refers to the dropped
+			 * file. There is nothing to delete.
+			 */
+			if (ep->df->path == NULL || entry_new(as, ep))
+				continue;
+			saved = true;
+			/* Keep a file changed by another program. */
+			if (as->policy != CONFLICT_OVERWRITE &&
+			    df_modified(ep->df, ep->df->path))
+				continue;
+			if (df_del(ep->df->path) == -1)
+				goto out;
 			continue;
 		}
 		/*
@@ -446,147 +891,959 @@ dsbautostart_save(dsbautostart_t *as)
 		 */
 		if (ep->df->path != NULL) {
 			if ((path = user_autostart_path(ep->df->path)) == NULL)
-				return (-1);
+				goto out;
 			if ((df = df_read(path)) != NULL) {
 				hidden = df->hidden;
 				df_free(df);
 				if (hidden && df_del(path) == -1) {
 					free(path);
-					return (-1);
+					goto out;
 				}
 			} else if (errno != ENOENT) {
 				seterr("df_read(%s)", path);
 				free(path);
-				return (-1);
+				goto out;
 			}
 			free(path);
 		}
-		if (entry_changed(as, ep) || ep->df->path == NULL) {
-			if (df_save(ep->df) == -1)
-				return (-1);
-			saved = true;
+		if (!entry_changed(as, ep) && ep->df->path != NULL)
+			continue;
+		saved = true;
+		if (ep->df->path != NULL && as->policy != CONFLICT_OVERWRITE) {
+			if ((path = user_autostart_path(ep->df->path)) == NULL)
+				goto out;
+			modified = df_modified(ep->df, path);
+			if (modified && as->policy == CONFLICT_RELOAD) {
+				reload = df_reload(ep->df, path);
+				free(path);
+				if (reload == -1 || (reload == 0 &&
+				    hist_rebase(as, ep) == -1))
+					goto out;
+				/* Keep the deletion by the other program. */
+				if (reload == 1 &&
+				    dsbautostart_entry_del(as, ep) == NULL)
+					goto out;
+				ep->exclude = df_exclude(ep->df);
+				continue;
+			}
+			if (modified && df_merge(ep->df, path) == -1) {
+				free(path);
+				goto out;
+			}
+			free(path);
+			ep->exclude = df_exclude(ep->df);
 		}
+		if (df_save(ep->df) == -1 || hist_rebase(as, ep) == -1)
+			goto out;
 	}
 	if (saved) {
 		free_entries(as->prev_entries);
 		as->prev_entries = copy_entries(as->cur_entries);
 		if (as->prev_entries == NULL && _error)
-			return (-1);
+			goto out;
 	}
-	return (0);
+	ret = 0;
+out:
+	(void)close(lockfd);
+
+	return (ret);
 }
 
-int
-dsbautostart_df_set_key(desktop_file_t *df, df_key_t key, const void *val)
+/*
+ * Return 1 and set the error if a file we would write or delete was
+ * changed by another program, 0 if not, and -1 on error.
+ */
+static int
+find_conflict(const dsbautostart_t *as)
 {
+	char	*path;
+	bool	modified;
+	entry_t *ep;
 
-	_clearerr();
-	if (val == NULL)
-		return (-1);
-	switch (key) {
-	case DF_KEY_NAME:
-		return (change_string(&df->name, (char *)val) != NULL ? 0 : -1);
-	case DF_KEY_EXEC:
-		return (change_string(&df->exec, (char *)val) != NULL ? 0 : -1);
-	case DF_KEY_COMMENT:
-		return (change_string(&df->comment, (char *)val) != NULL ? 0 : -1);
-	case DF_KEY_HIDDEN:
-		df->hidden = *(bool *)val;
-		return (0);
-	case DF_KEY_TERMINAL:
-		df->terminal = *(bool *)val;
-		return (0);
-	case DF_KEY_NOT_SHOW_IN:
-		return (change_string(&df->not_show_in, (char *)val) != NULL ? 0 : -1);
-	case DF_KEY_ONLY_SHOW_IN:
-		return (change_string(&df->only_show_in, (char *)val) != NULL ? 0 : -1);
-	default:
-		return (-1);
+	for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
+		if (ep->df->path == NULL)
+			continue;
+		if (ep->deleted) {
+			if (entry_new(as, ep) || access(ep->df->path, F_OK) != 0)
+				continue;
+			if ((path = strdup(ep->df->path)) == NULL)
+				ERROR(-1, "strdup()");
+		} else if (!entry_changed(as, ep))
+			continue;
+		else if ((path = user_autostart_path(ep->df->path)) == NULL)
+			return (-1);
+		modified = df_modified(ep->df, path);
+		if (modified) {
+			errno = 0;
+			seterr("%s was changed by another program", path);
+			_conflict = true;
+		}
+		free(path);
+		if (modified)
+			return (1);
 	}
-	return (-1);
+	return (0);
 }
 
-static desktop_file_t *
-df_read(const char *path)
+/*
+ * Return true if the file at "path" was created, changed, replaced, or
+ * deleted by another program since the desktop file was read from, or
+ * written to it. If the inode, size, and modification time are the same,
+ * the file is assumed to be unchanged without reading it. Otherwise, its
+ * contents are compared with the document.
+ */
+static bool
+df_modified(const desktop_file_t *df, const char *path)
 {
-	FILE	       *fp;
-	char	       *val, *ln, *_path;
-	bool	       found_desktop_entry;
-	size_t	       i;
-	desktop_file_t *df;
-
-	_clearerr();
+	bool	    modified;
+	FILE	    *fp;
+	df_doc_t    *doc, *disk;
+	struct stat sb;
+
+	doc = df->doc;
+	if (stat(path, &sb) == -1) {
+		return (errno != ENOENT || (doc != NULL && df->path != NULL &&
+		    strcmp(df->path, path) == 0));
+	}
+	if (doc == NULL)
+		return (true);
+	if (sb.st_dev == doc->dev && sb.st_ino == doc->ino &&
+	    sb.st_size == doc->size &&
+	    sb.st_mtim.tv_sec == doc->mtime.tv_sec &&
+	    sb.st_mtim.tv_nsec == doc->mtime.tv_nsec)
+		return (false);
+	if (sb.st_size != doc->size || (fp = fopen(path, "r")) == NULL)
+		return (true);
+	disk = df_doc_read(fp);
+	(void)fclose(fp);
+	modified = disk == NULL || disk->len != doc->len ||
+	    memcmp(disk->buf, doc->buf, doc->len) != 0;
+	df_doc_free(disk);
+
+	return (modified);
+}
+
+/*
+ * Exchange the contents of two desktop files, so that the pointers held
+ * by the entry and the history stay valid.
+ */
+static void
+df_swap(desktop_file_t *df1, desktop_file_t *df2)
+{
+	desktop_file_t tmp;
+
+	tmp = *df1; *df1 = *df2; *df2 = tmp;
+}
+
+/*
+ * Replace the desktop file by the version at "path". Returns 1 if the
+ * file was deleted, 0 on success, and -1 on error.
+ */
+static int
+df_reload(desktop_file_t *df, const char *path)
+{
+	desktop_file_t *disk;
+
+	if ((disk = df_read(path)) == NULL) {
+		if (_error)
+			return (-1);
+		return (errno == ENOENT ? 1 : 0);
+	}
+	df_swap(df, disk);
+	df_free(disk);
+
+	return (0);
+}
+
+/*
+ * Apply the keys we changed to the version at "path", and make the result
+ * the desktop file. Other keys keep the values on disk. If the file was
+ * deleted, the desktop file is written as it is.
+ */
+static int
+df_merge(desktop_file_t *df, const char *path)
+{
+	int	       i, ret;
+	bool	       b;
+	desktop_file_t *disk;
+
+	if ((disk = df_read(path)) == NULL)
+		return (_error ? -1 : 0);
+	for (i = 0; i < (int)N_DF_VARS; i++) {
+		if (!df_key_changed(df, df->doc, i))
+			continue;
+		if (df_vars[i].type == TYPE_BOOL) {
+			b = *df_bool_field(df, df_vars[i].key);
+			ret = dsbautostart_df_set_key(disk, df_vars[i].key, &b);
+		} else {
+			ret = dsbautostart_df_set_key(disk, df_vars[i].key,
+			    *df_str_field(df, df_vars[i].key));
+		}
+		if (ret == -1) {
+			df_free(disk);
+			return (-1);
+		}
+	}
+	df_swap(df, disk);
+	df_free(disk);
+
+	return (0);
+}
+
+/*
+ * Let the versions of the entry's desktop file in the history refer to
+ * the file just written, so that undoing a change and saving again isn't
+ * taken for a conflict.
+ */
+static int
+hist_rebase(dsbautostart_t *as, const entry_t *entry)
+{
+	int	       i;
+	df_doc_t       *doc;
+	hist_entry_t   *h;
+	desktop_file_t *v[2];
+
+	for (h = as->hist->head->next; h != as->hist->tail; h = h->next) {
+		if (h->entry != entry || h->action != CHANGE)
+			continue;
+		v[0] = h->df0; v[1] = h->df1;
+		for (i = 0; i < 2; i++) {
+			if (v[i] == entry->df || v[i]->doc == entry->df->doc)
+				continue;
+			if ((doc = df_doc_dup(entry->df->doc)) == NULL)
+				return (-1);
+			df_doc_free(v[i]->doc);
+			v[i]->doc = doc;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Serialize saving with other instances of dsbautostart by an advisory
+ * lock on the user's autostart directory. Returns the locked descriptor.
+ */
+static int
+lock_autostart_dir()
+{
+	int fd;
+
+	if (create_autostart_dir() == -1)
+		return (-1);
+	if ((fd = open(xdg_autostart_home, O_RDONLY | O_DIRECTORY |
+	    O_CLOEXEC)) == -1)
+		ERROR(-1, "open(%s)", xdg_autostart_home);
+	while (flock(fd, LOCK_EX) == -1) {
+		if (errno != EINTR) {
+			(void)close(fd);
+			ERROR(-1, "flock(%s)", xdg_autostart_home);
+		}
+	}
+	return (fd);
+}
+
+int
+dsbautostart_df_set_key(desktop_file_t *df, df_key_t key, const void *val)
+{
+	char **str;
+
+	_clearerr();
+	if ((str = df_str_field(df, key)) != NULL) {
+		/* %c in Exec expands to the Name */
+		if (key == DF_KEY_EXEC || key == DF_KEY_NAME) {
+			free(df->argv); df->argv = NULL;
+		}
+		/* A changed Name or Comment replaces the translations. */
+		if (key == DF_KEY_NAME && cmp(*str, val) != 0) {
+			free(df->local_name); df->local_name = NULL;
+		} else if (key == DF_KEY_COMMENT && cmp(*str, val) != 0) {
+			free(df->local_comment); df->local_comment = NULL;
+		}
+		if (val == NULL) {
+			/* Unset the key */
+			free(*str); *str = NULL;
+			df_update_desktop_sets(df, key);
+			return (0);
+		}
+		if (change_string(str, (char *)val) == NULL)
+			return (-1);
+		df_update_desktop_sets(df, key);
+		return (0);
+	}
+	if (val == NULL || df_bool_field(df, key) == NULL)
+		return (-1);
+	*df_bool_field(df, key) = *(bool *)val;
+
+	return (0);
+}
+
+/*
+ * Return the tokenized Exec value of the given desktop file as a
+ * NULL-terminated argument vector which can be passed to execvp().
+ * The vector is created on first use and cached in the desktop file
+ * object. If Exec is a shell command line, the vector runs it via
+ * "/bin/sh -c". The returned vector must not be free()'d.
+ */
+char **
+dsbautostart_df_argv(desktop_file_t *df)
+{
+	_clearerr();
+	if (df->argv != NULL)
+		return (df->argv);
+	df->argv = exec_tokenize(df, &df->shell);
+
+	return (df->argv);
+}
+
+/*
+ * Return the key which excludes the given desktop file from the current
+ * desktop, i.e., DF_KEY_NOT_SHOW_IN or DF_KEY_ONLY_SHOW_IN, or -1 if it
+ * is not excluded.
+ */
+int
+dsbautostart_df_exclude_rule(const desktop_file_t *df)
+{
+	return (exclude_rule(df, current_desktops));
+}
+
+/*
+ * Return whether the given desktop file is started in a session whose
+ * XDG_CURRENT_DESKTOP is the given set of desktops.
+ */
+bool
+dsbautostart_df_shown_in(const desktop_file_t *df, desktop_set_t desktops)
+{
+	return (exclude_rule(df, desktops) == -1);
+}
+
+/*
+ * Convert the given colon separated list of desktop names, like
+ * XDG_CURRENT_DESKTOP, to a set.
+ */
+desktop_set_t
+dsbautostart_desktop_set(const char *desktops)
+{
+	return (desktop_set(desktops, ':'));
+}
+
+desktop_set_t
+dsbautostart_current_desktops()
+{
+	return (current_desktops);
+}
+
+/*
+ * Return the i-th XDG autostart directory, or NULL if i is out of range.
+ */
+const char *
+dsbautostart_xdg_dir(int i)
+{
+	int n;
+
+	if (xdg_dirs[0].path == NULL && create_xdg_dir_list() == -1)
+		return (NULL);
+	for (n = 0; n < i && xdg_dirs[n].path != NULL; n++)
+		;
+	return (xdg_dirs[n].path);
+}
+
+/*
+ * Return the path of the desktop file with the given ID which takes
+ * precedence over the others with the same ID, or NULL if there is none.
+ * The returned path must be free()'d by the caller.
+ */
+char *
+dsbautostart_df_lookup(const char *id)
+{
+	int	    i, prio;
+	char	    *path, *best;
+	size_t	    len;
+	struct stat sb;
+
+	_clearerr();
+	if (xdg_dirs[0].path == NULL && create_xdg_dir_list() == -1)
+		return (NULL);
+	for (i = 0, best = NULL, prio = -1; xdg_dirs[i].path != NULL; i++) {
+		if (xdg_dirs[i].prio <= prio)
+			continue;
+		len = strlen(xdg_dirs[i].path) + strlen(id) + 2;
+		if ((path = malloc(len)) == NULL) {
+			free(best);
+			ERROR(NULL, "malloc()");
+		}
+		(void)snprintf(path, len, "%s/%s", xdg_dirs[i].path, id);
+		if (stat(path, &sb) == -1 || !S_ISREG(sb.st_mode)) {
+			free(path);
+			continue;
+		}
+		free(best);
+		best = path;
+		prio = xdg_dirs[i].prio;
+	}
+	return (best);
+}
+
+/*
+ * Read the given desktop file. Returns NULL if it can't be read, or if it
+ * has no [Desktop Entry] group. In the latter case, dsbautostart_error()
+ * returns false.
+ */
+desktop_file_t *
+dsbautostart_df_read(const char *path)
+{
+	return (df_read(path));
+}
+
+/*
+ * Return the Name of the given desktop file translated to the user's
+ * language, if there is a translation, or else the untranslated Name.
+ */
+const char *
+dsbautostart_df_name(const desktop_file_t *df)
+{
+	return (df->local_name != NULL ? df->local_name : df->name);
+}
+
+const char *
+dsbautostart_df_comment(const desktop_file_t *df)
+{
+	return (df->local_comment != NULL ? df->local_comment : df->comment);
+}
+
+/*
+ * Read the [Desktop Action <id>] groups of the given desktop file. Desktop
+ * files are only read up to the end of their [Desktop Entry] group, so
+ * this reads the file again. Returns NULL if there are no actions, or on
+ * error. In the former case, dsbautostart_error() returns false. The list
+ * must be free()'d by dsbautostart_df_free_actions().
+ */
+df_action_t *
+dsbautostart_df_actions(const desktop_file_t *df)
+{
+	FILE	    *fp;
+	char	    *ln, *id, *val, **field;
+	df_action_t *head, *cur, **next;
+
+	_clearerr();
+	if (df->path == NULL)
+		return (NULL);
+	if ((fp = fopen(df->path, "r")) == NULL)
+		ERROR(NULL, "fopen(%s)", df->path);
+	head = cur = NULL;
+	next = &head;
+	while ((ln = readln(fp)) != NULL) {
+		skip_spaces(&ln);
+		if (*ln == '\0' || *ln == '#')
+			continue;
+		if ((id = group_name(ln)) != NULL) {
+			cur = NULL;
+			if (strncmp(id, "Desktop Action ", 15) != 0)
+				continue;
+			if ((cur = calloc(1, sizeof(*cur))) == NULL ||
+			    (cur->id = strdup(id + 15)) == NULL) {
+				free(cur);
+				seterr("strdup()");
+				goto error;
+			}
+			*next = cur;
+			next = &cur->next;
+			continue;
+		}
+		if (cur == NULL)
+			continue;
+		if ((val = df_get_val(ln, "Name")) != NULL)
+			field = &cur->name;
+		else if ((val = df_get_val(ln, "Exec")) != NULL)
+			field = &cur->exec;
+		else
+			continue;
+		free(*field);
+		if ((*field = strdup(val)) == NULL) {
+			seterr("strdup()");
+			goto error;
+		}
+	}
+	(void)fclose(fp);
+
+	return (head);
+error:
+	(void)readln(NULL);
+	(void)fclose(fp);
+	dsbautostart_df_free_actions(head);
+
+	return (NULL);
+}
+
+void
+dsbautostart_df_free_actions(df_action_t *action)
+{
+	df_action_t *next;
+
+	for (; action != NULL; action = next) {
+		next = action->next;
+		free(action->id);
+		free(action->name);
+		free(action->exec);
+		free(action);
+	}
+}
+
+/*
+ * Return the XDG autostart directory the given desktop file was read
+ * from, or NULL.
+ */
+const char *
+dsbautostart_df_layer(const desktop_file_t *df)
+{
+	int i;
+
+	for (i = 0; df->prio >= 0 && xdg_dirs[i].path != NULL; i++) {
+		if (xdg_dirs[i].prio == df->prio)
+			return (xdg_dirs[i].path);
+	}
+	return (NULL);
+}
+
+/*
+ * Return the name of the given key as used in desktop files.
+ */
+const char *
+dsbautostart_df_key_name(df_key_t key)
+{
+	return (df_vars[key].name);
+}
+
+bool
+dsbautostart_df_need_shell(desktop_file_t *df)
+{
+	if (dsbautostart_df_argv(df) == NULL)
+		return (false);
+	return (df->shell);
+}
+
+/*
+ * Check whether the given command is a valid Exec value.
+ */
+int
+dsbautostart_exec_check(const char *exec)
+{
+	char	       **argv;
+	bool	       shell;
+	desktop_file_t df;
+
+	_clearerr();
+	(void)memset(&df, 0, sizeof(df));
+	df.exec = (char *)exec;
+	if ((argv = exec_tokenize(&df, &shell)) == NULL)
+		return (-1);
+	free(argv);
+
+	return (0);
+}
+
+/*
+ * Build the index of executables in $PATH used to evaluate TryExec. If
+ * "persist" is true, the index is kept in the user's cache directory,
+ * and only directories that changed are read again.
+ */
+int
+dsbautostart_build_path_index(bool persist)
+{
+	int  ret;
+	char *cache;
+
+	_clearerr();
+	if (pathidx_built())
+		return (0);
+	pidx_persist = persist;
+	cache = persist ? dsbautostart_cache_path(PATH_PATH_INDEX) : NULL;
+	ret = pathidx_build(cache);
+	free(cache);
+	if (ret == -1)
+		ERROR(-1, "pathidx_build()");
+	return (0);
+}
+
+/*
+ * Bring the index of executables up to date with the directories of
+ * $PATH, so that programs installed since it was built are found.
+ */
+int
+dsbautostart_update_path_index()
+{
+	int  ret;
+	char *cache;
+
+	_clearerr();
+	if (!pathidx_built())
+		return (dsbautostart_build_path_index(false));
+	cache = pidx_persist ? dsbautostart_cache_path(PATH_PATH_INDEX) : NULL;
+	ret = pathidx_update(cache);
+	free(cache);
+	if (ret == -1)
+		ERROR(-1, "pathidx_update()");
+	return (0);
+}
+
+/*
+ * Check whether the program of the given desktop file is installed. If
+ * TryExec is set, its value is checked, else the program from Exec. We
+ * can't tell for shell command lines, so they are considered available.
+ */
+bool
+dsbautostart_df_available(desktop_file_t *df)
+{
+	char	   **argv, path[PATH_MAX];
+	const char *prog, *dir;
+
+	if (df->try_exec != NULL && *df->try_exec != '\0')
+		prog = df->try_exec;
+	else {
+		if ((argv = dsbautostart_df_argv(df)) == NULL)
+			return (false);
+		if (df->shell)
+			return (true);
+		prog = argv[0];
+	}
+	if (strchr(prog, '/') != NULL)
+		return (access(prog, X_OK) == 0);
+	if (dsbautostart_build_path_index(false) == -1)
+		return (true);
+	if ((dir = pathidx_lookup(prog)) == NULL)
+		return (false);
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, prog);
+
+	return (access(path, X_OK) == 0);
+}
+
+/*
+ * Return the full path of the program from Exec, or NULL if it's not
+ * installed, or if Exec requires a shell. The returned path must be
+ * free()'d by the caller.
+ */
+char *
+dsbautostart_df_program(desktop_file_t *df)
+{
+	char	   **argv, *path;
+	size_t	   len;
+	const char *dir;
+
+	_clearerr();
+	if ((argv = dsbautostart_df_argv(df)) == NULL)
+		return (NULL);
+	if (df->shell)
+		ERROR(NULL, "Command requires a shell");
+	if (strchr(argv[0], '/') != NULL) {
+		if ((path = strdup(argv[0])) == NULL)
+			ERROR(NULL, "strdup()");
+		return (path);
+	}
+	if (dsbautostart_build_path_index(false) == -1)
+		return (NULL);
+	if ((dir = pathidx_lookup(argv[0])) == NULL)
+		ERROR(NULL, "%s not found", argv[0]);
+	len = strlen(dir) + strlen(argv[0]) + 2;
+	if ((path = malloc(len)) == NULL)
+		ERROR(NULL, "malloc()");
+	(void)snprintf(path, len, "%s/%s", dir, argv[0]);
+
+	return (path);
+}
+
+/*
+ * Create a full path of the given filename under
+ * $XDG_CACHE_HOME/dsbautostart, and create the directory if it doesn't
+ * exist. The returned path must be free()'d by the caller.
+ */
+char *
+dsbautostart_cache_path(const char *file)
+{
+	char	      *path;
+	size_t	      len;
+	const char    *dir, *sub;
+	struct passwd *pwd;
+
+	_clearerr();
+	if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir == '/')
+		sub = "";
+	else {
+		if ((pwd = getpwuid(getuid())) == NULL)
+			ERROR(NULL, "getpwuid(%u)", getuid());
+		dir = pwd->pw_dir;
+		sub = "/" PATH_USER_CACHE_DIR;
+	}
+	len = strlen(dir) + strlen(sub) + sizeof(PROGRAM) + strlen(file) + 3;
+	if ((path = malloc(len)) == NULL)
+		ERROR(NULL, "malloc()");
+	(void)snprintf(path, len, "%s%s/%s", dir, sub, PROGRAM);
+	if (make_dirs(path) == -1) {
+		free(path);
+		return (NULL);
+	}
+	(void)snprintf(path, len, "%s%s/%s/%s", dir, sub, PROGRAM, file);
+
+	return (path);
+}
+
+/*
+ * Return the path of the file the launcher writes the output of the
+ * given entry's command to, i.e., $XDG_CACHE_HOME/dsbautostart/logs/
+ * <ID>.log. The log directory is created if it doesn't exist. The
+ * returned path must be free()'d by the caller.
+ */
+char *
+dsbautostart_log_path(const desktop_file_t *df)
+{
+	char	   *dir, *path;
+	size_t	   len, idlen;
+	const char *id;
+
+	_clearerr();
+	if (df->path == NULL)
+		ERROR(NULL, "Entry has no desktop file");
+	if ((id = strrchr(df->path, '/')) != NULL)
+		id++;
+	else
+		id = df->path;
+	idlen = strlen(id);
+	if (idlen > sizeof(".desktop") - 1 &&
+	    strcmp(id + idlen - sizeof(".desktop") + 1, ".desktop") == 0)
+		idlen -= sizeof(".desktop") - 1;
+	if ((dir = dsbautostart_cache_path(PATH_LOG_DIR)) == NULL)
+		return (NULL);
+	if (make_dirs(dir) == -1) {
+		free(dir);
+		return (NULL);
+	}
+	len = strlen(dir) + idlen + sizeof("/.log");
+	if ((path = malloc(len)) == NULL) {
+		free(dir);
+		ERROR(NULL, "malloc()");
+	}
+	(void)snprintf(path, len, "%s/%.*s.log", dir, (int)idlen, id);
+	free(dir);
+
+	return (path);
+}
+
+static desktop_file_t *
+df_read(const char *path)
+{
+	long long      t0;
+	const char     *p;
+	desktop_file_t *df;
+
+	t0 = stats_begin();
+	if ((df = df_parse(path)) != NULL)
+		stats.files_parsed++;
+	p = strrchr(path, '/');
+	stats_end(STATS_PHASE_PARSE, t0, p != NULL ? p + 1 : path);
+
+	return (df);
+}
+
+static desktop_file_t *
+df_parse(const char *path)
+{
+	int	       ret;
+	FILE	       *fp;
+	char	       *_path;
+	df_doc_t       *doc;
+	desktop_file_t *df;
+
+	_clearerr();
 	if ((_path = realpath(path, NULL)) == NULL)
 		return (NULL);
-	if ((fp = fopen(_path, "r")) == NULL && errno != ENOENT)
-		ERROR(NULL, "fopen(%s)", _path);
-	if ((df = df_new()) == NULL)
+	if ((fp = fopen(_path, "r")) == NULL) {
+		if (errno != ENOENT)
+			seterr("fopen(%s)", _path);
+		free(_path);
+		return (NULL);
+	}
+	stats.files_opened++;
+	doc = df_doc_read(fp);
+	(void)fclose(fp);
+	if (doc == NULL || (df = df_new()) == NULL) {
+		df_doc_free(doc);
+		free(_path);
+		return (NULL);
+	}
+	df->doc = doc;
+	if ((ret = df_scan(df)) != 1) {
+		df_free(df);
+		free(_path);
+		if (ret == 0)
+			errno = 0;
 		return (NULL);
-	init_var_tbl(df);
+	}
+	df->path = _path;
+	stats_alloc(STATS_MEM_DF, strlen(_path) + 1);
+	df->prio = df_prio(df->path);
+
+	return (df);
+}
+
+/*
+ * Set the fields of the desktop file from the [Desktop Entry] group of
+ * its document, and record where the keys are. Returns 1 on success, 0
+ * if there is no [Desktop Entry] group, and -1 on error.
+ */
+static int
+df_scan(desktop_file_t *df)
+{
+	int	       k, rank[2];
+	char	       *ln, *val, *eol;
+	bool	       found_desktop_entry;
+	size_t	       pos, next, len;
+	df_doc_t       *doc;
+	df_span_t      *sp;
+	static char    *buf = NULL;
+	static size_t  bufsz = 0;
+
+	if (!locales_init)
+		init_locales();
+	doc = df->doc;
 	found_desktop_entry = false;
-	while ((ln = readln(fp)) != NULL) {
+	rank[0] = rank[1] = N_LOCALES;
+	for (pos = 0; pos < doc->len; pos = next) {
+		eol  = memchr(doc->buf + pos, '\n', doc->len - pos);
+		len  = (eol != NULL ? (size_t)(eol - doc->buf) : doc->len) - pos;
+		next = pos + len + (eol != NULL);
+		/*
+		 * Parse a NUL-terminated copy, so that the line can be
+		 * split up without touching the document.
+		 */
+		if (len >= bufsz) {
+			if ((ln = realloc(buf, len + _POSIX2_LINE_MAX)) == NULL)
+				ERROR(-1, "realloc()");
+			buf = ln; bufsz = len + _POSIX2_LINE_MAX;
+		}
+		(void)memcpy(buf, doc->buf + pos, len);
+		buf[len] = '\0';
+		ln = buf;
 		skip_spaces(&ln);
 		if (*ln == '\0' || *ln == '#')
 			continue;
 		if (!found_desktop_entry) {
-			if (strcmp(ln, "[Desktop Entry]") == 0)
+			if (strcmp(ln, "[Desktop Entry]") == 0) {
 				found_desktop_entry = true;
+				doc->group_end = next;
+			}
 			continue;
 		}
-		for (i = 0; i < N_DF_VARS; i++) {
-			if (df_vars[i].type == TYPE_STR) {
-				val = df_get_val(ln, df_vars[i].name);
-				if (val == NULL)
-					continue;
-				*df_vars[i].val.strval = strdup(val);
-				if (*df_vars[i].val.strval == NULL) {
-					seterr("strdup()");
-					(void)fclose(fp);
-					df_free(df);
-					return (NULL);
-				}
-			} else {
-				val = df_get_val(ln, df_vars[i].name);
-				if (val == NULL)
-					continue;
-				*df_vars[i].val.boolval = df_str_to_bool(val);
-			}
+		/*
+		 * End of the [Desktop Entry] group. The other groups are
+		 * read by dsbautostart_df_actions().
+		 */
+		if (group_name(ln) != NULL)
+			break;
+		if (df_set_local_val(df, ln, rank) == -1 ||
+		    (k = df_set_val(df, ln, &val)) == -1)
+			return (-1);
+		if (k < (int)N_DF_VARS) {
+			sp = &doc->spans[k];
+			sp->line     = pos;
+			sp->val	     = pos + (val - buf);
+			sp->val_end  = pos + len;
+			sp->line_end = next;
 		}
+		doc->group_end = next;
 	}
-	(void)fclose(fp);
-	if (!found_desktop_entry) {
-		errno = 0;
-		df_free(df);
-		return (NULL);
+	return (found_desktop_entry ? 1 : 0);
+}
+
+/*
+ * Read the rest of the given file into a new document.
+ */
+static df_doc_t *
+df_doc_read(FILE *fp)
+{
+	int	    c;
+	char	    *p;
+	size_t	    size, rd, want;
+	df_doc_t    *doc;
+	struct stat sb;
+
+	if ((doc = calloc(1, sizeof(df_doc_t))) == NULL)
+		ERROR(NULL, "calloc()");
+	if (fstat(fileno(fp), &sb) == 0) {
+		doc->dev   = sb.st_dev;
+		doc->ino   = sb.st_ino;
+		doc->size  = sb.st_size;
+		doc->mtime = sb.st_mtim;
 	}
-	if ((df->path = strdup(_path)) == NULL) {
-		seterr("strdup()");
-		df_free(df);
-		return (NULL);
+	size = doc->size > 0 ? (size_t)doc->size + 1 : _POSIX2_LINE_MAX;
+	for (;;) {
+		if ((p = realloc(doc->buf, size)) == NULL) {
+			df_doc_free(doc);
+			ERROR(NULL, "realloc()");
+		}
+		doc->buf = p;
+		want = size - doc->len - 1;
+		rd = fread(doc->buf + doc->len, 1, want, fp);
+		doc->len += rd;
+		if (rd < want || feof(fp) || (c = getc(fp)) == EOF)
+			break;
+		/* The file has grown since fstat(). */
+		doc->buf[doc->len++] = (char)c;
+		size += _POSIX2_LINE_MAX;
 	}
-	df->prio = df_prio(df->path);
+	if (ferror(fp)) {
+		df_doc_free(doc);
+		ERROR(NULL, "fread()");
+	}
+	doc->buf[doc->len] = '\0';
+	stats.bytes_read += doc->len;
+	stats_alloc(STATS_MEM_DF, sizeof(df_doc_t) + size);
 
-	return (df);
+	return (doc);
+}
+
+static df_doc_t *
+df_doc_dup(const df_doc_t *doc)
+{
+	df_doc_t *cp;
+
+	if ((cp = malloc(sizeof(df_doc_t))) == NULL)
+		ERROR(NULL, "malloc()");
+	*cp = *doc;
+	if ((cp->buf = malloc(doc->len + 1)) == NULL) {
+		free(cp);
+		ERROR(NULL, "malloc()");
+	}
+	(void)memcpy(cp->buf, doc->buf, doc->len + 1);
+	stats_alloc(STATS_MEM_DF, sizeof(df_doc_t) + doc->len + 1);
+
+	return (cp);
+}
+
+static void
+df_doc_free(df_doc_t *doc)
+{
+	if (doc == NULL)
+		return;
+	free(doc->buf);
+	free(doc);
 }
 
 static char *
 df_create(desktop_file_t *df)
 {
 	int	   fd;
-	FILE	   *fp;
 	char	   *tmp, name[_POSIX_PATH_MAX];
-	size_t	   len, i;
+	size_t	   len;
 	const char template[] = "XXXXXX";
 
 	_clearerr();
 
-	init_var_tbl(df);
 	if (create_autostart_dir() == -1)
 		return (NULL);
 	(void)snprintf(name, sizeof(name), "%s-%s", PROGRAM, template);
 	if ((tmp = user_autostart_path(name)) == NULL)
 		return (NULL);
 	len = strlen(tmp) + sizeof(".desktop");
+	/* %k in Exec expands to the path */
+	free(df->argv); df->argv = NULL;
 	if ((df->path = malloc(len)) == NULL) {
 		seterr("malloc()");
 		goto error;
@@ -596,33 +1853,15 @@ df_create(desktop_file_t *df)
 		goto error;
 	}
 	(void)snprintf(df->path, len, "%s.desktop", tmp);
-	if ((fp = fdopen(fd, "r+")) == NULL) {
-		seterr("fdopen()");
-		goto error;
-	}
-	(void)fprintf(fp, "[Desktop Entry]\nType=Application\n");
-	for (i = 0; i < N_DF_VARS; i++) {
-		if (df_vars[i].type == TYPE_STR) {
-			if (*df_vars[i].val.strval == NULL)
-				continue;
-			(void)fprintf(fp, "%s=%s\n", 
-			    df_vars[i].name, *df_vars[i].val.strval);
-		} else {
-			(void)fprintf(fp, "%s=%s\n", df_vars[i].name,
-			    *df_vars[i].val.boolval ? "true" : "false");
-		}
-	}
-	(void)fclose(fp);
-	if (rename(tmp, df->path) == -1) {
-		seterr("rename(%s, %s)", tmp, df->path);
+	if (df_write_file(df, fd, tmp, df->path) == -1)
 		goto error;
-	}
 	free(tmp);
 
 	return (df->path);
 error:
 	free(tmp);
 	free(df->path);
+	df->path = NULL;
 
 	return (NULL);
 }
@@ -630,7 +1869,7 @@ error:
 static void
 _clearerr()
 {
-	_error = false;
+	_error = _conflict = false;
 }
 
 static void
@@ -655,6 +1894,11 @@ readln(FILE *fp)
 	static char   *p, *buf = NULL;
 	static size_t bsize = 0, slen = 0, rd, len = 0;
 	
+	if (fp == NULL) {
+		/* Discard what's left of the previous file. */
+		slen = len = 0;
+		return (NULL);
+	}
 	for (errno = 0;;) {
 		if (bsize == 0 || len == bsize - 1) {
 			buf = realloc(buf, bsize + _POSIX2_LINE_MAX);
@@ -674,6 +1918,7 @@ readln(FILE *fp)
 			return (NULL);
 		}
 		len += rd; buf[len] = '\0';
+		stats.bytes_read += rd;
 	}
 }
 
@@ -700,7 +1945,9 @@ hist_add(change_history_t *hist)
 
 	if ((hentry = malloc(sizeof(hist_entry_t))) == NULL)
 		ERROR(NULL, "malloc()");
+	stats_alloc(STATS_MEM_HISTORY, sizeof(hist_entry_t));
 	hentry->prev = hentry->next = NULL;
+	hentry->txn  = hist->txn;
 	hist->idx->next->prev = hentry;
 	hentry->prev = hist->idx;
 	hentry->next = hist->idx->next;
@@ -710,6 +1957,25 @@ hist_add(change_history_t *hist)
 	return (hentry);
 }
 
+/*
+ * Revert, or reapply the given change.
+ */
+static void
+hist_apply(hist_entry_t *hentry, bool revert)
+{
+	switch (hentry->action) {
+	case CHANGE:
+		hentry->entry->df = revert ? hentry->df0 : hentry->df1;
+		break;
+	case DELETE:
+		hentry->entry->deleted = !revert;
+		break;
+	case ADD:
+		hentry->entry->deleted = revert;
+		break;
+	}
+}
+
 static hist_entry_t *
 undo(change_history_t *hist)
 {
@@ -741,11 +2007,16 @@ entry_add(dsbautostart_t *as, desktop_file_t *df)
 {
 	entry_t *entry, *tail;
 
-	for (tail = as->cur_entries; tail != NULL && tail->next != NULL;
-	    tail = tail->next)
-		;
+	if (as->txn != NULL)
+		tail = as->txn->tail;
+	else {
+		for (tail = as->cur_entries; tail != NULL && tail->next != NULL;
+		    tail = tail->next)
+			;
+	}
 	if ((entry = malloc(sizeof(entry_t))) == NULL)
 		ERROR(NULL, "malloc()");
+	stats_alloc(STATS_MEM_ENTRIES, sizeof(entry_t));
 	if (tail == NULL) {
 		as->cur_entries = entry;
 		entry->next = entry->prev = NULL;
@@ -758,23 +2029,30 @@ entry_add(dsbautostart_t *as, desktop_file_t *df)
 	entry->df = df;
 	entry->id = entry_id++;
 	entry->deleted = false;
-
+	if (as->txn != NULL) {
+		as->txn->tail = entry;
+		if (txn_index(as->txn, entry) == -1)
+			return (NULL);
+	}
 	return (entry);
 }
 
 static bool
 cmp_entries(const entry_t *e0, const entry_t *e1)
 {
+	size_t i;
 
-	if (cmp(e0->df->exec, e1->df->exec) != 0		||
-	    cmp(e0->df->name, e1->df->name) != 0		||
-	    cmp(e0->df->comment, e1->df->comment) != 0		||
-	    cmp(e0->df->not_show_in, e1->df->not_show_in) != 0	||
-	    cmp(e0->df->only_show_in, e1->df->only_show_in) != 0)
-		return (false);
-	if ((e0->df->terminal && !e1->df->terminal) ||
-	    (!e0->df->terminal && e1->df->terminal))
-		return (false);
+	for (i = 0; i < N_DF_VARS; i++) {
+		if (df_vars[i].key == DF_KEY_HIDDEN)
+			continue;
+		if (df_vars[i].type == TYPE_STR) {
+			if (cmp(*df_str_field(e0->df, df_vars[i].key),
+			    *df_str_field(e1->df, df_vars[i].key)) != 0)
+				return (false);
+		} else if (*df_bool_field(e0->df, df_vars[i].key) !=
+		    *df_bool_field(e1->df, df_vars[i].key))
+			return (false);
+	}
 	if ((e0->deleted && !e1->deleted) || (!e0->deleted && e1->deleted))
 		return (false);
 	return (true);
@@ -793,6 +2071,7 @@ copy_entries(const entry_t *entries)
 			free_entries(head);
 			ERROR(NULL, "malloc()");
 		}
+		stats_alloc(STATS_MEM_ENTRIES, sizeof(entry_t));
 		if (head == NULL)
 			cur = head = new;
 		cur->next = new;
@@ -810,29 +2089,182 @@ copy_entries(const entry_t *entries)
 }
 
 static void
-init_var_tbl(desktop_file_t *df)
+skip_spaces(char **s)
 {
-	size_t i;
+	size_t n;
+	n = strspn(*s, "\t ");
+	(*s) += n;
+}
+
+/*
+ * Set the field of the given "key=value" line, if we know the key, and
+ * the caller wants it (see dsbautostart_set_read_keys()). Other lines are
+ * skipped without allocating anything. Returns the key, and sets "valp"
+ * to the value in "ln", or returns N_DF_VARS if the line was skipped.
+ */
+static int
+df_set_val(desktop_file_t *df, char *ln, char **valp)
+{
+	char   **str, *val;
+	size_t i, len;
 
+	len = strcspn(ln, "=\t ");
 	for (i = 0; i < N_DF_VARS; i++) {
-		assert(df_vars[i].key == i);
-		df_vars[i].set = false;
+		if (read_keys != 0 && (read_keys & (1ULL << i)) == 0)
+			continue;
+		if (strncmp(ln, df_vars[i].name, len) != 0 ||
+		    df_vars[i].name[len] != '\0')
+			continue;
+		if ((val = df_get_val(ln, df_vars[i].name)) == NULL)
+			return (N_DF_VARS);
+		*valp = val;
+		if (df_vars[i].type == TYPE_BOOL) {
+			*df_bool_field(df, df_vars[i].key) =
+			    df_str_to_bool(val);
+			return (i);
+		}
+		str = df_str_field(df, df_vars[i].key);
+		free(*str);
+		if ((*str = strdup(val)) == NULL)
+			ERROR(-1, "strdup()");
+		stats_alloc(STATS_MEM_DF, strlen(val) + 1);
+		df_update_desktop_sets(df, df_vars[i].key);
+		return (i);
+	}
+	return (N_DF_VARS);
+}
+
+/*
+ * If the given line is a group header, terminate the group name, and
+ * return it. Otherwise return NULL.
+ */
+static char *
+group_name(char *ln)
+{
+	char *p;
+
+	if (*ln != '[' || (p = strchr(ln, ']')) == NULL)
+		return (NULL);
+	*p = '\0';
+
+	return (ln + 1);
+}
+
+/*
+ * If the given line is a localized Name or Comment, and its locale ranks
+ * higher in the fallback chain than the one stored before, store its
+ * value. Translations to other languages are skipped without allocating
+ * anything. rank[] holds the rank of the stored Name and Comment.
+ */
+static int
+df_set_local_val(desktop_file_t *df, char *ln, int *rank)
+{
+	int	   i, r;
+	char	   *p, *val, **str;
+	size_t	   len;
+	const char *key[2] = { "Name[", "Comment[" };
+	df_key_t   k[2] = { DF_KEY_NAME, DF_KEY_COMMENT };
+
+	if (locales[0] == NULL)
+		return (0);
+	for (i = 0; i < 2; i++) {
+		len = strlen(key[i]);
+		if (strncmp(ln, key[i], len) == 0)
+			break;
+	}
+	if (i == 2 || (read_keys != 0 && (read_keys & (1ULL << k[i])) == 0))
+		return (0);
+	ln += len;
+	if ((p = strchr(ln, ']')) == NULL ||
+	    (r = locale_rank(ln, p - ln)) >= rank[i])
+		return (0);
+	p++;
+	skip_spaces(&p);
+	if (*p++ != '=')
+		return (0);
+	skip_spaces(&p);
+	val = p;
+	str = i == 0 ? &df->local_name : &df->local_comment;
+	free(*str);
+	if ((*str = strdup(val)) == NULL)
+		ERROR(-1, "strdup()");
+	stats_alloc(STATS_MEM_DF, strlen(val) + 1);
+	rank[i] = r;
+
+	return (0);
+}
+
+/*
+ * Return the position of the given locale in the fallback chain, or
+ * N_LOCALES if it's not in it.
+ */
+static int
+locale_rank(const char *locale, size_t len)
+{
+	int i;
+
+	for (i = 0; locales[i] != NULL; i++) {
+		if (strncmp(locales[i], locale, len) == 0 &&
+		    locales[i][len] == '\0')
+			return (i);
 	}
-	df_vars[DF_KEY_NAME].val.strval		 = &df->name;
-	df_vars[DF_KEY_COMMENT].val.strval	 = &df->comment;
-	df_vars[DF_KEY_EXEC].val.strval		 = &df->exec;
-	df_vars[DF_KEY_HIDDEN].val.boolval	 = &df->hidden;
-	df_vars[DF_KEY_TERMINAL].val.boolval	 = &df->terminal;
-	df_vars[DF_KEY_NOT_SHOW_IN].val.strval	 = &df->not_show_in;
-	df_vars[DF_KEY_ONLY_SHOW_IN].val.strval  = &df->only_show_in;
+	return (N_LOCALES);
 }
 
+/*
+ * Create the fallback chain of locales to look up localized keys from
+ * LC_ALL, LC_MESSAGES, or LANG. For "lang_COUNTRY.ENCODING@MODIFIER",
+ * this is lang_COUNTRY@MODIFIER, lang_COUNTRY, lang@MODIFIER, and lang.
+ * See the Desktop Entry Specification.
+ */
 static void
-skip_spaces(char **s)
+init_locales()
 {
-	size_t n;
-	n = strspn(*s, "\t ");
-	(*s) += n;
+	int	   n;
+	char	   buf[64];
+	size_t	   llen, clen;
+	const char *p, *env[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+	const char *lang, *country, *modifier;
+
+	locales_init = true;
+	for (n = 0, p = NULL; n < 3; n++) {
+		if ((p = getenv(env[n])) != NULL && *p != '\0')
+			break;
+	}
+	if (p == NULL || *p == '\0' || strcmp(p, "C") == 0 ||
+	    strcmp(p, "POSIX") == 0 || strlen(p) >= sizeof(buf))
+		return;
+	lang = p;
+	llen = strcspn(lang, "_.@");
+	country = lang[llen] == '_' ? lang + llen + 1 : NULL;
+	clen = country != NULL ? strcspn(country, ".@") : 0;
+	modifier = strchr(lang, '@');
+
+	n = 0;
+	if (country != NULL && modifier != NULL) {
+		(void)snprintf(buf, sizeof(buf), "%.*s_%.*s%s", (int)llen,
+		    lang, (int)clen, country, modifier);
+		locales[n++] = strdup(buf);
+	}
+	if (country != NULL) {
+		(void)snprintf(buf, sizeof(buf), "%.*s_%.*s", (int)llen, lang,
+		    (int)clen, country);
+		locales[n++] = strdup(buf);
+	}
+	if (modifier != NULL) {
+		(void)snprintf(buf, sizeof(buf), "%.*s%s", (int)llen, lang,
+		    modifier);
+		locales[n++] = strdup(buf);
+	}
+	(void)snprintf(buf, sizeof(buf), "%.*s", (int)llen, lang);
+	locales[n++] = strdup(buf);
+	/* Cut the chain at the first failed strdup(). */
+	for (n = 0; n < N_LOCALES && locales[n] != NULL; n++)
+		;
+	for (; n < N_LOCALES; n++) {
+		free(locales[n]);
+		locales[n] = NULL;
+	}
 }
 
 static char *
@@ -866,11 +2298,82 @@ change_string(char **str, char *val)
 
 	if ((newstr = strdup(val)) == NULL)
 		ERROR(NULL, "strdup()");
+	stats_alloc(STATS_MEM_DF, strlen(val) + 1);
 	free(*str); *str = newstr;
 
 	return (*str);
 }
 
+/*
+ * Return a pointer to the field of the given string key, or NULL if the
+ * key is not of type string.
+ */
+static char **
+df_str_field(desktop_file_t *df, df_key_t key)
+{
+	switch (key) {
+	case DF_KEY_NAME:
+		return (&df->name);
+	case DF_KEY_COMMENT:
+		return (&df->comment);
+	case DF_KEY_EXEC:
+		return (&df->exec);
+	case DF_KEY_NOT_SHOW_IN:
+		return (&df->not_show_in);
+	case DF_KEY_ONLY_SHOW_IN:
+		return (&df->only_show_in);
+	case DF_KEY_TRY_EXEC:
+		return (&df->try_exec);
+	case DF_KEY_AFTER:
+		return (&df->after);
+	case DF_KEY_REQUIRES:
+		return (&df->require);
+	case DF_KEY_READY:
+		return (&df->ready);
+	case DF_KEY_RESTART:
+		return (&df->restart);
+	case DF_KEY_NICE:
+		return (&df->nice);
+	case DF_KEY_IO_CLASS:
+		return (&df->io_class);
+	case DF_KEY_IO_PRIORITY:
+		return (&df->io_prio);
+	case DF_KEY_CPU_AFFINITY:
+		return (&df->cpu_affinity);
+	case DF_KEY_CGROUP:
+		return (&df->cgroup);
+	case DF_KEY_CPU_WEIGHT:
+		return (&df->cpu_weight);
+	case DF_KEY_MEMORY_HIGH:
+		return (&df->memory_high);
+	case DF_KEY_BACKGROUND:
+		return (&df->background);
+	case DF_KEY_ALLOW_MULTIPLE:
+		return (&df->allow_multiple);
+	case DF_KEY_NEEDS_DISPLAY:
+		return (&df->needs_display);
+	default:
+		return (NULL);
+	}
+}
+
+/*
+ * Return a pointer to the field of the given boolean key, or NULL if the
+ * key is not of type boolean.
+ */
+static bool *
+df_bool_field(desktop_file_t *df, df_key_t key)
+{
+	switch (key) {
+	case DF_KEY_HIDDEN:
+		return (&df->hidden);
+	case DF_KEY_TERMINAL:
+		return (&df->terminal);
+	default:
+		return (NULL);
+	}
+}
+
 static int
 cmp(const char *str1, const char *str2)
 {
@@ -882,20 +2385,118 @@ cmp(const char *str1, const char *str2)
 	return (strcmp(str1, str2));
 }
 
+static const char *
+basename_of(const char *path)
+{
+	const char *p;
+
+	return ((p = strrchr(path, '/')) != NULL ? p + 1 : path);
+}
+
+static unsigned
+hash_basename(const char *path)
+{
+	unsigned   h;
+	const char *p;
+
+	for (p = basename_of(path), h = 2166136261U; *p != '\0'; p++)
+		h = (h ^ (unsigned char)*p) * 16777619U;
+	return (h);
+}
+
+/*
+ * Return the first entry whose desktop file has the same basename as
+ * "path", or NULL if there is none.
+ */
+static entry_t *
+find_basename(const dsbautostart_t *as, const char *path)
+{
+	size_t	i, mask;
+	entry_t *ep;
+
+	if (as->txn == NULL) {
+		for (ep = as->cur_entries; ep != NULL; ep = ep->next) {
+			if (ep->df->path != NULL &&
+			    cmp_basenames(ep->df->path, path) == 0)
+				return (ep);
+		}
+		return (NULL);
+	}
+	mask = as->txn->nslots - 1;
+	for (i = hash_basename(path) & mask; (ep = as->txn->slots[i]) != NULL;
+	    i = (i + 1) & mask) {
+		if (cmp_basenames(ep->df->path, path) == 0)
+			return (ep);
+	}
+	return (NULL);
+}
+
+/*
+ * Add the given entry to the hash table of the transaction, unless it
+ * has no file, or an entry with the same basename was added before.
+ */
+static int
+txn_index(txn_t *txn, entry_t *entry)
+{
+	size_t	i, j, mask, nslots;
+	entry_t **slots, *ep;
+
+	if (entry->df->path == NULL)
+		return (0);
+	if (2 * (txn->nused + 1) > txn->nslots) {
+		nslots = txn->nslots * 2;
+		if ((slots = calloc(nslots, sizeof(entry_t *))) == NULL)
+			ERROR(-1, "calloc()");
+		stats_alloc(STATS_MEM_OTHER, nslots * sizeof(entry_t *));
+		for (j = 0; j < txn->nslots; j++) {
+			if ((ep = txn->slots[j]) == NULL)
+				continue;
+			for (i = hash_basename(ep->df->path) & (nslots - 1);
+			    slots[i] != NULL; i = (i + 1) & (nslots - 1))
+				;
+			slots[i] = ep;
+		}
+		free(txn->slots);
+		txn->slots  = slots;
+		txn->nslots = nslots;
+	}
+	mask = txn->nslots - 1;
+	for (i = hash_basename(entry->df->path) & mask;
+	    (ep = txn->slots[i]) != NULL; i = (i + 1) & mask) {
+		if (cmp_basenames(ep->df->path, entry->df->path) == 0)
+			return (0);
+	}
+	txn->slots[i] = entry;
+	txn->nused++;
+
+	return (0);
+}
+
+static void
+txn_free(txn_t *txn)
+{
+	if (txn == NULL)
+		return;
+	free(txn->slots);
+	free(txn);
+}
+
 static int
 cmp_basenames(const char *path1, const char *path2)
 {
-	const char *p1, *p2;
-	
-	if ((p1 = strrchr(path1, '/')) != NULL)
-		p1++;
-	else
-		p1 = path1;
-	if ((p2 = strrchr(path2, '/')) != NULL)
-		p2++;
-	else
-		p2 = path2;
-	return (strcmp(p1, p2));
+	return (strcmp(basename_of(path1), basename_of(path2)));
+}
+
+/*
+ * qsort() callback to order an array of pointers by address.
+ */
+static int
+cmp_ptrs(const void *a, const void *b)
+{
+	uintptr_t p = (uintptr_t)*(void * const *)a;
+	uintptr_t q = (uintptr_t)*(void * const *)b;
+
+	return (p < q ? -1 : p > q);
 }
 
 static void
@@ -904,7 +2505,9 @@ get_current_desktop()
 	char *p;
 
 	if ((p = getenv("XDG_CURRENT_DESKTOP")) != NULL)
-		current_desktop = p;
+		current_desktops = desktop_set(p, ':');
+	else
+		current_desktops = 0;
 }
 
 /*
@@ -1002,10 +2605,19 @@ create_xdg_dir_list()
 
 static int
 create_autostart_dir()
+{
+	return (make_dirs(xdg_autostart_home));
+}
+
+/*
+ * Create the given directory and all its missing parent directories.
+ */
+static int
+make_dirs(const char *dirpath)
 {
 	char *path, *dir, *buf;
 
-	if ((path = strdup(xdg_autostart_home)) == NULL)
+	if ((path = strdup(dirpath)) == NULL)
 		ERROR(-1, "strdup()");
 	if ((buf = malloc(strlen(path) + 1)) == NULL)
 		ERROR(-1, "malloc()");
@@ -1027,62 +2639,99 @@ df_new()
 {
 	desktop_file_t *df;
 	
-	if ((df = malloc(sizeof(desktop_file_t))) == NULL)
-		ERROR(NULL, "malloc()");
-	df->name = df->exec = df->path = df->comment = NULL;
-	df->not_show_in = df->only_show_in = NULL;
-	df->terminal = df->hidden = false;
+	if ((df = calloc(1, sizeof(desktop_file_t))) == NULL)
+		ERROR(NULL, "calloc()");
+	stats_alloc(STATS_MEM_DF, sizeof(desktop_file_t));
 	df->prio = -1;
 
-	return (df);
+	return (df);
+}
+
+/*
+ * Return the number of bytes the given desktop file and its strings
+ * occupy, not counting the cached argv.
+ */
+static size_t
+df_size(const desktop_file_t *df)
+{
+	char   *str;
+	size_t i, size;
+
+	if (df == NULL)
+		return (0);
+	size = sizeof(desktop_file_t);
+	for (i = 0; i < N_DF_VARS; i++) {
+		if (df_vars[i].type != TYPE_STR)
+			continue;
+		str = *df_str_field((desktop_file_t *)df, df_vars[i].key);
+		if (str != NULL)
+			size += strlen(str) + 1;
+	}
+	if (df->path != NULL)
+		size += strlen(df->path) + 1;
+	if (df->local_name != NULL)
+		size += strlen(df->local_name) + 1;
+	if (df->local_comment != NULL)
+		size += strlen(df->local_comment) + 1;
+	if (df->doc != NULL)
+		size += sizeof(df_doc_t) + df->doc->len + 1;
+
+	return (size);
 }
 
 static void
 df_free(desktop_file_t *df)
 {
-	free(df->name);
-	free(df->exec);
-	free(df->comment);
+	size_t i;
+
+	if (df == NULL)
+		return;
+	for (i = 0; i < N_DF_VARS; i++) {
+		if (df_vars[i].type == TYPE_STR)
+			free(*df_str_field(df, df_vars[i].key));
+	}
 	free(df->path);
-	free(df->not_show_in);
-	free(df->only_show_in);
+	free(df->argv);
+	free(df->local_name);
+	free(df->local_comment);
+	df_doc_free(df->doc);
 	free(df);
 }
 
 static desktop_file_t *
 df_dup(const desktop_file_t *df)
 {
+	char	       *str;
+	size_t	       i;
 	desktop_file_t *cp;
 
 	_clearerr();
 	if ((cp = df_new()) == NULL)
 		return (NULL);
-	if (df->exec != NULL) {
-		if (dsbautostart_df_set_key(cp, DF_KEY_EXEC, df->exec) == -1)
-			goto error;
-	}
-	if (df->name != NULL) {
-		if (dsbautostart_df_set_key(cp, DF_KEY_NAME, df->name) == -1)
-			goto error;
-	}
-	if (df->comment != NULL) {
-		if (dsbautostart_df_set_key(cp, DF_KEY_COMMENT,
-		    df->comment) == -1)
-			goto error;
-	}
-	if (df->only_show_in != NULL) {
-		if (dsbautostart_df_set_key(cp, DF_KEY_ONLY_SHOW_IN, df->only_show_in) == -1)
-			goto error;
-	}
-	if (df->not_show_in != NULL) {
-		if (dsbautostart_df_set_key(cp, DF_KEY_NOT_SHOW_IN, df->not_show_in) == -1)
+	for (i = 0; i < N_DF_VARS; i++) {
+		if (df_vars[i].type == TYPE_BOOL) {
+			*df_bool_field(cp, df_vars[i].key) =
+			    *df_bool_field((desktop_file_t *)df, df_vars[i].key);
+			continue;
+		}
+		str = *df_str_field((desktop_file_t *)df, df_vars[i].key);
+		if (str == NULL)
+			continue;
+		if (dsbautostart_df_set_key(cp, df_vars[i].key, str) == -1)
 			goto error;
 	}
-	dsbautostart_df_set_key(cp, DF_KEY_TERMINAL, &df->terminal);
 	if (df->path != NULL) {
 		if ((cp->path = strdup(df->path)) == NULL)
 			goto error;
 	}
+	if (df->local_name != NULL &&
+	    (cp->local_name = strdup(df->local_name)) == NULL)
+		goto error;
+	if (df->local_comment != NULL &&
+	    (cp->local_comment = strdup(df->local_comment)) == NULL)
+		goto error;
+	if (df->doc != NULL && (cp->doc = df_doc_dup(df->doc)) == NULL)
+		goto error;
 	cp->prio = df->prio;
 
 	return (cp);
@@ -1124,7 +2773,10 @@ df_del(const char *path)
 	 * delete it, we are done.
 	 */
 	if (df_count_paths(path) <= 1) {
-		if (unlink(path) == 0)
+		if (unlink(path) == 0) {
+			stats.files_deleted++;
+			return (0);
+		} else if (errno == ENOENT)
 			return (0);
 		else if (errno != EPERM && errno != EACCES)
 			ERROR(-1, "unlink()");
@@ -1193,69 +2845,93 @@ df_count_paths(const char *path)
 	return (count);
 }
 
-static const char *
-next_list_item(const char *str, size_t *len)
+/*
+ * Return the bit of the given desktop name, and assign one if the name is
+ * new. Names beyond the first N_DESKTOPS share the bit N_DESKTOPS, so
+ * they can match each other.
+ */
+static int
+desktop_id(const char *name, size_t len)
 {
-	const char	  *p;
-	static const char *prev = NULL;
-
-	if (str != NULL)
-		prev = str;
-	else
-		str = prev;
-	if (str == NULL || *str == '\0')
-		return (NULL);
-	while (*str == ';')
-		str++;
-	p = strchr(str, ';');
-	if (p == NULL)
-		p = strchr(str, '\0');
-	*len = p - str;
-	if (*len == 0)
-		return (NULL);
-	prev = ++p;
+	size_t	 i;
+	unsigned h;
+
+	for (i = 0, h = 2166136261U; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619U;
+	for (i = h % DESKTOP_HASH_SIZE; desktop_hash[i] != 0;
+	    i = (i + 1) % DESKTOP_HASH_SIZE) {
+		if (strncmp(desktops[desktop_hash[i] - 1], name, len) == 0 &&
+		    desktops[desktop_hash[i] - 1][len] == '\0')
+			return (desktop_hash[i] - 1);
+	}
+	if (ndesktops == N_DESKTOPS ||
+	    (desktops[ndesktops] = strndup(name, len)) == NULL)
+		return (N_DESKTOPS);
+	desktop_hash[i] = (signed char)++ndesktops;
 
-	return (str);
+	return (ndesktops - 1);
 }
 
-static bool
-df_exclude(const desktop_file_t *df)
+/*
+ * Convert the given list of desktop names, separated by "sep", to a set.
+ */
+static desktop_set_t
+desktop_set(const char *list, int sep)
 {
-	size_t	   len;
-	const char *p;
+	size_t	      len;
+	desktop_set_t set;
 
-	if (df->not_show_in != NULL) {
-		p = df->not_show_in;
-		while ((p = next_list_item(p, &len)) != NULL) {
-			if (strncmp(p, current_desktop, len) == 0)
-				return (true);
-			p = NULL;
+	for (set = 0; *list != '\0'; list += len) {
+		if (*list == sep) {
+			len = 1;
+			continue;
 		}
+		for (len = 0; list[len] != '\0' && list[len] != sep; len++)
+			;
+		set |= 1ULL << desktop_id(list, len);
 	}
-	if (df->only_show_in != NULL) {
-		p = df->only_show_in;
-		while ((p = next_list_item(p, &len)) != NULL) {
-			if (strncmp(p, current_desktop, len) == 0)
-				return (false);
-			p = NULL;
-		}
-		return (true);
+	return (set);
+}
+
+static int
+exclude_rule(const desktop_file_t *df, desktop_set_t desktops)
+{
+	if (df->not_show_in != NULL && (df->not_show_in_set & desktops) != 0)
+		return (DF_KEY_NOT_SHOW_IN);
+	if (df->only_show_in != NULL && (df->only_show_in_set & desktops) == 0)
+		return (DF_KEY_ONLY_SHOW_IN);
+	return (-1);
+}
+
+/*
+ * Tokenize OnlyShowIn or NotShowIn after it was changed.
+ */
+static void
+df_update_desktop_sets(desktop_file_t *df, df_key_t key)
+{
+	if (key == DF_KEY_ONLY_SHOW_IN) {
+		df->only_show_in_set = df->only_show_in == NULL ? 0 :
+		    desktop_set(df->only_show_in, ';');
+	} else if (key == DF_KEY_NOT_SHOW_IN) {
+		df->not_show_in_set = df->not_show_in == NULL ? 0 :
+		    desktop_set(df->not_show_in, ';');
 	}
-	return (false);
+}
+
+static bool
+df_exclude(const desktop_file_t *df)
+{
+	return (dsbautostart_df_exclude_rule(df) != -1);
 }
 
 static int
 df_save(desktop_file_t *df)
 {
 	int	   fd;
-	char	   *tmpath, *userpath, *ln;
-	FILE	   *in, *out;
-	size_t	   i, len, namelen;
+	char	   *tmpath, *userpath;
+	size_t	   len;
 	const char template[] = "XXXXXX";
 
-	init_var_tbl(df);
-	in = out = NULL;
-	
 	if (df->path == NULL) {
 		if (df_create(df) == NULL)
 			return (-1);
@@ -1265,85 +2941,288 @@ df_save(desktop_file_t *df)
 		return (-1);
 	free(df->path);
 	df->path = userpath;
-	if ((in = fopen(df->path, "r")) == NULL && errno != ENOENT)
-		ERROR(-1, "fopen(%s)", df->path);
+	free(df->argv); df->argv = NULL;
 	len = strlen(df->path) + sizeof(".") + sizeof(template);
-	if ((tmpath = malloc(len)) == NULL) {
-		seterr("malloc()");
-		goto error;
-	}
+	if ((tmpath = malloc(len)) == NULL)
+		ERROR(-1, "malloc()");
 	(void)snprintf(tmpath, len, "%s.%s", df->path, template);
 
 	if ((fd = mkstemp(tmpath)) == -1) {
 		seterr("mkstemp()");
+		free(tmpath);
+		return (-1);
+	}
+	if (df_write_file(df, fd, tmpath, df->path) == -1) {
+		free(tmpath);
+		return (-1);
+	}
+	free(tmpath);
+
+	return (0);
+}
+
+/*
+ * Write the desktop file to the temporary file "tmpath", opened as "fd",
+ * and rename it to "path". The document of the desktop file is replaced
+ * by what was written, so that it describes the file on disk. "fd" is
+ * closed, and on error, "tmpath" is removed.
+ */
+static int
+df_write_file(desktop_file_t *df, int fd, const char *tmpath,
+    const char *path)
+{
+	int	       ret;
+	char	       *buf;
+	FILE	       *mem;
+	size_t	       len, n;
+	ssize_t	       wr;
+	df_doc_t       *doc;
+	struct stat    sb;
+
+	buf = NULL; len = 0; doc = NULL;
+	if ((mem = open_memstream(&buf, &len)) == NULL) {
+		seterr("open_memstream()");
 		goto error;
 	}
-	if ((out = fdopen(fd, "w")) == NULL) {
-		seterr("fdopen()");
+	if ((doc = calloc(1, sizeof(df_doc_t))) == NULL) {
+		seterr("calloc()");
+		(void)fclose(mem);
 		goto error;
 	}
-	while (in != NULL && (ln = readln(in)) != NULL) {
-		for (i = 0; i < N_DF_VARS; i++) {
-			namelen = strlen(df_vars[i].name);
-			if (strncmp(ln, df_vars[i].name, namelen) == 0 &&
-			    (isspace(ln[namelen]) || ln[namelen] == '=')) {
-			    	if (df_vars[i].type == TYPE_STR) {
-					if (*df_vars[i].val.strval == NULL)
-						break;
-					(void)fprintf(out, "%s=%s\n", 
-					    df_vars[i].name,
-					    *df_vars[i].val.strval);
-				} else {
-					(void)fprintf(out, "%s=%s\n", 
-					    df_vars[i].name,
-					    *df_vars[i].val.boolval ? \
-					    "true" : "false");
-				}
-				df_vars[i].set = true;
-				break;
-			}
-		}
-		if (i == N_DF_VARS)
-			(void)fprintf(out, "%s\n", ln);
+	ret = df_write(df, mem, doc);
+	if (fclose(mem) != 0 && ret == 0) {
+		seterr("fclose()");
+		ret = -1;
 	}
-	if (in == NULL)
-		(void)fprintf(out, "[Desktop Entry]\nType=Application\n");
-	for (i = 0; i < N_DF_VARS; i++) {
-		if (df_vars[i].set)
-			continue;
-		if (df_vars[i].type == TYPE_STR) {
-			if (*df_vars[i].val.strval == NULL)
+	if (ret == -1)
+		goto error;
+	for (n = 0; n < len; n += wr) {
+		if ((wr = write(fd, buf + n, len - n)) == -1) {
+			if (errno == EINTR) {
+				wr = 0;
 				continue;
-			(void)fprintf(out, "%s=%s\n", 
-			    df_vars[i].name, *df_vars[i].val.strval);
-		} else {
-			(void)fprintf(out, "%s=%s\n", df_vars[i].name,
-			     *df_vars[i].val.boolval ? "true" : "false");
+			}
+			seterr("write(%s)", tmpath);
+			goto error;
 		}
 	}
-	(void)fclose(out);
-	if (in != NULL)
-		(void)fclose(in);
-	in = out = NULL;
-	if (rename(tmpath, df->path) == -1) {
-		seterr("rename(%s, %s)", tmpath, df->path);
+	if (fstat(fd, &sb) == -1) {
+		seterr("fstat(%s)", tmpath);
 		goto error;
 	}
-	free(tmpath);
+	ret = close(fd); fd = -1;
+	if (ret == -1) {
+		seterr("close(%s)", tmpath);
+		goto error;
+	}
+	if (rename(tmpath, path) == -1) {
+		seterr("rename(%s, %s)", tmpath, path);
+		goto error;
+	}
+	stats.files_written++;
+	stats.files_renamed++;
+
+	/* open_memstream() keeps the buffer NUL-terminated. */
+	doc->buf   = buf;
+	doc->len   = len;
+	doc->dev   = sb.st_dev;
+	doc->ino   = sb.st_ino;
+	doc->size  = sb.st_size;
+	doc->mtime = sb.st_mtim;
+	stats_alloc(STATS_MEM_DF, sizeof(df_doc_t) + len + 1);
+	df_doc_free(df->doc);
+	df->doc = doc;
 
 	return (0);
 error:
-	if (in != NULL)
-		(void)fclose(in);
-	if (out != NULL)
-		(void)fclose(out);
-	free(tmpath);
+	if (fd != -1)
+		(void)close(fd);
+	(void)unlink(tmpath);
+	free(doc);
+	free(buf);
 
 	return (-1);
 }
 
+/*
+ * Write the given desktop file. Only the values which differ from the
+ * document it was read from are replaced. Keys which were unset are
+ * removed, and new keys are appended to the [Desktop Entry] group. All
+ * other bytes are copied unchanged. If "res" is not NULL, the positions
+ * of the keys and the end of the group in the written bytes are stored
+ * in it, so that they don't need to be parsed again. Copied keys are
+ * moved by the change in length of the edits before them.
+ */
+static int
+df_write(const desktop_file_t *df, FILE *out, df_doc_t *res)
+{
+	int	   i, j, k, n;
+	bool	   bol;
+	size_t	   pos, opos, len;
+	df_doc_t   new, scratch;
+	const char *val;
+	df_span_t  *rp;
+	const df_doc_t	*doc;
+	const df_span_t *sp;
+	struct edit_s {
+		size_t start;
+		size_t end;
+		int    key;
+		bool   insert;
+	} edits[N_DF_VARS], tmp;
+
+	if ((doc = df->doc) == NULL) {
+		(void)memset(&new, 0, sizeof(new));
+		new.buf = (char *)DF_TEMPLATE;
+		new.len = new.group_end = sizeof(DF_TEMPLATE) - 1;
+		doc = &new;
+	}
+	for (i = n = 0; i < (int)N_DF_VARS; i++) {
+		assert(df_vars[i].key == (df_key_t)i);
+		if (!df_key_changed(df, doc, i))
+			continue;
+		sp  = &doc->spans[i];
+		val = df_text_val(df, df_vars[i].key);
+		if (sp->line_end == 0) {
+			edits[n].start = edits[n].end = doc->group_end;
+			edits[n].insert = true;
+		} else if (val == NULL) {
+			edits[n].start = sp->line;
+			edits[n].end   = sp->line_end;
+			edits[n].insert = false;
+		} else {
+			edits[n].start = sp->val;
+			edits[n].end   = sp->val_end;
+			edits[n].insert = false;
+		}
+		edits[n++].key = i;
+	}
+	/* Sort by offset. New keys keep the order of df_vars. */
+	for (i = 1; i < n; i++) {
+		for (j = i; j > 0 && edits[j - 1].start > edits[j].start; j--) {
+			tmp = edits[j]; edits[j] = edits[j - 1]; edits[j - 1] = tmp;
+		}
+	}
+	if (res == NULL)
+		res = &scratch;
+	(void)memset(res->spans, 0, sizeof(res->spans));
+	for (i = 0, pos = opos = 0, bol = true; i <= n; i++) {
+		len = (i < n ? edits[i].start : doc->len) - pos;
+		if (len > 0) {
+			(void)fwrite(doc->buf + pos, 1, len, out);
+			bol = doc->buf[pos + len - 1] == '\n';
+		}
+		/* Keys in the copied bytes. Edited keys are set below. */
+		for (k = 0; k < (int)N_DF_VARS; k++) {
+			sp = &doc->spans[k];
+			if (sp->line_end == 0 || sp->line < pos ||
+			    sp->line >= pos + len)
+				continue;
+			rp = &res->spans[k];
+			rp->line     = sp->line - pos + opos;
+			rp->val	     = sp->val - pos + opos;
+			rp->val_end  = sp->val_end - pos + opos;
+			rp->line_end = sp->line_end - pos + opos;
+		}
+		if (doc->group_end >= pos && doc->group_end <= pos + len)
+			res->group_end = doc->group_end - pos + opos;
+		opos += len;
+		if (i == n)
+			break;
+		k   = edits[i].key;
+		sp  = &doc->spans[k];
+		rp  = &res->spans[k];
+		val = df_text_val(df, df_vars[k].key);
+		if (edits[i].insert) {
+			/* The last line of the group has no newline. */
+			if (!bol) {
+				(void)fputc('\n', out);
+				for (j = 0; j < (int)N_DF_VARS; j++) {
+					if (res->spans[j].line_end == opos)
+						res->spans[j].line_end++;
+				}
+				opos++;
+			}
+			(void)fprintf(out, "%s=%s\n", df_vars[k].name, val);
+			rp->line     = opos;
+			rp->val	     = opos + strlen(df_vars[k].name) + 1;
+			rp->val_end  = rp->val + strlen(val);
+			rp->line_end = rp->val_end + 1;
+			opos = res->group_end = rp->line_end;
+			bol = true;
+		} else if (val != NULL) {
+			(void)fputs(val, out);
+			rp->line     = opos - (sp->val - sp->line);
+			rp->val	     = opos;
+			rp->val_end  = opos + strlen(val);
+			rp->line_end = rp->val_end + (sp->line_end - sp->val_end);
+			opos = rp->val_end;
+			bol = false;
+		} else
+			(void)memset(rp, 0, sizeof(*rp));
+		pos = edits[i].end;
+	}
+	if (ferror(out))
+		ERROR(-1, "fwrite()");
+	return (0);
+}
+
+/*
+ * Return true if the value of the given key differs from the one in the
+ * given document.
+ */
+static bool
+df_key_changed(const desktop_file_t *df, const df_doc_t *doc, int key)
+{
+	size_t		len;
+	const char	*val;
+	const df_span_t *sp;
+
+	val = df_text_val(df, df_vars[key].key);
+	if (doc == NULL || (sp = &doc->spans[key])->line_end == 0)
+		return (val != NULL);
+	if (val == NULL)
+		return (true);
+	len = sp->val_end - sp->val;
+
+	return (strlen(val) != len || strncmp(doc->buf + sp->val, val, len) != 0);
+}
+
+/*
+ * Return the value of the given key as written to a desktop file, or NULL
+ * if the key is unset. A false boolean is only written if the file has
+ * the key already.
+ */
+static const char *
+df_text_val(const desktop_file_t *df, df_key_t key)
+{
+	bool *b;
+
+	if (df_vars[key].type == TYPE_STR)
+		return (*df_str_field((desktop_file_t *)df, key));
+	b = df_bool_field((desktop_file_t *)df, key);
+	if (*b)
+		return ("true");
+	if (df->doc != NULL && df->doc->spans[key].line_end != 0)
+		return ("false");
+	return (NULL);
+}
+
 static desktop_file_t **
 df_readdir(const char *dir, desktop_file_t ***list)
+{
+	long long      t0;
+	desktop_file_t **ret;
+
+	t0  = stats_begin();
+	ret = scan_dir(dir, list);
+	stats_end(STATS_PHASE_SCAN, t0, dir);
+
+	return (ret);
+}
+
+static desktop_file_t **
+scan_dir(const char *dir, desktop_file_t ***list)
 {
 	DIR	       *dirp;
 	char	       *path, *suffix;
@@ -1358,6 +3237,7 @@ df_readdir(const char *dir, desktop_file_t ***list)
 			ERROR(NULL, "opendir(%s)", dir);
 		return (NULL);
 	}
+	stats.dirs_scanned++;
 	len = strlen(dir) + _POSIX_PATH_MAX + 2;
 	if ((path = malloc(len)) == NULL) {
 		seterr("malloc()");
@@ -1407,6 +3287,7 @@ extend_desktop_file_list(desktop_file_t ***list, desktop_file_t *df)
 		ptr = *list = malloc(2 * sizeof(desktop_file_t *));
 		if (ptr == NULL)
 			ERROR(NULL, "malloc()");
+		stats_alloc(STATS_MEM_OTHER, 2 * sizeof(desktop_file_t *));
 	} else {
 		/* Replace desktop files with the same basename */
 		for (ptr = *list; *ptr != NULL; ptr++) {
@@ -1423,6 +3304,7 @@ extend_desktop_file_list(desktop_file_t ***list, desktop_file_t *df)
 		ptr = realloc(*list, n * sizeof(desktop_file_t *));
 		if (ptr == NULL)
 			ERROR(NULL, "realloc()");
+		stats_alloc(STATS_MEM_OTHER, n * sizeof(desktop_file_t *));
 		*list = ptr;
 		ptr += n - 2;
 	}
@@ -1431,6 +3313,271 @@ extend_desktop_file_list(desktop_file_t ***list, desktop_file_t *df)
 	return (df);
 }
 
+/*
+ * Append the string "s" of length "len" to the buffer "*buf" of size
+ * "*bufsz" at "*pos", and grow the buffer if necessary.
+ */
+static int
+buf_append(char **buf, size_t *bufsz, size_t *pos, const char *s, size_t len)
+{
+	char *p;
+
+	if (*pos + len + 1 > *bufsz) {
+		if ((p = realloc(*buf, *pos + len + 64)) == NULL)
+			ERROR(-1, "realloc()");
+		*buf = p;
+		*bufsz = *pos + len + 64;
+	}
+	(void)memcpy(*buf + *pos, s, len);
+	*pos += len;
+	(*buf)[*pos] = '\0';
+
+	return (0);
+}
+
+/*
+ * Look up the expansion of the given field code. Return 1 if the field
+ * code is to be replaced by "*val", 0 if it is to be removed, and -1 if
+ * it is unknown.
+ */
+static int
+field_code_value(const desktop_file_t *df, char code, const char **val)
+{
+	switch (code) {
+	case '%':
+		*val = "%";
+		return (1);
+	case 'c':
+		*val = dsbautostart_df_name(df) != NULL ?
+		    dsbautostart_df_name(df) : "";
+		return (1);
+	case 'k':
+		*val = df->path != NULL ? df->path : "";
+		return (1);
+	case 'f': case 'F': case 'u': case 'U': case 'd': case 'D':
+	case 'n': case 'N': case 'v': case 'm': case 'i':
+		/* There are no files, URLs or icons to pass on autostart. */
+		return (0);
+	}
+	return (-1);
+}
+
+/*
+ * Apply the unescaping rules for values of type string to the given Exec
+ * value. If "shell" is true, also expand the field codes. In that case
+ * the expansions of %c and %k are single quoted, and unknown field codes
+ * are kept as they might be part of the shell command (e.g. date +%s).
+ * The returned string must be free()'d by the caller.
+ */
+static char *
+exec_unescape(const desktop_file_t *df, bool shell)
+{
+	char	   *buf, c;
+	size_t	   bufsz, pos;
+	const char *s, *p, *val;
+
+	bufsz = pos = 0;
+	if ((buf = strdup("")) == NULL)
+		ERROR(NULL, "strdup()");
+	for (s = df->exec; *s != '\0'; s++) {
+		if (*s == '\\' && s[1] != '\0' && strchr("sntr\\", s[1]) != NULL) {
+			switch (*++s) {
+			case 's':
+				c = ' ';
+				break;
+			case 'n':
+				c = '\n';
+				break;
+			case 't':
+				c = '\t';
+				break;
+			case 'r':
+				c = '\r';
+				break;
+			default:
+				c = '\\';
+			}
+			if (buf_append(&buf, &bufsz, &pos, &c, 1) == -1)
+				goto error;
+			continue;
+		}
+		if (!shell || *s != '%' || s[1] == '\0' ||
+		    field_code_value(df, s[1], &val) == -1) {
+			if (buf_append(&buf, &bufsz, &pos, s, 1) == -1)
+				goto error;
+			continue;
+		}
+		if (field_code_value(df, *++s, &val) == 0)
+			continue;
+		if (*s == '%') {
+			if (buf_append(&buf, &bufsz, &pos, val, 1) == -1)
+				goto error;
+			continue;
+		}
+		if (buf_append(&buf, &bufsz, &pos, "'", 1) == -1)
+			goto error;
+		for (p = val; *p != '\0'; p++) {
+			if (*p == '\'') {
+				if (buf_append(&buf, &bufsz, &pos, "'\\''", 4) == -1)
+					goto error;
+			} else if (buf_append(&buf, &bufsz, &pos, p, 1) == -1)
+				goto error;
+		}
+		if (buf_append(&buf, &bufsz, &pos, "'", 1) == -1)
+			goto error;
+	}
+	return (buf);
+error:
+	free(buf);
+	return (NULL);
+}
+
+/*
+ * Create an argument vector from the given strings separated by '\0'.
+ * The vector and the strings are allocated as one block, so a single
+ * free() releases everything.
+ */
+static char **
+make_argv(const char *args, size_t len, int argc)
+{
+	int    i;
+	char   **argv, *p;
+	size_t n;
+
+	n = (argc + 1) * sizeof(char *);
+	if ((argv = malloc(n + len)) == NULL)
+		ERROR(NULL, "malloc()");
+	p = (char *)argv + n;
+	(void)memcpy(p, args, len);
+	for (i = 0; i < argc; i++) {
+		argv[i] = p;
+		p += strlen(p) + 1;
+	}
+	argv[i] = NULL;
+
+	return (argv);
+}
+
+/*
+ * Split the Exec value of the given desktop file into arguments according
+ * to the quoting rules of the Desktop Entry Specification, and expand the
+ * field codes. If an unquoted reserved character is found, the value is
+ * treated as a shell command line, "*shell" is set to true, and a vector
+ * to run the command via /bin/sh -c is returned.
+ */
+static char **
+exec_tokenize(const desktop_file_t *df, bool *shell)
+{
+	int	   argc;
+	char	   *exec, *buf, **argv;
+	bool	   quoted, in_arg;
+	size_t	   bufsz, pos;
+	const char *s, *val;
+
+	*shell = false;
+	if (df->exec == NULL || *df->exec == '\0')
+		ERROR(NULL, "Exec value is empty");
+	if ((exec = exec_unescape(df, false)) == NULL)
+		return (NULL);
+	buf = NULL; bufsz = pos = 0;
+	argc = 0; quoted = in_arg = false;
+	for (s = exec; *s != '\0'; s++) {
+		if (*s == '%' && s[1] != '\0') {
+			switch (field_code_value(df, s[1], &val)) {
+			case 0:
+				s++;
+				continue;
+			case 1:
+				s++;
+				in_arg = true;
+				if (buf_append(&buf, &bufsz, &pos, val,
+				    strlen(val)) == -1)
+					goto error;
+				continue;
+			}
+		}
+		if (quoted) {
+			if (*s == '"') {
+				quoted = false;
+				continue;
+			}
+			if (*s == '\\' && s[1] != '\0' &&
+			    strchr("\"`$\\", s[1]) != NULL)
+				s++;
+		} else if (*s == ' ' || *s == '\t' || *s == '\n') {
+			if (!in_arg)
+				continue;
+			if (buf_append(&buf, &bufsz, &pos, "", 1) == -1)
+				goto error;
+			argc++; in_arg = false;
+			continue;
+		} else if (*s == '"') {
+			quoted = in_arg = true;
+			continue;
+		} else if (strchr(EXEC_RESERVED_CHARS, *s) != NULL) {
+			*shell = true;
+			break;
+		}
+		in_arg = true;
+		if (buf_append(&buf, &bufsz, &pos, s, 1) == -1)
+			goto error;
+	}
+	free(exec); exec = NULL;
+	if (*shell) {
+		free(buf);
+		if ((exec = exec_unescape(df, true)) == NULL)
+			return (NULL);
+		pos = sizeof(PATH_SHELL) + sizeof("-c") + strlen(exec) + 1;
+		if ((buf = malloc(pos)) == NULL) {
+			seterr("malloc()");
+			goto error;
+		}
+		(void)snprintf(buf, pos, "%s%c-c%c%s", PATH_SHELL, '\0', '\0',
+		    exec);
+		argv = make_argv(buf, pos, 3);
+		free(buf); free(exec);
+
+		return (argv);
+	}
+	if (quoted) {
+		seterr("Unterminated quote in Exec value");
+		goto error;
+	}
+	if (in_arg) {
+		if (buf_append(&buf, &bufsz, &pos, "", 1) == -1)
+			goto error;
+		argc++;
+	}
+	if (argc == 0) {
+		seterr("Exec value is empty");
+		goto error;
+	}
+	argv = make_argv(buf, pos, argc);
+	free(buf);
+
+	return (argv);
+error:
+	free(buf);
+	free(exec);
+
+	return (NULL);
+}
+
+/*
+ * Return true if the given entry was added after the last save.
+ */
+static bool
+entry_new(const dsbautostart_t *as, const entry_t *entry)
+{
+	entry_t *ep;
+
+	for (ep = as->prev_entries; ep != NULL; ep = ep->next) {
+		if (ep->id == entry->id)
+			return (false);
+	}
+	return (true);
+}
+
 static bool
 entry_changed(const dsbautostart_t *as, const entry_t *entry)
 {
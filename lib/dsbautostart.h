@@ -31,24 +31,73 @@ extern "C" {
 
 #define PATH_ASFILE "autostart.sh"
 
+/*
+ * Set of desktop environment names. Each name seen in OnlyShowIn,
+ * NotShowIn, or XDG_CURRENT_DESKTOP is assigned a bit.
+ */
+typedef unsigned long long desktop_set_t;
+
 typedef enum {
 	DF_KEY_NAME, DF_KEY_COMMENT, DF_KEY_EXEC, DF_KEY_HIDDEN,
-	DF_KEY_TERMINAL, DF_KEY_NOT_SHOW_IN, DF_KEY_ONLY_SHOW_IN
+	DF_KEY_TERMINAL, DF_KEY_NOT_SHOW_IN, DF_KEY_ONLY_SHOW_IN,
+	DF_KEY_TRY_EXEC, DF_KEY_AFTER, DF_KEY_REQUIRES, DF_KEY_READY,
+	DF_KEY_RESTART, DF_KEY_NICE, DF_KEY_IO_CLASS, DF_KEY_IO_PRIORITY,
+	DF_KEY_CPU_AFFINITY, DF_KEY_CGROUP, DF_KEY_CPU_WEIGHT,
+	DF_KEY_MEMORY_HIGH, DF_KEY_BACKGROUND, DF_KEY_ALLOW_MULTIPLE,
+	DF_KEY_NEEDS_DISPLAY
 } df_key_t;
 
+/*
+ * The bytes of a desktop file as read from disk. See df_parse().
+ */
+typedef struct df_doc_s df_doc_t;
+
 typedef struct desktop_file_s {
 	int  prio;
 	char *type;
 	char *name;
 	char *comment;
 	char *exec;
+	char *try_exec;
 	char *path;
 	char *only_show_in;
 	char *not_show_in;
+	char *after;	/* X-DSB-After: Start after these desktop file IDs */
+	char *require;	/* X-DSB-Requires: Like After, but mandatory */
+	char *ready;	/* X-DSB-Ready: "spawn" (default), or "exit" */
+	char *restart;	/* X-DSB-Restart: "never", "on-failure", "always" */
+	char *nice;	/* X-DSB-Nice: -20 ... 19 */
+	char *io_class;	/* X-DSB-IOClass: "idle", "best-effort", "realtime" */
+	char *io_prio;	/* X-DSB-IOPriority: 0 ... 7 */
+	char *cpu_affinity; /* X-DSB-CPUAffinity: E.g., "0-3;6" */
+	char *cgroup;	/* X-DSB-CGroup: Name of the cgroup to run in */
+	char *cpu_weight; /* X-DSB-CPUWeight: 1 ... 10000 */
+	char *memory_high; /* X-DSB-MemoryHigh: Bytes with K, M, G suffix */
+	char *background; /* X-DSB-Background: "true" to start when idle */
+	char *allow_multiple; /* X-DSB-AllowMultiple: "true" to start even
+				 if already running */
+	char *needs_display; /* X-DSB-NeedsDisplay: "true" to wait for the
+				X11 or Wayland server */
+	desktop_set_t only_show_in_set; /* Tokenized OnlyShowIn */
+	desktop_set_t not_show_in_set;	/* Tokenized NotShowIn */
+	char *local_name; /* Name[<locale>] best matching the user's locale */
+	char *local_comment; /* Comment[<locale>] */
 	bool hidden;
 	bool terminal;
+	bool shell;	/* Exec must be run by /bin/sh -c */
+	char **argv;	/* Cached tokenized Exec. See dsbautostart_df_argv() */
+	df_doc_t *doc;	/* Original file, NULL for a new desktop file */
 } desktop_file_t;
 
+/*
+ * A [Desktop Action <id>] group. See dsbautostart_df_actions().
+ */
+typedef struct df_action_s {
+	char		   *id;
+	char		   *name;
+	char		   *exec;
+	struct df_action_s *next;
+} df_action_t;
 typedef struct entry_s {
 	int	       id;
 	bool	       deleted;
@@ -67,6 +116,7 @@ typedef struct hist_entry_s {
 	action_t       action;
 	desktop_file_t *df0;
 	desktop_file_t *df1;
+	unsigned       txn;	/* Records of a transaction share an ID > 0 */
 	struct hist_entry_s *next;
 	struct hist_entry_s *prev;
 } hist_entry_t;
@@ -78,14 +128,72 @@ typedef struct change_history_s {
 	hist_entry_t *head;
 	hist_entry_t *tail;
 	hist_entry_t *idx;
+	unsigned     txn;	/* Transaction ID given to new records */
 } change_history_t;
 
+/*
+ * What dsbautostart_save() does with a file changed by another program
+ * since it was read.
+ */
+typedef enum {
+	CONFLICT_FAIL,		/* Write nothing. See dsbautostart_conflict() */
+	CONFLICT_RELOAD,	/* Keep the other program's version */
+	CONFLICT_MERGE,		/* Apply only the keys we changed to it */
+	CONFLICT_OVERWRITE	/* Replace it by our version */
+} conflict_policy_t;
+
+/*
+ * An open transaction. See dsbautostart_begin().
+ */
+typedef struct txn_s txn_t;
+
 typedef struct dsbautostart_s {
 	entry_t		 *prev_entries;
 	entry_t		 *cur_entries;
 	change_history_t *hist;
+	txn_t		 *txn;
+	conflict_policy_t policy;
 } dsbautostart_t;
 
+typedef enum {
+	STATS_PHASE_INIT,	/* dsbautostart_init() */
+	STATS_PHASE_SCAN,	/* Reading an autostart directory */
+	STATS_PHASE_PARSE,	/* Reading a desktop file */
+	STATS_PHASE_COMPARE,	/* dsbautostart_changed() */
+	STATS_PHASE_SAVE,	/* dsbautostart_save() */
+	STATS_NPHASES
+} stats_phase_t;
+
+typedef enum {
+	STATS_MEM_DF,		/* Desktop files and their values */
+	STATS_MEM_ENTRIES,	/* Entry lists */
+	STATS_MEM_HISTORY,	/* Undo/redo records */
+	STATS_MEM_OTHER,	/* Desktop file lists */
+	STATS_NMEM
+} stats_mem_t;
+
+/*
+ * Counters are totals since the start of the process, except for the
+ * history, which is measured by dsbautostart_stats(), and the file
+ * operations of the last save.
+ */
+typedef struct dsbautostart_stats_s {
+	unsigned long	   dirs_scanned;
+	unsigned long	   files_opened;
+	unsigned long	   files_parsed;
+	unsigned long long bytes_read;
+	unsigned long	   allocs[STATS_NMEM];
+	unsigned long long alloc_bytes[STATS_NMEM];
+	unsigned long	   hist_depth;	  /* # of undo/redo records */
+	unsigned long long hist_bytes;	  /* Memory held by them */
+	unsigned long	   files_written; /* By the last save */
+	unsigned long	   files_renamed;
+	unsigned long	   files_deleted;
+	unsigned long	   phase_calls[STATS_NPHASES];
+	unsigned long long phase_us[STATS_NPHASES]; /* Monotonic time spent */
+	unsigned long	   spans_dropped; /* Trace spans beyond the limit */
+} dsbautostart_stats_t;
+
 int		dsbautostart_read_desktop_files(dsbautostart_t *);
 int		dsbautostart_df_del(const char *);
 int		dsbautostart_df_set_key(desktop_file_t *, df_key_t,
@@ -93,19 +201,61 @@ int		dsbautostart_df_set_key(desktop_file_t *, df_key_t,
 int		dsbautostart_entry_set(dsbautostart_t *, entry_t *,
 			const char *, const char *, const char *,
 			const char *, const char *, bool);
+int		dsbautostart_entry_set_df(dsbautostart_t *, entry_t *,
+			desktop_file_t *);
 int		dsbautostart_save(dsbautostart_t *);
+int		dsbautostart_begin(dsbautostart_t *);
+int		dsbautostart_commit(dsbautostart_t *);
+int		dsbautostart_exec_check(const char *);
+int		dsbautostart_build_path_index(bool);
+int		dsbautostart_update_path_index(void);
+int		dsbautostart_df_exclude_rule(const desktop_file_t *);
+int		dsbautostart_stats_write_trace(const char *);
+int		dsbautostart_stats_write_metrics(const char *);
+void		dsbautostart_stats_dump(const dsbautostart_t *);
 void		dsbautostart_undo(dsbautostart_t *);
 void		dsbautostart_redo(dsbautostart_t *);
+void		dsbautostart_rollback(dsbautostart_t *);
+void		dsbautostart_set_conflict_policy(dsbautostart_t *,
+			conflict_policy_t);
+void		dsbautostart_set_read_keys(const df_key_t *, size_t);
 bool		dsbautostart_error(void);
+bool		dsbautostart_conflict(void);
 bool		dsbautostart_can_undo(const dsbautostart_t *);
 bool		dsbautostart_can_redo(const dsbautostart_t *);
 bool		dsbautostart_changed(const dsbautostart_t *);
+bool		dsbautostart_df_need_shell(desktop_file_t *);
+bool		dsbautostart_df_available(desktop_file_t *);
+bool		dsbautostart_df_shown_in(const desktop_file_t *,
+			desktop_set_t);
+char		*dsbautostart_cache_path(const char *);
+char		*dsbautostart_log_path(const desktop_file_t *);
+char		*dsbautostart_df_program(desktop_file_t *);
+char		*dsbautostart_df_lookup(const char *);
+char		**dsbautostart_df_argv(desktop_file_t *);
 entry_t		*dsbautostart_entry_del(dsbautostart_t *, entry_t *);
 entry_t		*dsbautostart_df_add(dsbautostart_t *, const char *);
 entry_t		*dsbautostart_entry_add(dsbautostart_t *, const char *cmd,
 			const char *name, const char *comment, const char *,
 			const char *, bool terminal);
+entry_t		*dsbautostart_entry_add_df(dsbautostart_t *,
+			desktop_file_t *);
+void		dsbautostart_df_free(desktop_file_t *);
+void		dsbautostart_free(dsbautostart_t *);
+void		dsbautostart_df_free_actions(df_action_t *);
 const char	*dsbautostart_strerror(void);
+const dsbautostart_stats_t *dsbautostart_stats(const dsbautostart_t *);
+const char	*dsbautostart_df_key_name(df_key_t);
+const char	*dsbautostart_df_layer(const desktop_file_t *);
+desktop_set_t	dsbautostart_desktop_set(const char *);
+desktop_set_t	dsbautostart_current_desktops(void);
+const char	*dsbautostart_df_name(const desktop_file_t *);
+const char	*dsbautostart_df_comment(const desktop_file_t *);
+const char	*dsbautostart_xdg_dir(int);
+desktop_file_t	*dsbautostart_df_new(void);
+desktop_file_t	*dsbautostart_df_dup(const desktop_file_t *);
+desktop_file_t	*dsbautostart_df_read(const char *);
+df_action_t	*dsbautostart_df_actions(const desktop_file_t *);
 dsbautostart_t	*dsbautostart_init(void);
 #ifdef __cplusplus
 }
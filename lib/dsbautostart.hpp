@@ -0,0 +1,499 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Header-only C++ interface to libdsbautostart.
+ *
+ * Session owns a dsbautostart_t, and frees it when it goes out of scope.
+ * Entry and File are borrowed handles. The string_view accessors of File
+ * point into the library's strings, and are valid until the entry is
+ * changed, or the session is destroyed. Entries are identified by their
+ * ID, which, unlike a pointer, can be kept and looked up again later.
+ *
+ * Edit collects changes to a copy of a desktop file. It is moved into
+ * the session, which takes over the copy.
+ *
+ * Failing operations return an Error, which holds a copy of the message,
+ * instead of leaving it in the library's static buffer.
+ */
+#ifndef _DSBAUTOSTART_HPP_
+#define _DSBAUTOSTART_HPP_
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "dsbautostart.h"
+
+namespace dsbautostart {
+
+class Error {
+public:
+	Error() = default;
+	explicit Error(std::string msg) : failed(true), msg(std::move(msg)) {}
+
+	/*
+	 * Return the error of the last library call, if it failed.
+	 */
+	static Error last() {
+		Error error;
+
+		if (!dsbautostart_error())
+			return (error);
+		error.failed	= true;
+		error._conflict = dsbautostart_conflict();
+		error.msg	= dsbautostart_strerror();
+		return (error);
+	}
+	explicit operator bool() const { return (failed); }
+	bool conflict() const { return (_conflict); }
+	const std::string &message() const { return (msg); }
+	const char *what() const { return (msg.c_str()); }
+private:
+	bool	    failed    = false;
+	bool	    _conflict = false;
+	std::string msg;
+};
+
+/*
+ * The value of an operation which can fail. Use as
+ * auto [value, error] = ...
+ */
+template <typename T>
+struct Result {
+	T     value;
+	Error error;
+};
+
+/*
+ * Borrowed handle to a desktop file. A null handle reads as a desktop
+ * file without any keys set.
+ */
+class File {
+public:
+	File() = default;
+	explicit File(desktop_file_t *df) : df(df) {}
+
+	explicit operator bool() const { return (df != nullptr); }
+	desktop_file_t *get() const { return (df); }
+
+	/*
+	 * Return the value of a string key, or an empty view if it's unset.
+	 */
+	std::string_view value(df_key_t key) const {
+		return (view(field(key)));
+	}
+	bool has(df_key_t key) const { return (field(key) != nullptr); }
+	bool isTrue(df_key_t key) const { return (value(key) == "true"); }
+	bool hidden() const { return (df != nullptr && df->hidden); }
+	bool terminal() const { return (df != nullptr && df->terminal); }
+
+	/*
+	 * Name and Comment in the user's language.
+	 */
+	std::string_view name() const {
+		return (df != nullptr ? view(dsbautostart_df_name(df)) :
+		    std::string_view());
+	}
+	std::string_view comment() const {
+		return (df != nullptr ? view(dsbautostart_df_comment(df)) :
+		    std::string_view());
+	}
+	bool available() const {
+		return (df != nullptr && dsbautostart_df_available(df));
+	}
+	bool shownIn(desktop_set_t desktops) const {
+		return (df != nullptr && dsbautostart_df_shown_in(df, desktops));
+	}
+	Result<std::string> logPath() const {
+		char *path;
+
+		if (df == nullptr)
+			return { {}, Error("No desktop file") };
+		if ((path = dsbautostart_log_path(df)) == nullptr)
+			return { {}, Error::last() };
+		std::string s(path);
+		std::free(path);
+		return { std::move(s), {} };
+	}
+	static std::string_view view(const char *s) {
+		return (s != nullptr ? std::string_view(s) : std::string_view());
+	}
+private:
+	const char *field(df_key_t key) const {
+		if (df == nullptr)
+			return (nullptr);
+		switch (key) {
+		case DF_KEY_NAME:	    return (df->name);
+		case DF_KEY_COMMENT:	    return (df->comment);
+		case DF_KEY_EXEC:	    return (df->exec);
+		case DF_KEY_NOT_SHOW_IN:    return (df->not_show_in);
+		case DF_KEY_ONLY_SHOW_IN:   return (df->only_show_in);
+		case DF_KEY_TRY_EXEC:	    return (df->try_exec);
+		case DF_KEY_AFTER:	    return (df->after);
+		case DF_KEY_REQUIRES:	    return (df->require);
+		case DF_KEY_READY:	    return (df->ready);
+		case DF_KEY_RESTART:	    return (df->restart);
+		case DF_KEY_NICE:	    return (df->nice);
+		case DF_KEY_IO_CLASS:	    return (df->io_class);
+		case DF_KEY_IO_PRIORITY:    return (df->io_prio);
+		case DF_KEY_CPU_AFFINITY:   return (df->cpu_affinity);
+		case DF_KEY_CGROUP:	    return (df->cgroup);
+		case DF_KEY_CPU_WEIGHT:	    return (df->cpu_weight);
+		case DF_KEY_MEMORY_HIGH:    return (df->memory_high);
+		case DF_KEY_BACKGROUND:	    return (df->background);
+		case DF_KEY_ALLOW_MULTIPLE: return (df->allow_multiple);
+		case DF_KEY_NEEDS_DISPLAY:  return (df->needs_display);
+		case DF_KEY_HIDDEN:
+		case DF_KEY_TERMINAL:
+			break;
+		}
+		return (nullptr);
+	}
+private:
+	desktop_file_t *df = nullptr;
+};
+
+/*
+ * Borrowed handle to an entry of a session.
+ */
+class Entry {
+public:
+	Entry() = default;
+	explicit Entry(entry_t *entry) : entry(entry) {}
+
+	explicit operator bool() const { return (entry != nullptr); }
+	entry_t *get() const { return (entry); }
+	int id() const { return (entry != nullptr ? entry->id : -1); }
+	bool excluded() const { return (entry != nullptr && entry->exclude); }
+	File file() const { return (File(entry != nullptr ? entry->df : nullptr)); }
+private:
+	entry_t *entry = nullptr;
+};
+
+/*
+ * Changes to a copy of a desktop file. The first failing change is kept,
+ * and returned by error(). Later changes are ignored.
+ */
+class Edit {
+public:
+	Edit() = default;
+	Edit(Edit &&e) noexcept
+	    : df(std::exchange(e.df, nullptr)), err(std::move(e.err)) {}
+	Edit(const Edit &) = delete;
+	~Edit() { dsbautostart_df_free(df); }
+
+	Edit &operator=(Edit &&e) noexcept {
+		if (this != &e) {
+			dsbautostart_df_free(df);
+			df  = std::exchange(e.df, nullptr);
+			err = std::move(e.err);
+		}
+		return (*this);
+	}
+	Edit &operator=(const Edit &) = delete;
+
+	/*
+	 * Start from a new desktop file, or from a copy of the given one.
+	 */
+	static Edit create() {
+		Edit e;
+
+		if ((e.df = dsbautostart_df_new()) == nullptr)
+			e.err = Error::last();
+		return (e);
+	}
+	static Edit of(File file) {
+		Edit e;
+
+		if (!file)
+			return (create());
+		if ((e.df = dsbautostart_df_dup(file.get())) == nullptr)
+			e.err = Error::last();
+		return (e);
+	}
+
+	/*
+	 * Set a string key. NULL unsets it.
+	 */
+	Edit &set(df_key_t key, const char *val) {
+		if (err || df == nullptr)
+			return (*this);
+		if (isFlag(key) || dsbautostart_df_set_key(df, key, val) == -1)
+			fail(key);
+		return (*this);
+	}
+	Edit &set(df_key_t key, std::string_view val) {
+		return (set(key, std::string(val).c_str()));
+	}
+	Edit &setFlag(df_key_t key, bool val) {
+		if (err || df == nullptr)
+			return (*this);
+		if (!isFlag(key) || dsbautostart_df_set_key(df, key, &val) == -1)
+			fail(key);
+		return (*this);
+	}
+	Edit &unset(df_key_t key) { return (set(key, nullptr)); }
+
+	File file() const { return (File(df)); }
+	const Error &error() const { return (err); }
+
+	/*
+	 * Return the desktop file. The caller takes it over.
+	 */
+	desktop_file_t *release() { return (std::exchange(df, nullptr)); }
+private:
+	/*
+	 * dsbautostart_df_set_key() takes a bool * for these keys, and a
+	 * string for all others.
+	 */
+	static bool isFlag(df_key_t key) {
+		return (key == DF_KEY_HIDDEN || key == DF_KEY_TERMINAL);
+	}
+	void fail(df_key_t key) {
+		err = dsbautostart_error() ? Error::last() :
+		    Error(std::string("Invalid value for ") +
+			dsbautostart_df_key_name(key));
+	}
+private:
+	desktop_file_t *df = nullptr;
+	Error	       err;
+};
+
+/*
+ * An open transaction. It's rolled back when it goes out of scope
+ * without being committed. See dsbautostart_begin().
+ */
+class Transaction {
+public:
+	Transaction() = default;
+	explicit Transaction(dsbautostart_t *as) : as(as) {}
+	Transaction(Transaction &&t) noexcept
+	    : as(std::exchange(t.as, nullptr)) {}
+	Transaction(const Transaction &) = delete;
+	~Transaction() { rollback(); }
+
+	Transaction &operator=(Transaction &&t) noexcept {
+		if (this != &t) {
+			rollback();
+			as = std::exchange(t.as, nullptr);
+		}
+		return (*this);
+	}
+	Transaction &operator=(const Transaction &) = delete;
+
+	Error commit() {
+		if (as == nullptr)
+			return (Error("No transaction is open"));
+		if (dsbautostart_commit(std::exchange(as, nullptr)) == -1)
+			return (Error::last());
+		return (Error());
+	}
+	void rollback() {
+		if (as != nullptr)
+			dsbautostart_rollback(std::exchange(as, nullptr));
+	}
+private:
+	dsbautostart_t *as = nullptr;
+};
+
+/*
+ * The entries of a session which are not deleted.
+ */
+class Entries {
+public:
+	class iterator {
+	public:
+		explicit iterator(entry_t *entry) : entry(skip(entry)) {}
+		Entry operator*() const { return (Entry(entry)); }
+		iterator &operator++() {
+			entry = skip(entry->next);
+			return (*this);
+		}
+		bool operator!=(const iterator &it) const {
+			return (entry != it.entry);
+		}
+	private:
+		static entry_t *skip(entry_t *entry) {
+			while (entry != nullptr && entry->deleted)
+				entry = entry->next;
+			return (entry);
+		}
+	private:
+		entry_t *entry;
+	};
+	explicit Entries(entry_t *head) : head(head) {}
+	iterator begin() const { return (iterator(head)); }
+	iterator end() const { return (iterator(nullptr)); }
+private:
+	entry_t *head;
+};
+
+class Session {
+public:
+	Session() = default;
+	Session(Session &&s) noexcept : as(std::exchange(s.as, nullptr)) {}
+	Session(const Session &) = delete;
+	~Session() { dsbautostart_free(as); }
+
+	Session &operator=(Session &&s) noexcept {
+		if (this != &s) {
+			dsbautostart_free(as);
+			as = std::exchange(s.as, nullptr);
+		}
+		return (*this);
+	}
+	Session &operator=(const Session &) = delete;
+
+	/*
+	 * Read the autostart entries.
+	 */
+	static Result<Session> open() {
+		Session s;
+
+		if ((s.as = dsbautostart_init()) == nullptr) {
+			Error error = Error::last();
+			return { Session(), error ? std::move(error) :
+			    Error("dsbautostart_init() failed") };
+		}
+		return { std::move(s), {} };
+	}
+
+	explicit operator bool() const { return (as != nullptr); }
+	dsbautostart_t *get() const { return (as); }
+
+	Entries entries() const {
+		return (Entries(as != nullptr ? as->cur_entries : nullptr));
+	}
+
+	/*
+	 * Look up an entry by its ID. Returns a null handle if there is no
+	 * such entry, or if it was deleted.
+	 */
+	Entry entry(int id) const {
+		for (Entry entry : entries()) {
+			if (entry.id() == id)
+				return (entry);
+		}
+		return (Entry());
+	}
+
+	/*
+	 * Replace the desktop file of the given entry by the edited one.
+	 */
+	Error set(Entry entry, Edit edit) {
+		desktop_file_t *df;
+
+		if (edit.error())
+			return (edit.error());
+		if (!entry)
+			return (Error("No such entry"));
+		df = edit.release();
+		if (dsbautostart_entry_set_df(as, entry.get(), df) == -1) {
+			dsbautostart_df_free(df);
+			return (Error::last());
+		}
+		return (Error());
+	}
+
+	/*
+	 * Add a new entry for the edited desktop file.
+	 */
+	Result<Entry> add(Edit edit) {
+		entry_t *entry;
+
+		if (edit.error())
+			return { Entry(), edit.error() };
+		/* The list may own the file even if adding the record failed */
+		if ((entry = dsbautostart_entry_add_df(as, edit.release())) ==
+		    nullptr)
+			return { Entry(), Error::last() };
+		return { Entry(entry), {} };
+	}
+
+	/*
+	 * Add an entry for the desktop file at the given path. A null
+	 * handle without an error means the file was skipped. See
+	 * dsbautostart_df_add().
+	 */
+	Result<Entry> addFile(const char *path) {
+		entry_t *entry;
+
+		if ((entry = dsbautostart_df_add(as, path)) == nullptr)
+			return { Entry(), Error::last() };
+		return { Entry(entry), {} };
+	}
+
+	Error del(Entry entry) {
+		if (!entry)
+			return (Error("No such entry"));
+		if (dsbautostart_entry_del(as, entry.get()) == nullptr)
+			return (Error::last());
+		return (Error());
+	}
+
+	Result<Transaction> begin() {
+		if (dsbautostart_begin(as) == -1)
+			return { Transaction(), Error::last() };
+		return { Transaction(as), {} };
+	}
+
+	/*
+	 * Write the changes. Files changed by other programs are handled
+	 * according to the given policy. See dsbautostart_save().
+	 */
+	Error save(conflict_policy_t policy = CONFLICT_FAIL) {
+		int ret;
+
+		dsbautostart_set_conflict_policy(as, policy);
+		ret = dsbautostart_save(as);
+		dsbautostart_set_conflict_policy(as, CONFLICT_FAIL);
+		return (ret == -1 ? Error::last() : Error());
+	}
+
+	void undo() { dsbautostart_undo(as); }
+	void redo() { dsbautostart_redo(as); }
+	bool canUndo() const { return (dsbautostart_can_undo(as)); }
+	bool canRedo() const { return (dsbautostart_can_redo(as)); }
+	bool changed() const { return (dsbautostart_changed(as)); }
+	void dumpStats() const {
+		if (as != nullptr)
+			dsbautostart_stats_dump(as);
+	}
+private:
+	dsbautostart_t *as = nullptr;
+};
+
+/*
+ * Check whether the given Exec value is valid.
+ */
+inline Error
+checkExec(const char *exec)
+{
+	if (dsbautostart_exec_check(exec) == -1)
+		return (Error::last());
+	return (Error());
+}
+} // namespace dsbautostart
+#endif // !_DSBAUTOSTART_HPP_
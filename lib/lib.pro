@@ -0,0 +1,19 @@
+include(../config.pri)
+
+#
+# Plain C library shared by the launcher and the GUI. It must not
+# depend on Qt.
+#
+TEMPLATE     = lib
+TARGET	     = dsbautostart
+CONFIG	    += staticlib
+CONFIG	    -= qt
+DEPENDPATH  += .
+INCLUDEPATH += .
+
+HEADERS += dsbautostart.h \
+	   pathindex.h \
+	   stats.h
+SOURCES += dsbautostart.c \
+	   pathindex.c \
+	   stats.c
@@ -0,0 +1,398 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Index of the executables found in the directories of $PATH. The index
+ * is built once per run, and pathidx_update() re-reads the directories
+ * which changed since. If a cache file is given, the file names of
+ * directories whose mtime didn't change since the cache was written are
+ * taken from the cache instead of reading the directory.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pathindex.h"
+
+#define CACHE_MAGIC "dsbautostart-pathindex 1"
+#define MAX_DIRS    64
+
+struct pidx_dir_s {
+	char	*path;
+	char	*names;		/* '\0'-separated list of file names */
+	bool	from_cache;
+	size_t	len;
+	time_t	mtime;
+	long	mtime_ns;
+};
+
+struct pidx_slot_s {
+	int	 dir;
+	uint32_t hash;
+	const char *name;
+};
+
+static int	   ndirs;
+static bool	   built;
+static size_t	   nslots;
+static struct pidx_dir_s  dirs[MAX_DIRS];
+static struct pidx_slot_s *slots;
+
+static int	   read_dir(struct pidx_dir_s *);
+static int	   load_cache(const char *);
+static int	   save_cache(const char *);
+static int	   add_name(struct pidx_dir_s *, const char *, size_t);
+static int	   create_table(void);
+static uint32_t	   hash(const char *);
+
+bool
+pathidx_built()
+{
+	return (built);
+}
+
+int
+pathidx_build(const char *cachefile)
+{
+	int	    i;
+	char	    *path, *dir, *last;
+	bool	    changed;
+	const char  *p;
+	struct stat sb;
+
+	if (built)
+		return (0);
+	if ((p = getenv("PATH")) == NULL)
+		p = "/bin:/usr/bin:/usr/local/bin";
+	if ((path = strdup(p)) == NULL)
+		return (-1);
+	for (dir = path; (dir = strtok_r(dir, ":", &last)) != NULL &&
+	    ndirs < MAX_DIRS; dir = NULL) {
+		if (*dir != '/' || stat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode))
+			continue;
+		for (i = 0; i < ndirs && strcmp(dirs[i].path, dir) != 0; i++)
+			;
+		if (i < ndirs)
+			continue;
+		if ((dirs[ndirs].path = strdup(dir)) == NULL) {
+			free(path);
+			return (-1);
+		}
+		dirs[ndirs].mtime    = sb.st_mtim.tv_sec;
+		dirs[ndirs].mtime_ns = sb.st_mtim.tv_nsec;
+		ndirs++;
+	}
+	free(path);
+	if (cachefile != NULL)
+		(void)load_cache(cachefile);
+	for (i = 0, changed = false; i < ndirs; i++) {
+		if (dirs[i].from_cache)
+			continue;
+		if (read_dir(&dirs[i]) == -1)
+			return (-1);
+		changed = true;
+	}
+	if (create_table() == -1)
+		return (-1);
+	if (cachefile != NULL && changed)
+		(void)save_cache(cachefile);
+	built = true;
+
+	return (0);
+}
+
+/*
+ * Read the directories whose mtime changed since the index was built or
+ * updated again, e.g., because a package was installed in the meantime.
+ * The directories of $PATH are not looked up again.
+ */
+int
+pathidx_update(const char *cachefile)
+{
+	int	    i, ret;
+	bool	    changed;
+	struct stat sb;
+
+	if (!built)
+		return (pathidx_build(cachefile));
+	for (i = ret = 0, changed = false; i < ndirs && ret == 0; i++) {
+		if (stat(dirs[i].path, &sb) == -1 ||
+		    (sb.st_mtim.tv_sec == dirs[i].mtime &&
+		    sb.st_mtim.tv_nsec == dirs[i].mtime_ns))
+			continue;
+		dirs[i].len = 0;
+		if ((ret = read_dir(&dirs[i])) == 0) {
+			dirs[i].mtime	 = sb.st_mtim.tv_sec;
+			dirs[i].mtime_ns = sb.st_mtim.tv_nsec;
+		}
+		changed = true;
+	}
+	if (!changed)
+		return (0);
+	/* The table points into the lists of names. */
+	free(slots);
+	if (create_table() == -1) {
+		slots  = NULL;
+		nslots = 0;
+		return (-1);
+	}
+	if (cachefile != NULL && ret == 0)
+		(void)save_cache(cachefile);
+	return (ret);
+}
+
+/*
+ * Return the directory containing the executable of the given name, or
+ * NULL if there is none.
+ */
+const char *
+pathidx_lookup(const char *name)
+{
+	size_t	 i;
+	uint32_t h;
+
+	if (!built || nslots == 0)
+		return (NULL);
+	h = hash(name);
+	for (i = h & (nslots - 1); slots[i].name != NULL;
+	    i = (i + 1) & (nslots - 1)) {
+		if (slots[i].hash == h && strcmp(slots[i].name, name) == 0)
+			return (dirs[slots[i].dir].path);
+	}
+	return (NULL);
+}
+
+static uint32_t
+hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char)*s;
+		h *= 16777619u;
+	}
+	return (h);
+}
+
+static int
+add_name(struct pidx_dir_s *dir, const char *name, size_t len)
+{
+	char *p;
+
+	if ((p = realloc(dir->names, dir->len + len + 1)) == NULL)
+		return (-1);
+	dir->names = p;
+	(void)memcpy(dir->names + dir->len, name, len);
+	dir->len += len;
+	dir->names[dir->len++] = '\0';
+
+	return (0);
+}
+
+/*
+ * Add all non-directory entries of the given directory. Entries are not
+ * stat()ed. Whether a found file is executable is checked on lookup.
+ */
+static int
+read_dir(struct pidx_dir_s *dir)
+{
+	DIR	      *dirp;
+	struct dirent *dp;
+
+	if ((dirp = opendir(dir->path)) == NULL)
+		return (errno == ENOENT || errno == EACCES ? 0 : -1);
+	while ((dp = readdir(dirp)) != NULL) {
+		if (dp->d_name[0] == '.' || dp->d_type == DT_DIR)
+			continue;
+		if (add_name(dir, dp->d_name, strlen(dp->d_name)) == -1) {
+			(void)closedir(dirp);
+			return (-1);
+		}
+	}
+	(void)closedir(dirp);
+
+	return (0);
+}
+
+static int
+create_table()
+{
+	int	 i;
+	size_t	 n, j;
+	uint32_t h;
+	const char *p;
+
+	for (i = 0, n = 0; i < ndirs; i++) {
+		for (p = dirs[i].names; p < dirs[i].names + dirs[i].len;
+		    p += strlen(p) + 1)
+			n++;
+	}
+	for (nslots = 16; nslots < 2 * n; nslots <<= 1)
+		;
+	if ((slots = calloc(nslots, sizeof(*slots))) == NULL)
+		return (-1);
+	/* Directories listed first in $PATH take precedence. */
+	for (i = 0; i < ndirs; i++) {
+		for (p = dirs[i].names; p < dirs[i].names + dirs[i].len;
+		    p += strlen(p) + 1) {
+			h = hash(p);
+			for (j = h & (nslots - 1); slots[j].name != NULL;
+			    j = (j + 1) & (nslots - 1)) {
+				if (slots[j].hash == h &&
+				    strcmp(slots[j].name, p) == 0)
+					break;
+			}
+			if (slots[j].name != NULL)
+				continue;
+			slots[j].name = p;
+			slots[j].hash = h;
+			slots[j].dir  = i;
+		}
+	}
+	return (0);
+}
+
+/*
+ * The cache file consists of a magic line, followed by one
+ * "D<TAB>mtime<TAB>mtime_ns<TAB>path" line per directory, each followed
+ * by one "F<TAB>name" line per file. Directories whose mtime changed are
+ * ignored. A corrupt cache is ignored as a whole.
+ */
+static int
+load_cache(const char *cachefile)
+{
+	int	  i;
+	FILE	  *fp;
+	char	  *ln, *p, *path;
+	long	  ns;
+	size_t	  lncap;
+	ssize_t	  len;
+	long long sec;
+	struct pidx_dir_s *cur;
+
+	if ((fp = fopen(cachefile, "r")) == NULL)
+		return (-1);
+	ln = NULL; lncap = 0; cur = NULL;
+	if (getline(&ln, &lncap, fp) <= 0 || strcmp(ln, CACHE_MAGIC "\n") != 0)
+		goto error;
+	while ((len = getline(&ln, &lncap, fp)) > 0) {
+		if (ln[len - 1] != '\n')
+			goto error;
+		ln[--len] = '\0';
+		if (ln[0] == 'F' && ln[1] == '\t') {
+			if (cur != NULL && add_name(cur, ln + 2, len - 2) == -1)
+				goto error;
+			continue;
+		}
+		if (ln[0] != 'D' || ln[1] != '\t')
+			goto error;
+		cur = NULL;
+		sec = strtoll(ln + 2, &p, 10);
+		if (*p++ != '\t')
+			goto error;
+		ns = strtol(p, &path, 10);
+		if (*path++ != '\t')
+			goto error;
+		for (i = 0; i < ndirs; i++) {
+			if (strcmp(dirs[i].path, path) != 0)
+				continue;
+			if (dirs[i].mtime == sec && dirs[i].mtime_ns == ns &&
+			    !dirs[i].from_cache) {
+				cur = &dirs[i];
+				cur->from_cache = true;
+			}
+			break;
+		}
+	}
+	free(ln);
+	(void)fclose(fp);
+
+	return (0);
+error:
+	/* Throw away everything we got from the corrupt cache. */
+	for (i = 0; i < ndirs; i++) {
+		if (!dirs[i].from_cache)
+			continue;
+		free(dirs[i].names);
+		dirs[i].names = NULL;
+		dirs[i].len = 0;
+		dirs[i].from_cache = false;
+	}
+	free(ln);
+	(void)fclose(fp);
+
+	return (-1);
+}
+
+static int
+save_cache(const char *cachefile)
+{
+	int	   i, fd;
+	FILE	   *fp;
+	char	   *tmp;
+	size_t	   len;
+	const char *p;
+
+	len = strlen(cachefile) + sizeof(".XXXXXX");
+	if ((tmp = malloc(len)) == NULL)
+		return (-1);
+	(void)snprintf(tmp, len, "%s.XXXXXX", cachefile);
+	if ((fd = mkstemp(tmp)) == -1) {
+		free(tmp);
+		return (-1);
+	}
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		(void)close(fd);
+		goto error;
+	}
+	(void)fprintf(fp, "%s\n", CACHE_MAGIC);
+	for (i = 0; i < ndirs; i++) {
+		(void)fprintf(fp, "D\t%lld\t%ld\t%s\n",
+		    (long long)dirs[i].mtime, dirs[i].mtime_ns, dirs[i].path);
+		for (p = dirs[i].names; p < dirs[i].names + dirs[i].len;
+		    p += strlen(p) + 1) {
+			if (strchr(p, '\n') == NULL)
+				(void)fprintf(fp, "F\t%s\n", p);
+		}
+	}
+	if (fclose(fp) != 0 || rename(tmp, cachefile) == -1)
+		goto error;
+	free(tmp);
+
+	return (0);
+error:
+	(void)unlink(tmp);
+	free(tmp);
+
+	return (-1);
+}
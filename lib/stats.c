@@ -0,0 +1,317 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Library statistics. The counters are updated by dsbautostart.c, and
+ * can be read by dsbautostart_stats(), or written as an OpenMetrics text
+ * file, e.g., for the node exporter's textfile collector. If
+ * DSBAUTOSTART_TRACE is set, the phases are also recorded as spans, and
+ * can be written in the Chrome trace event format (chrome://tracing,
+ * Perfetto).
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dsbautostart.h"
+#include "stats.h"
+
+#define ENV_TRACE	"DSBAUTOSTART_TRACE"
+#define ENV_METRICS	"DSBAUTOSTART_METRICS"
+#define SPAN_ARG_MAX	48
+
+typedef struct span_s {
+	char	      arg[SPAN_ARG_MAX];	/* E.g., the file name */
+	long long     ts;
+	long long     dur;
+	stats_phase_t phase;
+} span_t;
+
+dsbautostart_stats_t stats;
+
+static int    nspans;
+static int    tracing = -1;	/* -1 if not determined yet */
+static span_t *spans;
+static long long t_start;	/* Time of the first stats_begin() */
+
+static const char *phase_names[STATS_NPHASES] = {
+	"init", "scan", "parse", "compare", "save"
+};
+static const char *mem_names[STATS_NMEM] = {
+	"desktop_file", "entries", "history", "other"
+};
+
+static FILE *open_tmp(const char *, char **);
+static int  close_tmp(FILE *, char *, const char *);
+static void json_string(FILE *, const char *);
+
+void
+stats_alloc(stats_mem_t mem, size_t size)
+{
+	stats.allocs[mem]++;
+	stats.alloc_bytes[mem] += size;
+}
+
+/*
+ * Return the current monotonic time in microseconds.
+ */
+long long
+stats_begin()
+{
+	long long	now;
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (t_start == 0)
+		t_start = now;
+	return (now);
+}
+
+/*
+ * Add the time since t0 to the given phase, and record a span if tracing
+ * is enabled. "arg" can be NULL.
+ */
+void
+stats_end(stats_phase_t phase, long long t0, const char *arg)
+{
+	span_t	  *sp;
+	long long now;
+
+	now = stats_begin();
+	stats.phase_calls[phase]++;
+	stats.phase_us[phase] += now - t0;
+	if (tracing == -1)
+		tracing = getenv(ENV_TRACE) != NULL;
+	if (!tracing)
+		return;
+	if (spans == NULL &&
+	    (spans = malloc(STATS_MAX_SPANS * sizeof(span_t))) == NULL)
+		tracing = 0;
+	if (!tracing || nspans == STATS_MAX_SPANS) {
+		stats.spans_dropped++;
+		return;
+	}
+	sp = &spans[nspans++];
+	sp->phase = phase;
+	sp->ts	  = t0 - t_start;
+	sp->dur	  = now - t0;
+	(void)snprintf(sp->arg, sizeof(sp->arg), "%s", arg != NULL ? arg : "");
+}
+
+/*
+ * Write the recorded spans as Chrome trace events. Returns -1 with errno
+ * set on error.
+ */
+int
+dsbautostart_stats_write_trace(const char *path)
+{
+	int  i;
+	char *tmp;
+	FILE *fp;
+
+	if ((fp = open_tmp(path, &tmp)) == NULL)
+		return (-1);
+	(void)fprintf(fp, "{\"traceEvents\":[");
+	for (i = 0; i < nspans; i++) {
+		(void)fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"dsbautostart\","
+		    "\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%ld,"
+		    "\"tid\":1", i > 0 ? "," : "", phase_names[spans[i].phase],
+		    spans[i].ts, spans[i].dur, (long)getpid());
+		if (spans[i].arg[0] != '\0') {
+			(void)fprintf(fp, ",\"args\":{\"file\":");
+			json_string(fp, spans[i].arg);
+			(void)fputc('}', fp);
+		}
+		(void)fputc('}', fp);
+	}
+	(void)fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	return (close_tmp(fp, tmp, path));
+}
+
+/*
+ * Write the counters in the OpenMetrics text format. Returns -1 with
+ * errno set on error.
+ */
+int
+dsbautostart_stats_write_metrics(const char *path)
+{
+	int  i;
+	char *tmp;
+	FILE *fp;
+	const struct {
+		const char	   *name;
+		const char	   *help;
+		unsigned long long val;
+	} counters[] = {
+		{ "dirs_scanned", "Autostart directories scanned",
+		  stats.dirs_scanned },
+		{ "files_opened", "Desktop files opened", stats.files_opened },
+		{ "files_parsed", "Desktop files parsed", stats.files_parsed },
+		{ "read_bytes", "Bytes read from desktop files",
+		  stats.bytes_read }
+	}, gauges[] = {
+		{ "history_depth", "Undo/redo records", stats.hist_depth },
+		{ "history_bytes", "Memory held by undo/redo records",
+		  stats.hist_bytes },
+		{ "save_files_written", "Files written by the last save",
+		  stats.files_written },
+		{ "save_files_renamed", "Files renamed by the last save",
+		  stats.files_renamed },
+		{ "save_files_deleted", "Files deleted by the last save",
+		  stats.files_deleted }
+	};
+
+	if ((fp = open_tmp(path, &tmp)) == NULL)
+		return (-1);
+	for (i = 0; i < (int)(sizeof(counters) / sizeof(counters[0])); i++) {
+		(void)fprintf(fp, "# TYPE dsbautostart_%s counter\n"
+		    "# HELP dsbautostart_%s %s.\ndsbautostart_%s_total %llu\n",
+		    counters[i].name, counters[i].name, counters[i].help,
+		    counters[i].name, counters[i].val);
+	}
+	for (i = 0; i < (int)(sizeof(gauges) / sizeof(gauges[0])); i++) {
+		(void)fprintf(fp, "# TYPE dsbautostart_%s gauge\n"
+		    "# HELP dsbautostart_%s %s.\ndsbautostart_%s %llu\n",
+		    gauges[i].name, gauges[i].name, gauges[i].help,
+		    gauges[i].name, gauges[i].val);
+	}
+	(void)fprintf(fp, "# TYPE dsbautostart_allocs counter\n"
+	    "# HELP dsbautostart_allocs Allocations per subsystem.\n");
+	for (i = 0; i < STATS_NMEM; i++) {
+		(void)fprintf(fp, "dsbautostart_allocs_total{subsystem=\"%s\"} "
+		    "%lu\n", mem_names[i], stats.allocs[i]);
+	}
+	(void)fprintf(fp, "# TYPE dsbautostart_alloc_bytes counter\n"
+	    "# UNIT dsbautostart_alloc_bytes bytes\n"
+	    "# HELP dsbautostart_alloc_bytes Bytes allocated per subsystem.\n");
+	for (i = 0; i < STATS_NMEM; i++) {
+		(void)fprintf(fp, "dsbautostart_alloc_bytes_total"
+		    "{subsystem=\"%s\"} %llu\n", mem_names[i],
+		    stats.alloc_bytes[i]);
+	}
+	(void)fprintf(fp, "# TYPE dsbautostart_phase_seconds counter\n"
+	    "# UNIT dsbautostart_phase_seconds seconds\n"
+	    "# HELP dsbautostart_phase_seconds Time spent per phase.\n");
+	for (i = 0; i < STATS_NPHASES; i++) {
+		(void)fprintf(fp, "dsbautostart_phase_seconds_total"
+		    "{phase=\"%s\"} %.6f\n", phase_names[i],
+		    stats.phase_us[i] / 1e6);
+	}
+	(void)fprintf(fp, "# TYPE dsbautostart_phase_calls counter\n"
+	    "# HELP dsbautostart_phase_calls Times each phase was run.\n");
+	for (i = 0; i < STATS_NPHASES; i++) {
+		(void)fprintf(fp, "dsbautostart_phase_calls_total"
+		    "{phase=\"%s\"} %lu\n", phase_names[i],
+		    stats.phase_calls[i]);
+	}
+	(void)fprintf(fp, "# EOF\n");
+
+	return (close_tmp(fp, tmp, path));
+}
+
+/*
+ * Write the trace and metrics files named by DSBAUTOSTART_TRACE and
+ * DSBAUTOSTART_METRICS, if set. Failures are ignored.
+ */
+void
+dsbautostart_stats_dump(const dsbautostart_t *as)
+{
+	const char *path;
+
+	(void)dsbautostart_stats(as);
+	if ((path = getenv(ENV_TRACE)) != NULL && *path != '\0')
+		(void)dsbautostart_stats_write_trace(path);
+	if ((path = getenv(ENV_METRICS)) != NULL && *path != '\0')
+		(void)dsbautostart_stats_write_metrics(path);
+}
+
+/*
+ * Open a temporary file next to the given path, so that readers never see
+ * a partially written file.
+ */
+static FILE *
+open_tmp(const char *path, char **tmp)
+{
+	int    fd, saved_errno;
+	FILE   *fp;
+	size_t len;
+
+	len = strlen(path) + sizeof(".XXXXXX");
+	if ((*tmp = malloc(len)) == NULL)
+		return (NULL);
+	(void)snprintf(*tmp, len, "%s.XXXXXX", path);
+	if ((fd = mkstemp(*tmp)) == -1) {
+		free(*tmp);
+		return (NULL);
+	}
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		saved_errno = errno;
+		(void)close(fd);
+		(void)unlink(*tmp);
+		free(*tmp);
+		errno = saved_errno;
+	}
+	return (fp);
+}
+
+static int
+close_tmp(FILE *fp, char *tmp, const char *path)
+{
+	int saved_errno;
+
+	/* Let the textfile collector, which runs as another user, read it. */
+	(void)fchmod(fileno(fp), 0644);
+	if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+		saved_errno = errno;
+		(void)unlink(tmp);
+		free(tmp);
+		errno = saved_errno;
+		return (-1);
+	}
+	free(tmp);
+
+	return (0);
+}
+
+static void
+json_string(FILE *fp, const char *str)
+{
+	(void)fputc('"', fp);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			(void)fprintf(fp, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			(void)fprintf(fp, "\\u%04x", *str);
+		else
+			(void)fputc(*str, fp);
+	}
+	(void)fputc('"', fp);
+}
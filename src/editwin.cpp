@@ -23,13 +23,31 @@
  */
 
 #include <QFormLayout>
+#include <stdlib.h>
 
 #include "editwin.h"
 #include "qt-helper/qt-helper.h"
 
-EditWin::EditWin(entry_t *entry, QWidget *parent) : 
+using dsbautostart::File;
+
+static QString
+qstr(std::string_view s)
+{
+	return (QString::fromUtf8(s.data(), (int)s.size()));
+}
+
+/*
+ * Return the string, or NULL if it's empty, which unsets a key.
+ */
+static const char *
+orNull(const QByteArray &s)
+{
+	return (s.isEmpty() ? NULL : s.constData());
+}
+
+EditWin::EditWin(dsbautostart::Entry entry, QWidget *parent) : 
     QDialog(parent) {
-	QString list;
+	File file	    = entry.file();
 	QIcon winIcon	    = qh_loadIcon("edit", 0);
 	QIcon okIcon	    = qh_loadStockIcon(QStyle::SP_DialogOkButton, 0);
 	QIcon cancelIcon    = qh_loadStockIcon(QStyle::SP_DialogCancelButton,
@@ -41,29 +59,17 @@ EditWin::EditWin(entry_t *entry, QWidget *parent) :
 	QHBoxLayout *bbox   = new QHBoxLayout;
 	QFormLayout *form   = new QFormLayout;
 
-	name = command = comment = NULL;
-	terminal = false;
-
-	if (entry != NULL && entry->df->name != NULL)
-		name_edit = new QLineEdit(entry->df->name);
-	else
-		name_edit = new QLineEdit("");
-	if (entry != NULL && entry->df->exec != NULL)
-		command_edit = new QLineEdit(entry->df->exec);
-	else
-		command_edit = new QLineEdit("");
-	if (entry != NULL && entry->df->comment != NULL)
-		comment_edit = new QLineEdit(entry->df->comment);
-	else
-		comment_edit = new QLineEdit("");
-	terminal_cb = new QCheckBox(tr("Run in terminal"));
+	edit = dsbautostart::Edit::of(file);
+	if (edit.error())
+		qh_errx(parent, EXIT_FAILURE, "%s", edit.error().what());
 
-	if (entry != NULL)
-		terminal_cb->setChecked(entry->df->terminal);
-	else
-		terminal_cb->setChecked(false);
+	name_edit    = new QLineEdit(qstr(file.value(DF_KEY_NAME)));
+	command_edit = new QLineEdit(qstr(file.value(DF_KEY_EXEC)));
+	comment_edit = new QLineEdit(qstr(file.value(DF_KEY_COMMENT)));
+	terminal_cb  = new QCheckBox(tr("Run in terminal"));
+	terminal_cb->setChecked(file.terminal());
 	setWindowIcon(winIcon);
-	if (entry != NULL)
+	if (entry)
 		setWindowTitle(tr("Edit"));
 	else
 		setWindowTitle(tr("New"));
@@ -73,7 +79,9 @@ EditWin::EditWin(entry_t *entry, QWidget *parent) :
 	form->addRow(tr("Comment"), comment_edit);
 
 	layout->addLayout(form);
-	layout->addWidget(createVisibilityBox(entry));
+	layout->addWidget(createVisibilityBox(file));
+	layout->addWidget(createDependencyBox(file));
+	layout->addWidget(createResourceBox(file));
 	layout->addWidget(terminal_cb);
 	layout->addStretch(1);
 
@@ -84,8 +92,6 @@ EditWin::EditWin(entry_t *entry, QWidget *parent) :
 
 	connect(command_edit, SIGNAL(textChanged(const QString &)),
 	    this, SLOT(validate()));
-	connect(terminal_cb, SIGNAL(stateChanged(int)),
-	    this, SLOT(terminalToggled(int)));
 	connect(ok_pb, SIGNAL(clicked()), this, SLOT(acceptSlot()));
 	connect(cancel, SIGNAL(clicked()), this, SLOT(reject()));
 	if (parent) {
@@ -96,40 +102,90 @@ EditWin::EditWin(entry_t *entry, QWidget *parent) :
 	validate();
 }
 
+/*
+ * Return the changes to the desktop file. They can be applied to the
+ * session once.
+ */
+dsbautostart::Edit
+EditWin::takeEdit()
+{
+	return (std::move(edit));
+}
+
 void
 EditWin::validate()
 {
-	QString msg = "";
+	QString		    msg = "";
+	dsbautostart::Error error;
 
 	if (command_edit->text().length() < 1) {
 		ok_pb->setEnabled(false);
 		msg = tr("Command field must not be empty");
+	} else if ((error = dsbautostart::checkExec(
+	    command_edit->text().toLocal8Bit().constData()))) {
+		ok_pb->setEnabled(false);
+		msg = QString(error.what());
 	} else
 		ok_pb->setEnabled(true);
 	statusBar->showMessage(msg);
 }
 
-void
-EditWin::terminalToggled(int state)
-{
-	terminal = (state == Qt::Unchecked ? false : true);
-}
-
 void
 EditWin::acceptSlot(void)
 {
-	name	= QString(name_edit->text()).toLocal8Bit();
-	command	= QString(command_edit->text()).toLocal8Bit();
-	comment = QString(comment_edit->text()).toLocal8Bit();
-	if (nsi_rb->isChecked())
-		notShowIn = QString(list_le->text()).toLocal8Bit();
-	else if (osi_rb->isChecked())
-		onlyShowIn = QString(list_le->text()).toLocal8Bit();
+	QByteArray name	       = name_edit->text().toLocal8Bit();
+	QByteArray command     = command_edit->text().toLocal8Bit();
+	QByteArray comment     = comment_edit->text().toLocal8Bit();
+	QByteArray desktops    = list_le->text().toLocal8Bit();
+	QByteArray after       = after_edit->text().toLocal8Bit();
+	QByteArray require     = requires_edit->text().toLocal8Bit();
+	QByteArray io_class    = io_class_cb->currentData().toString()
+				     .toLocal8Bit();
+	QByteArray affinity    = affinity_edit->text().toLocal8Bit();
+	QByteArray cgroup      = cgroup_edit->text().toLocal8Bit();
+	QByteArray memory_high = memory_high_edit->text().toLocal8Bit();
+
+	/* The minimum of each spin box means "not set". */
+	QByteArray nice = nice_sb->value() == nice_sb->minimum() ?
+	    QByteArray() : QByteArray::number(nice_sb->value());
+	QByteArray io_prio = io_prio_sb->value() == io_prio_sb->minimum() ?
+	    QByteArray() : QByteArray::number(io_prio_sb->value());
+	QByteArray cpu_weight =
+	    cpu_weight_sb->value() == cpu_weight_sb->minimum() ?
+	    QByteArray() : QByteArray::number(cpu_weight_sb->value());
+
+	edit.set(DF_KEY_NAME, name.constData())
+	    .set(DF_KEY_EXEC, command.constData())
+	    .set(DF_KEY_COMMENT, comment.constData())
+	    .setFlag(DF_KEY_TERMINAL, terminal_cb->isChecked())
+	    .set(DF_KEY_NOT_SHOW_IN, nsi_rb->isChecked() ?
+		orNull(desktops) : NULL)
+	    .set(DF_KEY_ONLY_SHOW_IN, osi_rb->isChecked() ?
+		orNull(desktops) : NULL)
+	    .set(DF_KEY_AFTER, orNull(after))
+	    .set(DF_KEY_REQUIRES, orNull(require))
+	    .set(DF_KEY_READY, ready_exit_cb->isChecked() ? "exit" : NULL)
+	    .set(DF_KEY_BACKGROUND, background_cb->isChecked() ? "true" : NULL)
+	    .set(DF_KEY_ALLOW_MULTIPLE,
+		allow_multiple_cb->isChecked() ? "true" : NULL)
+	    .set(DF_KEY_NEEDS_DISPLAY,
+		needs_display_cb->isChecked() ? "true" : NULL)
+	    .set(DF_KEY_NICE, orNull(nice))
+	    .set(DF_KEY_IO_CLASS, orNull(io_class))
+	    .set(DF_KEY_IO_PRIORITY, orNull(io_prio))
+	    .set(DF_KEY_CPU_AFFINITY, orNull(affinity))
+	    .set(DF_KEY_CGROUP, orNull(cgroup))
+	    .set(DF_KEY_CPU_WEIGHT, orNull(cpu_weight))
+	    .set(DF_KEY_MEMORY_HIGH, orNull(memory_high));
+	if (edit.error()) {
+		qh_warnx(this, "%s", edit.error().what());
+		return;
+	}
 	accept();
 }
 
 QGroupBox *
-EditWin::createVisibilityBox(entry_t *entry)
+EditWin::createVisibilityBox(File file)
 {
 	QGroupBox   *box  = new QGroupBox(tr("Visibility"));
 	QVBoxLayout *vbox = new QVBoxLayout;
@@ -141,14 +197,12 @@ EditWin::createVisibilityBox(entry_t *entry)
 	    "desktop environment names if\nyou want to limit the execution " \
 	    "of this command to certain environments.\nE.g.: MATE;XFCE"));
 	list_le->setEnabled(false);
-	if (entry != NULL) {
-		if (entry->df->not_show_in != NULL) {
-			nsi_rb->setChecked(true);
-			list_le->setText(entry->df->not_show_in);
-		} else if (entry->df->only_show_in != NULL) {
-			osi_rb->setChecked(true);
-			list_le->setText(entry->df->only_show_in);
-		}
+	if (file.has(DF_KEY_NOT_SHOW_IN)) {
+		nsi_rb->setChecked(true);
+		list_le->setText(qstr(file.value(DF_KEY_NOT_SHOW_IN)));
+	} else if (file.has(DF_KEY_ONLY_SHOW_IN)) {
+		osi_rb->setChecked(true);
+		list_le->setText(qstr(file.value(DF_KEY_ONLY_SHOW_IN)));
 	}
 	if (nsi_rb->isChecked() || osi_rb->isChecked())
 		list_le->setEnabled(true);
@@ -164,6 +218,110 @@ EditWin::createVisibilityBox(entry_t *entry)
 	return (box);
 }
 
+QGroupBox *
+EditWin::createDependencyBox(File file)
+{
+	QGroupBox   *box  = new QGroupBox(tr("Dependencies"));
+	QVBoxLayout *vbox = new QVBoxLayout;
+	QFormLayout *form = new QFormLayout;
+	after_edit	  = new QLineEdit;
+	requires_edit	  = new QLineEdit;
+	ready_exit_cb	  = new QCheckBox(tr("Dependent commands wait until " \
+					  "this command has finished"));
+	background_cb	  = new QCheckBox(tr("Start in the background when " \
+					  "the system is idle"));
+	allow_multiple_cb = new QCheckBox(tr("Start even if the command is " \
+					  "already running"));
+	needs_display_cb  = new QCheckBox(tr("Wait until the display server " \
+					  "accepts connections"));
+	QString tip = tr("Define a semicolon (;) separated list of desktop " \
+	    "file names.\nE.g.: panel.desktop;keyring.desktop");
+	after_edit->setToolTip(QString("%1\n%2").arg(tip)
+	    .arg(tr("The command is started after these commands.")));
+	requires_edit->setToolTip(QString("%1\n%2").arg(tip)
+	    .arg(tr("The command is started after these commands, and only " \
+		    "if they could be started.")));
+	after_edit->setText(qstr(file.value(DF_KEY_AFTER)));
+	requires_edit->setText(qstr(file.value(DF_KEY_REQUIRES)));
+	ready_exit_cb->setChecked(file.value(DF_KEY_READY) == "exit");
+	background_cb->setChecked(file.isTrue(DF_KEY_BACKGROUND));
+	allow_multiple_cb->setChecked(file.isTrue(DF_KEY_ALLOW_MULTIPLE));
+	needs_display_cb->setChecked(file.isTrue(DF_KEY_NEEDS_DISPLAY));
+	form->addRow(tr("Start after:"), after_edit);
+	form->addRow(tr("Requires:"), requires_edit);
+	vbox->addLayout(form);
+	vbox->addWidget(ready_exit_cb);
+	vbox->addWidget(background_cb);
+	vbox->addWidget(allow_multiple_cb);
+	vbox->addWidget(needs_display_cb);
+	box->setLayout(vbox);
+
+	return (box);
+}
+
+QGroupBox *
+EditWin::createResourceBox(File file)
+{
+	int	    i;
+	QGroupBox   *box  = new QGroupBox(tr("Resources"));
+	QFormLayout *form = new QFormLayout;
+	nice_sb		  = new QSpinBox;
+	io_class_cb	  = new QComboBox;
+	io_prio_sb	  = new QSpinBox;
+	affinity_edit	  = new QLineEdit;
+	cgroup_edit	  = new QLineEdit;
+	cpu_weight_sb	  = new QSpinBox;
+	memory_high_edit  = new QLineEdit;
+
+	/* The minimum of each spin box means "not set". */
+	nice_sb->setRange(-21, 19);
+	nice_sb->setSpecialValueText(tr("Default"));
+	nice_sb->setValue(nice_sb->minimum());
+	io_prio_sb->setRange(-1, 7);
+	io_prio_sb->setSpecialValueText(tr("Default"));
+	io_prio_sb->setValue(io_prio_sb->minimum());
+	cpu_weight_sb->setRange(0, 10000);
+	cpu_weight_sb->setSpecialValueText(tr("Default"));
+	cpu_weight_sb->setValue(cpu_weight_sb->minimum());
+
+	io_class_cb->addItem(tr("Default"), QString());
+	io_class_cb->addItem(tr("Idle"), QString("idle"));
+	io_class_cb->addItem(tr("Best effort"), QString("best-effort"));
+	io_class_cb->addItem(tr("Realtime"), QString("realtime"));
+
+	affinity_edit->setToolTip(tr("Define a semicolon (;) separated list " \
+	    "of CPUs and CPU ranges\nthe command may run on. E.g.: 0-3;6"));
+	cgroup_edit->setToolTip(tr("Name of the cgroup to run the command " \
+	    "in.\nCommands with the same cgroup share its limits."));
+	memory_high_edit->setToolTip(tr("Memory usage throttle limit of the " \
+	    "cgroup in bytes.\nThe suffixes K, M, G, and T are supported. "  \
+	    "E.g.: 512M"));
+	if (file.has(DF_KEY_NICE))
+		nice_sb->setValue(qstr(file.value(DF_KEY_NICE)).toInt());
+	if (file.has(DF_KEY_IO_CLASS) && (i = io_class_cb->findData(
+	    qstr(file.value(DF_KEY_IO_CLASS)))) > 0)
+		io_class_cb->setCurrentIndex(i);
+	if (file.has(DF_KEY_IO_PRIORITY))
+		io_prio_sb->setValue(qstr(file.value(DF_KEY_IO_PRIORITY)).toInt());
+	if (file.has(DF_KEY_CPU_WEIGHT)) {
+		cpu_weight_sb->setValue(
+		    qstr(file.value(DF_KEY_CPU_WEIGHT)).toInt());
+	}
+	affinity_edit->setText(qstr(file.value(DF_KEY_CPU_AFFINITY)));
+	cgroup_edit->setText(qstr(file.value(DF_KEY_CGROUP)));
+	memory_high_edit->setText(qstr(file.value(DF_KEY_MEMORY_HIGH)));
+	form->addRow(tr("Nice value:"), nice_sb);
+	form->addRow(tr("I/O class:"), io_class_cb);
+	form->addRow(tr("I/O priority:"), io_prio_sb);
+	form->addRow(tr("CPU affinity:"), affinity_edit);
+	form->addRow(tr("cgroup:"), cgroup_edit);
+	form->addRow(tr("CPU weight:"), cpu_weight_sb);
+	form->addRow(tr("Memory limit:"), memory_high_edit);
+	box->setLayout(form);
+
+	return (box);
+}
+
 void
 EditWin::nsi_osi_rb_toggled(bool /* state */)
 {
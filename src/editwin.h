@@ -31,32 +31,44 @@
 #include <QRadioButton>
 #include <QWidget>
 #include <QCheckBox>
+#include <QComboBox>
+#include <QSpinBox>
 
-#include "lib/dsbautostart.h"
+#include "lib/dsbautostart.hpp"
 
 class EditWin : public QDialog {
 	Q_OBJECT
 public:
-	EditWin(entry_t *entry, QWidget *parent = 0);
+	EditWin(dsbautostart::Entry entry, QWidget *parent = 0);
+	dsbautostart::Edit takeEdit(void);
 private slots:
 	void	     validate(void);
-	void	     terminalToggled(int state);
 	void 	     acceptSlot(void);
 	void	     nsi_osi_rb_toggled(bool);
-	QGroupBox    *createVisibilityBox(entry_t *entry);
-public:
-	bool	     terminal;
-	QByteArray   name;
-	QByteArray   command;
-	QByteArray   comment;
-	QByteArray   notShowIn;
-	QByteArray   onlyShowIn;
 private:
+	QGroupBox    *createVisibilityBox(dsbautostart::File file);
+	QGroupBox    *createDependencyBox(dsbautostart::File file);
+	QGroupBox    *createResourceBox(dsbautostart::File file);
+private:
+	dsbautostart::Edit edit;
 	QLineEdit    *name_edit;
 	QLineEdit    *command_edit;
 	QLineEdit    *comment_edit;
 	QLineEdit    *list_le;
+	QLineEdit    *after_edit;
+	QLineEdit    *requires_edit;
+	QLineEdit    *affinity_edit;
+	QLineEdit    *cgroup_edit;
+	QLineEdit    *memory_high_edit;
+	QSpinBox     *nice_sb;
+	QSpinBox     *io_prio_sb;
+	QSpinBox     *cpu_weight_sb;
+	QComboBox    *io_class_cb;
 	QCheckBox    *terminal_cb;
+	QCheckBox    *ready_exit_cb;
+	QCheckBox    *background_cb;
+	QCheckBox    *allow_multiple_cb;
+	QCheckBox    *needs_display_cb;
 	QStatusBar   *statusBar;
 	QPushButton  *ok_pb;
 	QRadioButton *nsi_rb;
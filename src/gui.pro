@@ -0,0 +1,54 @@
+include(../config.pri)
+
+QT	    += widgets
+CONFIG	    += c++17
+TEMPLATE     = app
+TARGET	     = $${GUI_PROGRAM}
+DEPENDPATH  += . .. ../lib ../lib/qt-helper
+INCLUDEPATH += . .. ../lib ../lib/qt-helper
+TRANSLATIONS = ../locale/dsbautostart_de.ts \
+               ../locale/dsbautostart_fr.ts
+APPSDIR	     = $${PREFIX}/share/applications
+DEFINES	    += LOCALE_PATH=\\\"$${DATADIR}\\\"
+DEFINES	    += APPSDIR=\\\"$${APPSDIR}\\\"
+LIBS	    += -L$$OUT_PWD/../lib -ldsbautostart
+PRE_TARGETDEPS += $$OUT_PWD/../lib/libdsbautostart.a
+INSTALLS     = target locales desktopfile
+QMAKE_POST_LINK = $(STRIP) $(TARGET)
+QMAKE_EXTRA_TARGETS += distclean cleanqm
+
+target.files	  = $${GUI_PROGRAM}
+target.path	  = $${LIBEXECDIR}
+
+desktopfile.path  = $${APPSDIR}
+desktopfile.files = ../$${PROGRAM}.desktop
+
+HEADERS += list.h \
+	   editwin.h \
+	   logwin.h \
+	   listwidget.h \
+           mainwin.h \
+	   desktopfile.h \
+	   ../lib/dsbautostart.h \
+	   ../lib/dsbautostart.hpp \
+           ../lib/qt-helper/qt-helper.h 
+SOURCES += list.cpp \
+	   editwin.cpp \
+	   logwin.cpp \
+	   listwidget.cpp \
+           main.cpp \
+           mainwin.cpp \
+	   desktopfile.cpp \
+           ../lib/qt-helper/qt-helper.cpp
+
+locales.path = $${DATADIR}
+
+qtPrepareTool(LRELEASE, lrelease)
+for(a, TRANSLATIONS) {
+	cmd = $$LRELEASE $$PWD/$${a}
+	system($$cmd)
+}
+locales.files += ../locale/*.qm
+
+cleanqm.commands  = rm -f $${locales.files}
+distclean.depends = cleanqm
@@ -23,36 +23,125 @@
  */
 
 #include <QVBoxLayout>
-#include <err.h>
+#include <QHeaderView>
+#include <stdlib.h>
 
 #include "list.h"
 #include "desktopfile.h"
 #include "qt-helper/qt-helper.h"
 
-List::List(dsbautostart_t *as, QWidget *parent)
-	: QWidget(parent) {
+#define ENV_DESKTOPS	 "DSBAUTOSTART_DESKTOPS"
+#define DEFAULT_DESKTOPS "GNOME:KDE:LXDE:LXQt:MATE:Openbox:XFCE"
+
+using dsbautostart::Entry;
+using dsbautostart::Error;
+
+static QString
+qstr(std::string_view s)
+{
+	return (QString::fromUtf8(s.data(), (int)s.size()));
+}
+
+/*
+ * Items store the ID of their entry, which is looked up in the session
+ * when needed, so they never refer to a freed entry.
+ */
+List::List(dsbautostart::Session &session, QWidget *parent)
+	: QWidget(parent), session(session) {
 	
 	list = new ListWidget(parent);
 	list->setMouseTracking(true);
-	this->as = as;
 
+	initDesktops();
+	QStringList labels(tr("Command"));
+	labels.append(desktops);
+	list->setColumnCount(labels.count());
+	list->setHeaderLabels(labels);
+	list->setRootIsDecorated(false);
+	list->setUniformRowHeights(true);
+	list->setAllColumnsShowFocus(true);
+	list->header()->setStretchLastSection(false);
+	list->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+	for (int i = 1; i < labels.count(); i++) {
+		list->header()->setSectionResizeMode(i,
+		    QHeaderView::ResizeToContents);
+	}
 	QVBoxLayout *vbox = new QVBoxLayout;
 	vbox->addWidget(list);
 	setLayout(vbox);
 	list->setToolTip(QString(tr("Use Drag & Drop to add desktop files.")));
-	list->setLayoutMode(QListView::Batched);
-	for (entry_t *entry = as->cur_entries; entry != NULL; entry = entry->next) {
-		if (!entry->deleted && !entry->exclude)
+	updateVisibility();
+	for (Entry entry : session.entries()) {
+		if (visible(entry))
 			addItem(entry);
 	}
 	_modified = false;
 	connect(list, SIGNAL(itemDroped(QStringList &)), this,
 	    SLOT(addDesktopFiles(QStringList &)));
-	connect(list, SIGNAL(itemDoubleClicked(QListWidgetItem *)), this,
-	    SLOT(catchDoubleClicked(QListWidgetItem *)));
+	connect(list, SIGNAL(itemDoubleClicked(QTreeWidgetItem *, int)), this,
+	    SLOT(catchDoubleClicked(QTreeWidgetItem *, int)));
 	connect(list, SIGNAL(deleteKeyPressed()), this, SLOT(delItem()));
 }
 
+/*
+ * Read the colon separated list of desktops to preview from
+ * DSBAUTOSTART_DESKTOPS, and convert each of them to a set once.
+ */
+void
+List::initDesktops()
+{
+	const char *env = getenv(ENV_DESKTOPS);
+
+	desktops = QString(env != NULL ? env : DEFAULT_DESKTOPS)
+	    .split(':', QString::SkipEmptyParts);
+	desktops.removeDuplicates();
+	// One bit per desktop in the visibility mask.
+	while (desktops.count() > 64)
+		desktops.removeLast();
+	for (QString &d : desktops)
+		desktopSets.append(dsbautostart_desktop_set(d.toUtf8().data()));
+}
+
+QStringList
+List::desktopNames()
+{
+	return (desktops);
+}
+
+/*
+ * Compute the visibility mask of the given entry. Only needed when the
+ * entry was added or changed.
+ */
+void
+List::updateVisibility(Entry entry)
+{
+	quint64 mask = 0;
+
+	for (int i = 0; i < desktopSets.count(); i++) {
+		if (entry.file().shownIn(desktopSets.at(i)))
+			mask |= (quint64)1 << i;
+	}
+	visibility.insert(entry.id(), mask);
+}
+
+void
+List::updateVisibility()
+{
+	visibility.clear();
+	for (Entry entry : session.entries())
+		updateVisibility(entry);
+}
+
+bool
+List::visible(Entry entry)
+{
+	if (showAll)
+		return (true);
+	if (desktopFilter < 0)
+		return (!entry.excluded());
+	return ((visibility.value(entry.id()) >> desktopFilter) & 1);
+}
+
 bool
 List::modified()
 {
@@ -72,121 +161,151 @@ List::setShowAll(bool show)
 	redraw();
 }
 
-entry_t *
+/*
+ * Show the entries started on the given desktop, which is an index into
+ * desktopNames(), or -1 for the current session.
+ */
+void
+List::setDesktopFilter(int desktop)
+{
+	desktopFilter = desktop;
+	redraw();
+}
+
+Entry
+List::entryOf(QTreeWidgetItem *item)
+{
+	return (session.entry(item->data(0, Qt::UserRole).toInt()));
+}
+
+Entry
 List::currentEntry()
 {
-	QListWidgetItem *item = list->currentItem();
+	QTreeWidgetItem *item = list->currentItem();
 
 	if (item == 0)
-		return (NULL);
-	return ((entry_t *)item->data(Qt::UserRole).value<void *>());
+		return (Entry());
+	return (entryOf(item));
 }
 
+/*
+ * Apply the given changes to the desktop file of the current item.
+ */
 void
-List::changeCurrentItem(QByteArray &name, QByteArray &command,
-    QByteArray &comment, QByteArray &notShowIn, QByteArray &onlyShowIn,
-    bool terminal)
+List::changeCurrentItem(dsbautostart::Edit edit)
 {
-	char		*nsi, *osi;
-	entry_t		*entry;
-	QListWidgetItem *item = list->currentItem();
+	Entry		entry;
+	QTreeWidgetItem *item = list->currentItem();
 
 	if (item == 0)
 		return;
-	if (notShowIn.isEmpty())
-		nsi = NULL;
-	else
-		nsi = notShowIn.data();
-	if (onlyShowIn.isEmpty())
-		osi = NULL;
-	else
-		osi = onlyShowIn.data();
-	entry = (entry_t *)item->data(Qt::UserRole).value<void *>();
-	if (dsbautostart_entry_set(as, entry, command.data(),
-	    name.data(), comment.data(), nsi, osi, terminal) == -1)
-		qh_errx(this, EXIT_FAILURE, "%s", dsbautostart_strerror());
-	item->setText(command);
-	if ((entry->df->name != NULL && *entry->df->name != '\0') ||
-	    (entry->df->comment != NULL && *entry->df->comment != '\0')) {
-		warnx("%s, %s", entry->df->name, entry->df->comment);
-		item->setToolTip(QString("%1\n%2")
-			.arg(entry->df->name != NULL ? entry->df->name : "")
-			.arg(entry->df->comment != NULL ? entry->df->comment : ""));
-	} else
-		item->setToolTip(QString(tr("No further description available")));
+	entry = entryOf(item);
+	Error error = session.set(entry, std::move(edit));
+	if (error)
+		qh_errx(this, EXIT_FAILURE, "%s", error.what());
+	updateVisibility(entry);
+	setItem(item, entry);
 	compare();
 }
 
+/*
+ * Add a new entry for the edited desktop file.
+ */
 void
-List::newItem(QByteArray &name, QByteArray &command, QByteArray &comment,
-    QByteArray &notShowIn, QByteArray &onlyShowIn, bool terminal)
+List::newItem(dsbautostart::Edit edit)
 {
-	char	*osi, *nsi;
-	entry_t *entry;
+	auto [entry, error] = session.add(std::move(edit));
 
-	if (notShowIn.isEmpty())
-		nsi = NULL;
-	else
-		nsi = notShowIn.data();
-	if (onlyShowIn.isEmpty())
-		osi = NULL;
-	else
-		osi = onlyShowIn.data();
-	entry = dsbautostart_entry_add(as, command.data(), name.data(),
-		    comment.data(), nsi, osi, terminal);
-	if (entry == NULL)
-		qh_errx(this, EXIT_FAILURE, "%s", dsbautostart_strerror());
-	QListWidgetItem *item = List::addItem(entry);
-	item->setText(command);
+	if (error)
+		qh_errx(this, EXIT_FAILURE, "%s", error.what());
+	updateVisibility(entry);
+	List::addItem(entry);
 	compare();
 }
 
-QListWidgetItem *
-List::addItem(entry_t *entry)
+QTreeWidgetItem *
+List::addItem(Entry entry)
 {
-	QListWidgetItem *item = new QListWidgetItem(
-	    entry->df->exec != NULL ? entry->df->exec : "");
+	QTreeWidgetItem *item = new QTreeWidgetItem;
+
 	item->setFlags(Qt::ItemIsSelectable | Qt::ItemIsEnabled);
-	item->setData(Qt::UserRole, QVariant::fromValue((void *)entry));
-	list->addItem(item);
+	item->setData(0, Qt::UserRole, entry.id());
+	setItem(item, entry);
+	list->addTopLevelItem(item);
 	items.append(item);
-	if ((entry->df->name != NULL && *entry->df->name != '\0') ||
-	    (entry->df->comment != NULL && *entry->df->comment != '\0')) {
-		item->setToolTip(QString("%1\n%2")
-			.arg(entry->df->name != NULL ? entry->df->name : "")
-			.arg(entry->df->comment != NULL ? entry->df->comment : ""));
-	} else
-		item->setToolTip(QString(tr("No further description available")));
+
 	return (item);
 }
 
+/*
+ * Set the command, tooltip, and the desktop columns of the given item.
+ */
+void
+List::setItem(QTreeWidgetItem *item, Entry entry)
+{
+	quint64		   mask	   = visibility.value(entry.id());
+	dsbautostart::File file	   = entry.file();
+	std::string_view   name	   = file.name();
+	std::string_view   comment = file.comment();
+
+	item->setText(0, qstr(file.value(DF_KEY_EXEC)));
+	if (!name.empty() || !comment.empty()) {
+		item->setToolTip(0, QString("%1\n%2")
+			.arg(qstr(name))
+			.arg(qstr(comment)));
+	} else
+		item->setToolTip(0, QString(tr("No further description available")));
+	if (!file.available()) {
+		item->setForeground(0, list->palette().brush(QPalette::Disabled,
+		    QPalette::Text));
+		item->setToolTip(0, QString("%1\n\n%2").arg(item->toolTip(0))
+		    .arg(tr("The program is not installed. It will not be " \
+			    "started.")));
+	} else
+		item->setForeground(0, list->palette().brush(QPalette::Text));
+	for (int i = 0; i < desktops.count(); i++) {
+		item->setCheckState(i + 1, (mask >> i) & 1 ? Qt::Checked :
+		    Qt::Unchecked);
+		item->setToolTip(i + 1, (mask >> i) & 1 ?
+		    tr("Started on %1").arg(desktops.at(i)) :
+		    tr("Not started on %1").arg(desktops.at(i)));
+	}
+}
+
+/*
+ * Delete the selected items as one undo step.
+ */
 void
 List::delItem()
 {
-	entry_t *entry;
-	QListWidgetItem *item = list->currentItem();
+	QList<QTreeWidgetItem *> selected = list->selectedItems();
 
-	if (item == 0)
+	if (selected.isEmpty())
 		return;
-	entry = (entry_t *)item->data(Qt::UserRole).value<void *>();
-	if (dsbautostart_entry_del(as, entry) == NULL)
-		qh_errx(this, EXIT_FAILURE, "%s", dsbautostart_strerror());
-	list->removeItemWidget(item);
-	items.removeOne(item);
-	delete item;
+	auto [txn, error] = session.begin();
+	if (error)
+		qh_errx(this, EXIT_FAILURE, "%s", error.what());
+	for (QTreeWidgetItem *item : selected) {
+		if ((error = session.del(entryOf(item))))
+			qh_errx(this, EXIT_FAILURE, "%s", error.what());
+		items.removeOne(item);
+		delete item;
+	}
+	(void)txn.commit();
 	compare();
 }
 
 void
-List::catchDoubleClicked(QListWidgetItem *item)
+List::catchDoubleClicked(QTreeWidgetItem *item, int /* column */)
 {
-	emit itemDoubleClicked((entry_t *)item->data(Qt::UserRole).value<void *>());
+	emit itemDoubleClicked(item->data(0, Qt::UserRole).toInt());
 }
 
 void
 List::undo()
 {
-	dsbautostart_undo(as);
+	session.undo();
+	updateVisibility();
 	redraw();
 	compare();
 }
@@ -194,42 +313,56 @@ List::undo()
 void
 List::redo()
 {
-	dsbautostart_redo(as);
+	session.redo();
+	updateVisibility();
 	redraw();
 	compare();
 }
 
+/*
+ * Refill the list from the entries, using the visibility masks computed
+ * before.
+ */
 void
 List::redraw()
 {
 	list->clear();
 	items.clear();
-	for (entry_t *entry = as->cur_entries; entry != NULL; entry = entry->next) {
-		if (entry->deleted)
-			continue;
-		if (entry->exclude && !showAll)
-			continue;
-		addItem(entry);
+	for (Entry entry : session.entries()) {
+		if (visible(entry))
+			addItem(entry);
 	}
 }
 
+/*
+ * Recompute the visibility, and redraw the list after the library
+ * changed entries, e.g. when merging changes of other programs.
+ */
+void
+List::refresh()
+{
+	updateVisibility();
+	redraw();
+	compare();
+}
+
 bool
 List::canUndo()
 {
-	return (dsbautostart_can_undo(as));
+	return (session.canUndo());
 }
 
 bool
 List::canRedo()
 {
 
-	return (dsbautostart_can_redo(as));
+	return (session.canRedo());
 }
 
 void
 List::compare()
 {
-	if (dsbautostart_changed(as)) {
+	if (session.changed()) {
 		emit listModified(true);
 		_modified = true;
 	} else	{
@@ -238,18 +371,28 @@ List::compare()
 	}
 }
 
+/*
+ * Add the given desktop files as one undo step. Files which are already
+ * in the list, hidden, or not desktop files are skipped. If one can't be
+ * read, none of them is added, because the transaction is rolled back
+ * when it goes out of scope.
+ */
 void
 List::addDesktopFiles(QStringList &list)
 {
-	entry_t *entry;
-
-	for (QString s : list) {
-		entry = dsbautostart_df_add(as, s.toLocal8Bit().data());
-		if (entry == NULL) {
-			qh_errx(this, EXIT_FAILURE, "%s",
-			    dsbautostart_strerror());
+	if (list.isEmpty())
+		return;
+	auto [txn, error] = session.begin();
+	if (error)
+		qh_errx(this, EXIT_FAILURE, "%s", error.what());
+	for (const QString &s : list) {
+		if ((error = session.addFile(s.toLocal8Bit().constData()).error)) {
+			qh_warnx(this, "%s", error.what());
+			return;
 		}
-		List::addItem(entry);
 	}
+	(void)txn.commit();
+	updateVisibility();
+	redraw();
 	compare();
 }
@@ -25,18 +25,20 @@
 #include <QMainWindow>
 #include <QApplication>
 #include <QStringList>
-#include <QListWidget>
+#include <QTreeWidget>
 #include <QWidget>
 #include <QObject>
+#include <QHash>
+#include <QVector>
 
-#include "lib/dsbautostart.h"
+#include "lib/dsbautostart.hpp"
 #include "listwidget.h"
 
 class List : public QWidget {
 	Q_OBJECT
 public:
-	List(dsbautostart_t *as, QWidget *parent = 0);
-	QListWidgetItem *addItem(entry_t *entry);
+	List(dsbautostart::Session &session, QWidget *parent = 0);
+	QTreeWidgetItem *addItem(dsbautostart::Entry entry);
 	bool modified();
 	bool canUndo();
 	bool canRedo();
@@ -44,30 +46,39 @@ public:
 	void undo();
 	void redo();
 	void redraw();
+	void refresh();
 	void unsetModified();
 	void setShowAll(bool show);
-	void newItem(QByteArray &name, QByteArray &command, QByteArray &comment,
-		     QByteArray &notShowIn, QByteArray &onlyShowIn,
-		     bool terminal);
-	void changeCurrentItem(QByteArray &name, QByteArray &command,
-			       QByteArray &comment, QByteArray &notShowIn,
-			       QByteArray &onlyShowIn, bool terminal);
-	entry_t *currentEntry(void);
+	void setDesktopFilter(int desktop);
+	QStringList desktopNames();
+	void newItem(dsbautostart::Edit edit);
+	void changeCurrentItem(dsbautostart::Edit edit);
+	dsbautostart::Entry currentEntry(void);
 
 public slots:
 	void delItem();
+	void addDesktopFiles(QStringList &list);
 signals:
 	void listModified(bool);
-	void itemDoubleClicked(entry_t *entry);
+	void itemDoubleClicked(int id);
 private slots:
-	void addDesktopFiles(QStringList &list);
-	void catchDoubleClicked(QListWidgetItem *item);
+	void catchDoubleClicked(QTreeWidgetItem *item, int column);
 private:
 	void compare();
+	void initDesktops();
+	void updateVisibility(dsbautostart::Entry entry);
+	void updateVisibility();
+	bool visible(dsbautostart::Entry entry);
+	void setItem(QTreeWidgetItem *item, dsbautostart::Entry entry);
+	dsbautostart::Entry entryOf(QTreeWidgetItem *item);
 private:
+	int	       desktopFilter = -1;	// -1 = current session
 	bool	       _modified;
 	bool	       showAll = false;
 	ListWidget     *list;
-	dsbautostart_t *as;
-	QList<QListWidgetItem *> items;
+	dsbautostart::Session &session;
+	QStringList    desktops;		// Desktops to preview
+	QVector<desktop_set_t>	     desktopSets;
+	QHash<int, quint64>	     visibility; // Bit n: Shown in desktops[n]
+	QList<QTreeWidgetItem *> items;
 };
@@ -27,10 +27,11 @@
 
 #include "listwidget.h"
 
-ListWidget::ListWidget(QWidget* parent) : QListWidget(parent)
+ListWidget::ListWidget(QWidget* parent) : QTreeWidget(parent)
 {
 	this->setAcceptDrops(true);
 	this->setDropIndicatorShown(true);
+	this->setSelectionMode(QAbstractItemView::ExtendedSelection);
 }
 
 void ListWidget::dropEvent(QDropEvent* event)
@@ -75,5 +76,5 @@ void ListWidget::keyPressEvent(QKeyEvent *event)
 		emit deleteKeyPressed();
 		event->accept();
 	} else
-		QListView::keyPressEvent(event);
+		QTreeView::keyPressEvent(event);
 }
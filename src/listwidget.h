@@ -23,10 +23,10 @@
  */
 
 #pragma once
-#include <QListWidget>
+#include <QTreeWidget>
 #include <QDropEvent>
 
-class ListWidget : public QListWidget
+class ListWidget : public QTreeWidget
 {
 	Q_OBJECT
 public:
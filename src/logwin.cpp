@@ -0,0 +1,82 @@
+/*-
+ * Copyright (c) 2019 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QFile>
+#include <QFontDatabase>
+#include <QHBoxLayout>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QVBoxLayout>
+
+#include "logwin.h"
+#include "qt-helper/qt-helper.h"
+
+LogWin::LogWin(const QString &title, const char *path, QWidget *parent) :
+    QDialog(parent) {
+	QIcon reloadIcon    = qh_loadIcon("view-refresh", NULL);
+	QIcon closeIcon	    = qh_loadStockIcon(QStyle::SP_DialogCloseButton);
+	QPushButton *reload = new QPushButton(reloadIcon, tr("&Reload"));
+	QPushButton *close  = new QPushButton(closeIcon, tr("&Close"));
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	QHBoxLayout *bbox   = new QHBoxLayout;
+	text		    = new QPlainTextEdit;
+	this->path	    = QString(path);
+
+	text->setReadOnly(true);
+	text->setLineWrapMode(QPlainTextEdit::NoWrap);
+	text->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+	bbox->addWidget(reload, 1, Qt::AlignRight);
+	bbox->addWidget(close, 0, Qt::AlignRight);
+	layout->addWidget(text);
+	layout->addLayout(bbox);
+
+	connect(reload, SIGNAL(clicked()), this, SLOT(reload()));
+	connect(close, SIGNAL(clicked()), this, SLOT(accept()));
+
+	setWindowTitle(tr("Log of %1").arg(title));
+	setWindowIcon(qh_loadIcon("text-x-generic", NULL));
+	if (parent)
+		resize(parent->width(), parent->height());
+	reload();
+}
+
+/*
+ * Show the rotated log followed by the current one.
+ */
+void
+LogWin::reload()
+{
+	QString contents;
+	QFile	old(path + ".1"), cur(path);
+
+	if (old.open(QIODevice::ReadOnly | QIODevice::Text))
+		contents += QString::fromLocal8Bit(old.readAll());
+	if (cur.open(QIODevice::ReadOnly | QIODevice::Text))
+		contents += QString::fromLocal8Bit(cur.readAll());
+	if (contents.isEmpty())
+		text->setPlaceholderText(tr("No output recorded"));
+	text->setPlainText(contents);
+	text->verticalScrollBar()->setValue(
+	    text->verticalScrollBar()->maximum());
+}
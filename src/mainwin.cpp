@@ -23,29 +23,33 @@
  */
 
 #include <QMessageBox>
+#include <QFileDialog>
 #include <QCloseEvent>
 
 #include "mainwin.h"
 #include "editwin.h"
+#include "logwin.h"
 #include "qt-helper/qt-helper.h"
 
 #define PB_STYLE "padding: 2px; text-align: left;"
 
 Mainwin::Mainwin(QWidget *parent) : 
     QMainWindow(parent) {
-	if ((cmdlist = dsbautostart_init()) == NULL) {
-		if (dsbautostart_error()) {
-			qh_errx(parent, EXIT_FAILURE, "dsbautostart_init(): %s",
-			    dsbautostart_strerror());
-		}
+	auto [s, error] = dsbautostart::Session::open();
+	if (error) {
+		qh_errx(parent, EXIT_FAILURE, "dsbautostart_init(): %s",
+		    error.what());
 	}
+	session = std::move(s);
 	QIcon runIcon	   = qh_loadIcon("system-run", NULL);
 	QIcon editIcon	   = qh_loadIcon("edit", NULL);
 	QIcon addIcon	   = qh_loadIcon("list-add", NULL);
+	QIcon importIcon   = qh_loadIcon("document-open", NULL);
 	QIcon delIcon	   = qh_loadIcon("edit-delete", NULL);
 	QIcon undoIcon	   = qh_loadIcon("edit-undo", NULL);
 	QIcon redoIcon	   = qh_loadIcon("edit-redo", NULL);
 	QIcon saveIcon	   = qh_loadIcon("document-save", NULL);
+	QIcon logIcon	   = qh_loadIcon("text-x-generic", NULL);
 	QIcon quitIcon	   = qh_loadStockIcon(QStyle::SP_DialogCloseButton);
 	if (undoIcon.isNull())
 		undoIcon = qh_loadStockIcon(QStyle::SP_ArrowLeft);
@@ -53,27 +57,36 @@ Mainwin::Mainwin(QWidget *parent) :
 		addIcon = qh_loadStockIcon(QStyle::SP_FileDialogNewFolder);
 	if (editIcon.isNull())
 		editIcon = qh_loadStockIcon(QStyle::SP_ArrowRight);
+	if (importIcon.isNull())
+		importIcon = qh_loadStockIcon(QStyle::SP_DialogOpenButton);
 	if (delIcon.isNull())
 		delIcon = qh_loadStockIcon(QStyle::SP_TrashIcon);
 	if (saveIcon.isNull())
 		saveIcon = qh_loadStockIcon(QStyle::SP_DialogSaveButton);
+	if (logIcon.isNull())
+		logIcon = qh_loadStockIcon(QStyle::SP_FileDialogContentsView);
 
-	list		   = new List(cmdlist, this);
+	list		   = new List(session, this);
 	redo		   = new QPushButton(redoIcon, tr("&Redo"), this);
 	undo		   = new QPushButton(undoIcon, tr("&Undo"), this);
 	show_all_cb	   = new QCheckBox(tr("Show all"));
+	desktop_cb	   = new QComboBox;
+	QLabel *desktop_l  = new QLabel(tr("Show entries started on:"));
 	QWidget *container = new QWidget();
 	QLabel *label	   = new QLabel(tr("Add commands to be executed on " \
 					"session start"));
 	QLabel *pic	   = new QLabel();
 	QPushButton *add   = new QPushButton(addIcon,  tr("&New"),    this);
+	QPushButton *imp   = new QPushButton(importIcon, tr("&Import"), this);
 	QPushButton *del   = new QPushButton(delIcon,  tr("&Delete"), this);
 	QPushButton *edit  = new QPushButton(editIcon, tr("&Edit"),   this);
+	QPushButton *log   = new QPushButton(logIcon,  tr("Show &log"), this);
 	QPushButton *save  = new QPushButton(saveIcon, tr("&Save"),   this);
 	QPushButton *quit  = new QPushButton(quitIcon, tr("&Quit"),   this);
 	QHBoxLayout *bhbox = new QHBoxLayout;
 	QHBoxLayout *hhbox = new QHBoxLayout;
 	QHBoxLayout *hbox  = new QHBoxLayout;
+	QHBoxLayout *fhbox = new QHBoxLayout;
 	QVBoxLayout *vbox  = new QVBoxLayout;
 	QVBoxLayout *bvbox = new QVBoxLayout;
 
@@ -81,6 +94,12 @@ Mainwin::Mainwin(QWidget *parent) :
 	show_all_cb->setChecked(false);
 	show_all_cb->setToolTip(tr("Show entries not visible for " \
 	    "the current desktop environment"));
+	desktop_cb->addItem(tr("This session"));
+	desktop_cb->addItems(list->desktopNames());
+	desktop_cb->setToolTip(tr("Preview the entries started in another " \
+	    "desktop environment.\nSet DSBAUTOSTART_DESKTOPS to a colon " \
+	    "separated list to change the desktops."));
+	desktop_l->setBuddy(desktop_cb);
 
 	undo->setStyleSheet(PB_STYLE);
 	undo->setEnabled(list->canUndo());
@@ -89,20 +108,27 @@ Mainwin::Mainwin(QWidget *parent) :
 	redo->setEnabled(list->canRedo());
 
 	add->setStyleSheet(PB_STYLE);
+	imp->setStyleSheet(PB_STYLE);
+	imp->setToolTip(tr("Add desktop files of installed applications"));
 	del->setStyleSheet(PB_STYLE);
 	edit->setStyleSheet(PB_STYLE);
+	log->setStyleSheet(PB_STYLE);
 
 	connect(list, SIGNAL(listModified(bool)), this,
 	    SLOT(catchListModified(bool)));
-	connect(list, SIGNAL(itemDoubleClicked(entry_t *)), this,
-	    SLOT(catchItemDoubleClicked(entry_t *)));
+	connect(list, SIGNAL(itemDoubleClicked(int)), this,
+	    SLOT(catchItemDoubleClicked(int)));
 	connect(del,  SIGNAL(clicked()), this, SLOT(delClicked()));
 	connect(add,  SIGNAL(clicked()), this, SLOT(addClicked()));
+	connect(imp,  SIGNAL(clicked()), this, SLOT(importClicked()));
 	connect(edit, SIGNAL(clicked()), this, SLOT(editClicked()));
+	connect(log,  SIGNAL(clicked()), this, SLOT(logClicked()));
 	connect(undo, SIGNAL(clicked()), this, SLOT(undoClicked()));
 	connect(redo, SIGNAL(clicked()), this, SLOT(redoClicked()));
 	connect(show_all_cb, SIGNAL(stateChanged(int)), this,
 	    SLOT(showAll(int)));
+	connect(desktop_cb, SIGNAL(currentIndexChanged(int)), this,
+	    SLOT(desktopChanged(int)));
 	connect(save, SIGNAL(clicked(bool)), this, SLOT(save()));
 	connect(quit, SIGNAL(clicked(bool)), this, SLOT(quit()));
 
@@ -110,8 +136,10 @@ Mainwin::Mainwin(QWidget *parent) :
 	bvbox->addWidget(undo, 1);
 	bvbox->addWidget(redo, 1);
 	bvbox->addWidget(add, 1);
+	bvbox->addWidget(imp, 1);
 	bvbox->addWidget(edit, 1);
 	bvbox->addWidget(del, 1);
+	bvbox->addWidget(log, 1);
 	bvbox->addStretch(1);
 
 	hbox->addWidget(list);
@@ -123,7 +151,11 @@ Mainwin::Mainwin(QWidget *parent) :
 	bhbox->addWidget(quit,  0, Qt::AlignRight);
 	vbox->addLayout(hhbox);
 	vbox->addLayout(hbox);
-	vbox->addWidget(show_all_cb);
+	fhbox->addWidget(desktop_l);
+	fhbox->addWidget(desktop_cb);
+	fhbox->addStretch(1);
+	fhbox->addWidget(show_all_cb);
+	vbox->addLayout(fhbox);
 	vbox->addLayout(bhbox);
 	vbox->setContentsMargins(15, 15, 15, 15);
 
@@ -134,6 +166,11 @@ Mainwin::Mainwin(QWidget *parent) :
 	setWindowIcon(qh_loadIcon("system-run", NULL));
 }
 
+Mainwin::~Mainwin()
+{
+	session.dumpStats();
+}
+
 void
 Mainwin::catchListModified(bool status)
 {
@@ -143,14 +180,19 @@ Mainwin::catchListModified(bool status)
 }
 
 void
-Mainwin::catchItemDoubleClicked(entry_t *entry)
+Mainwin::catchItemDoubleClicked(int id)
+{
+	editEntry(session.entry(id));
+}
+
+void
+Mainwin::editEntry(dsbautostart::Entry entry)
 {
-	if (entry == NULL)
+	if (!entry)
 		return;
 	EditWin edit(entry, this);
 	if (edit.exec() == QDialog::Accepted) {
-		list->changeCurrentItem(edit.name, edit.command,
-		    edit.comment, edit.notShowIn, edit.onlyShowIn, edit.terminal);
+		list->changeCurrentItem(edit.takeEdit());
 		list->redraw();
 	}
 }
@@ -158,14 +200,64 @@ Mainwin::catchItemDoubleClicked(entry_t *entry)
 void
 Mainwin::save()
 {
-	if (dsbautostart_save(cmdlist) == -1) {
+	conflict_policy_t   policy;
+	dsbautostart::Error error = session.save();
+
+	if (error.conflict()) {
+		if (!resolveConflict(error, &policy))
+			return;
+		error = session.save(policy);
+		list->refresh();
+	}
+	if (error) {
 		qh_errx(this, EXIT_FAILURE, "dsbautostart_save(): %s",
-		    dsbautostart_strerror());
+		    error.what());
 	}
 	list->unsetModified();
 	statusBar()->showMessage(tr("Saved"), 5000);
 }
 
+/*
+ * Ask the user what to do with autostart files changed by another program
+ * since they were loaded, and return the conflict policy to save with in
+ * "policy". Returns false if saving was canceled.
+ */
+bool
+Mainwin::resolveConflict(const dsbautostart::Error &error,
+	conflict_policy_t *policy)
+{
+	QMessageBox msgBox(this);
+
+	msgBox.setWindowModality(Qt::WindowModal);
+	msgBox.setWindowTitle(tr("Autostart files changed"));
+	msgBox.setText(tr("Another program changed autostart files since " \
+	    "they were loaded."));
+	msgBox.setDetailedText(QString(error.what()));
+	msgBox.setInformativeText(tr("Merge keeps their changes, and " \
+	    "applies yours on top. Keep theirs discards your changes to " \
+	    "those files. Overwrite discards theirs."));
+	QPushButton *merge = msgBox.addButton(tr("&Merge"),
+	    QMessageBox::AcceptRole);
+	QPushButton *theirs = msgBox.addButton(tr("&Keep theirs"),
+	    QMessageBox::DestructiveRole);
+	QPushButton *overwrite = msgBox.addButton(tr("&Overwrite"),
+	    QMessageBox::DestructiveRole);
+	msgBox.addButton(QMessageBox::Cancel);
+	msgBox.setDefaultButton(merge);
+	msgBox.setIcon(QMessageBox::Warning);
+	msgBox.exec();
+
+	if (msgBox.clickedButton() == merge)
+		*policy = CONFLICT_MERGE;
+	else if (msgBox.clickedButton() == theirs)
+		*policy = CONFLICT_RELOAD;
+	else if (msgBox.clickedButton() == overwrite)
+		*policy = CONFLICT_OVERWRITE;
+	else
+		return (false);
+	return (true);
+}
+
 void
 Mainwin::quit()
 {
@@ -192,6 +284,9 @@ Mainwin::quit()
 	switch (msgBox.exec()) {
 	case QMessageBox::Save:
 		save();
+		/* Saving was canceled */
+		if (list->modified())
+			return;
 	case QMessageBox::Discard:
 		QApplication::quit();
 	}
@@ -207,36 +302,54 @@ Mainwin::closeEvent(QCloseEvent *event)
 void
 Mainwin::editClicked()
 {
-	entry_t *entry = list->currentEntry();
-	
-	if (entry == NULL)
-		return;
-	EditWin edit(entry, this);
-	if (edit.exec() == QDialog::Accepted) {
-		list->changeCurrentItem(edit.name, edit.command,
-		    edit.comment, edit.notShowIn, edit.onlyShowIn, edit.terminal);
-		list->redraw();
-	}
+	editEntry(list->currentEntry());
 }
 
 void
 Mainwin::addClicked()
 {
-	EditWin edit(NULL, this);
+	EditWin edit(dsbautostart::Entry(), this);
 
 	if (edit.exec() == QDialog::Accepted) {
-		list->newItem(edit.name, edit.command, edit.comment,
-		    edit.notShowIn, edit.onlyShowIn, edit.terminal);
+		list->newItem(edit.takeEdit());
 		list->redraw();
 	}
 }
 
+void
+Mainwin::importClicked()
+{
+	QStringList files = QFileDialog::getOpenFileNames(this,
+	    tr("Import desktop files"), APPSDIR,
+	    tr("Desktop files (*.desktop)"));
+	list->addDesktopFiles(files);
+}
+
 void
 Mainwin::delClicked()
 {
 	list->delItem();
 }
 
+void
+Mainwin::logClicked()
+{
+	dsbautostart::File file = list->currentEntry().file();
+
+	if (!file)
+		return;
+	auto [path, error] = file.logPath();
+	if (error) {
+		qh_warnx(this, "%s", error.what());
+		return;
+	}
+	std::string_view title = !file.name().empty() ? file.name() :
+	    file.value(DF_KEY_EXEC);
+	LogWin logwin(QString::fromUtf8(title.data(), (int)title.size()),
+	    path.c_str(), this);
+	logwin.exec();
+}
+
 void
 Mainwin::undoClicked()
 {
@@ -254,3 +367,10 @@ Mainwin::showAll(int state)
 {
 	list->setShowAll((state == Qt::Unchecked ? false : true));
 }
+
+void
+Mainwin::desktopChanged(int index)
+{
+	// Index 0 is the current session.
+	list->setDesktopFilter(index - 1);
+}
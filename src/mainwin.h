@@ -31,6 +31,7 @@
 #include <QMainWindow>
 #include <QLineEdit>
 #include <QCheckBox>
+#include <QComboBox>
 #include <QScrollArea>
 #include <QStatusBar>
 #include <QList>
@@ -41,6 +42,7 @@ class Mainwin : public QMainWindow {
 	Q_OBJECT
 public:
 	Mainwin(QWidget *paren = 0);
+	~Mainwin();
 	void closeEvent(QCloseEvent *event);
 
 private slots:
@@ -48,15 +50,23 @@ private slots:
 	void save();
 	void quit();
 	void addClicked();
+	void importClicked();
 	void delClicked();
+	void logClicked();
 	void undoClicked();
 	void redoClicked();
 	void catchListModified(bool state);
-	void catchItemDoubleClicked(entry_t *entry);
+	void catchItemDoubleClicked(int id);
 	void showAll(int state);
+	void desktopChanged(int index);
+private:
+	bool resolveConflict(const dsbautostart::Error &error,
+		conflict_policy_t *policy);
+	void editEntry(dsbautostart::Entry entry);
 private:
 	List	       *list;
 	QCheckBox      *show_all_cb;
+	QComboBox      *desktop_cb;
 	QPushButton    *undo, *redo;
-	dsbautostart_t *cmdlist;
+	dsbautostart::Session session;
 };